@@ -36,6 +36,7 @@
 
 /* TEMP/PRESS/HUMID reading skipped */
 #define BME680_MEAS_SKIPPED			0x8000
+#define BME680_MEAS_SKIPPED_20BIT		0x80000
 
 #define BME680_MAX_OVERFLOW_VAL			0x40000000
 #define BME680_HUM_REG_SHIFT_VAL		4
@@ -56,8 +57,22 @@
 #define   BME680_NB_CONV_MASK			GENMASK(3, 0)
 
 #define BME680_REG_MEAS_STAT_0			0x1D
+#define   BME680_NEW_DATA_BIT			BIT(7)
 #define   BME680_GAS_MEAS_BIT			BIT(6)
 
+/* Result registers, MEAS_STAT_0 up to GAS_R_LSB, read in one burst */
+#define BME680_MEAS_DATA_LEN			15
+#define   BME680_MEAS_PRESS			(BME680_REG_PRESS_MSB - \
+						 BME680_REG_MEAS_STAT_0)
+#define   BME680_MEAS_TEMP			(BME680_REG_TEMP_MSB - \
+						 BME680_REG_MEAS_STAT_0)
+#define   BME680_MEAS_HUMID			(BM6880_REG_HUMIDITY_MSB - \
+						 BME680_REG_MEAS_STAT_0)
+#define   BME680_MEAS_GAS			(BME680_REG_GAS_MSB - \
+						 BME680_REG_MEAS_STAT_0)
+#define BME680_MEAS_TRIES			5
+#define BME680_MEAS_RETRY_US			5000
+
 /* Calibration Parameters */
 #define BME680_T2_LSB_REG	0x8A
 #define BME680_T3_REG		0x8C
@@ -86,8 +101,10 @@
 #define BME680_GH3_REG		0xEE
 
 extern const struct regmap_config bme680_regmap_config;
+extern const struct dev_pm_ops bme680_pm_ops;
 
 int bme680_core_probe(struct device *dev, struct regmap *regmap,
 		      const char *name);
+void bme680_core_remove(struct device *dev);
 
 #endif  /* BME680_H_ */
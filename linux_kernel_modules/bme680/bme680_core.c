@@ -10,12 +10,18 @@
  */
 #include <linux/acpi.h>
 #include "bitfield.h"
+#include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/module.h>
 #include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/pm.h>
 #include <linux/regmap.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/version.h>
 #include "bme680.h"
 
@@ -58,14 +64,33 @@ struct bme680_calib {
 	s8  range_sw_err;
 };
 
+/* Compensated results of one forced conversion */
+struct bme680_snapshot {
+	s16 temp;	/* 0.01 degC */
+	u32 press;	/* Pa */
+	u32 humid;	/* 0.001 %rH */
+	u32 gas;	/* Ohm, 0 when not measured or heater unstable */
+};
+
+enum bme680_scan {
+	BME680_SCAN_TEMP,
+	BME680_SCAN_PRESS,
+	BME680_SCAN_HUMID,
+	BME680_SCAN_GAS,
+	BME680_SCAN_TIMESTAMP,
+};
+
 struct bme680_data {
 	struct regmap *regmap;
+	/* Serializes forced conversions and configuration changes */
+	struct mutex lock;
 	struct bme680_calib bme680;
 	u8 oversampling_temp;
 	u8 oversampling_press;
 	u8 oversampling_humid;
 	u16 heater_dur;
 	u16 heater_temp;
+	bool run_gas;
 	/*
 	 * Carryover value from temperature conversion, used in pressure
 	 * and humidity compensation calculations.
@@ -75,40 +100,84 @@ struct bme680_data {
 #ifndef REGMAP_SUPPORTS_GET_DEVICE
 	struct device *dev;
 #endif /* REGMAP_SUPPORTS_GET_DEVICE */
+	/* 4 x 32 bit channels + 64 bit timestamp */
+	u32 scan[6] __aligned(8);
 };
 
+/*
+ * Only the oversampling, filter and heater settings are cached, so changing
+ * them costs a single write and resume can restore them with regcache_sync().
+ * CTRL_MEAS is left out as the chip drops back to sleep mode on its own.
+ */
+static bool bme680_is_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case BME680_REG_RES_HEAT_0:
+	case BME680_REG_GAS_WAIT_0:
+	case BME680_REG_CTRL_GAS_1:
+	case BME680_REG_CTRL_HUMIDITY:
+	case BME680_REG_CONFIG:
+		return false;
+	default:
+		return true;
+	}
+}
+
 const struct regmap_config bme680_regmap_config = {
 	.reg_bits = 8,
 	.val_bits = 8,
+
+	.cache_type = REGCACHE_RBTREE,
+	.volatile_reg = bme680_is_volatile_reg,
 };
 EXPORT_SYMBOL(bme680_regmap_config);
 
+#ifdef IIO_SUPPORTS_OVERSAMPLING_RATIO
+#define BME680_INFO_OVERSAMPLING_RATIO	BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO)
+#else
+#define BME680_INFO_OVERSAMPLING_RATIO	0
+#endif
+
+#define BME680_SCAN_TYPE(_sign) {					\
+	.sign = _sign,							\
+	.realbits = 32,							\
+	.storagebits = 32,						\
+	.endianness = IIO_CPU,						\
+}
+
 static const struct iio_chan_spec bme680_channels[] = {
 	{
 		.type = IIO_TEMP,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED)
-#ifdef IIO_SUPPORTS_OVERSAMPLING_RATIO
-				    | BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),
-#endif
+		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) |
+				      BIT(IIO_CHAN_INFO_SCALE) |
+				      BME680_INFO_OVERSAMPLING_RATIO,
+		.scan_index = BME680_SCAN_TEMP,
+		.scan_type = BME680_SCAN_TYPE('s'),
 	},
 	{
 		.type = IIO_PRESSURE,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED)
-#ifdef IIO_SUPPORTS_OVERSAMPLING_RATIO
-				    | BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),
-#endif
+		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) |
+				      BIT(IIO_CHAN_INFO_SCALE) |
+				      BME680_INFO_OVERSAMPLING_RATIO,
+		.scan_index = BME680_SCAN_PRESS,
+		.scan_type = BME680_SCAN_TYPE('u'),
 	},
 	{
 		.type = IIO_HUMIDITYRELATIVE,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED)
-#ifdef IIO_SUPPORTS_OVERSAMPLING_RATIO
-				    | BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),
-#endif
+		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) |
+				      BIT(IIO_CHAN_INFO_SCALE) |
+				      BME680_INFO_OVERSAMPLING_RATIO,
+		.scan_index = BME680_SCAN_HUMID,
+		.scan_type = BME680_SCAN_TYPE('u'),
 	},
 	{
 		.type = IIO_RESISTANCE,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED),
+		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) |
+				      BIT(IIO_CHAN_INFO_SCALE),
+		.scan_index = BME680_SCAN_GAS,
+		.scan_type = BME680_SCAN_TYPE('u'),
 	},
+	IIO_CHAN_SOFT_TIMESTAMP(BME680_SCAN_TIMESTAMP),
 };
 
 static int bme680_read_calib(struct bme680_data *data,
@@ -503,6 +572,11 @@ static u8 bme680_calc_heater_dur(u16 dur)
 	return durval;
 }
 
+static u8 bme680_oversampling_to_reg(u8 val)
+{
+	return ilog2(val) + 1;
+}
+
 static int bme680_set_mode(struct bme680_data *data, bool mode)
 {
 #ifdef REGMAP_SUPPORTS_GET_DEVICE
@@ -511,16 +585,26 @@ static int bme680_set_mode(struct bme680_data *data, bool mode)
 	struct device *dev = data->dev;
 #endif
 	int ret;
+	u8 osrs;
+
+	/*
+	 * CTRL_MEAS is not cached, write it whole from the oversampling
+	 * settings rather than reading it back first.
+	 */
+	osrs = FIELD_PREP(BME680_OSRS_TEMP_MASK,
+			  bme680_oversampling_to_reg(data->oversampling_temp)) |
+	       FIELD_PREP(BME680_OSRS_PRESS_MASK,
+			  bme680_oversampling_to_reg(data->oversampling_press));
 
 	if (mode) {
-		ret = regmap_write_bits(data->regmap, BME680_REG_CTRL_MEAS,
-					BME680_MODE_MASK, BME680_MODE_FORCED);
+		ret = regmap_write(data->regmap, BME680_REG_CTRL_MEAS,
+				   osrs | BME680_MODE_FORCED);
 		if (ret < 0)
 			dev_err(dev, "failed to set forced mode\n");
 
 	} else {
-		ret = regmap_write_bits(data->regmap, BME680_REG_CTRL_MEAS,
-					BME680_MODE_MASK, BME680_MODE_SLEEP);
+		ret = regmap_write(data->regmap, BME680_REG_CTRL_MEAS,
+				   osrs | BME680_MODE_SLEEP);
 		if (ret < 0)
 			dev_err(dev, "failed to set sleep mode\n");
 
@@ -529,11 +613,6 @@ static int bme680_set_mode(struct bme680_data *data, bool mode)
 	return ret;
 }
 
-static u8 bme680_oversampling_to_reg(u8 val)
-{
-	return ilog2(val) + 1;
-}
-
 static int bme680_chip_config(struct bme680_data *data)
 {
 #ifdef REGMAP_SUPPORTS_GET_DEVICE
@@ -608,199 +687,221 @@ static int bme680_gas_config(struct bme680_data *data)
 		return ret;
 	}
 
-	/* Enable the gas sensor and select heater profile set-point 0 */
+	/*
+	 * Select heater profile set-point 0. The gas sensor itself is only
+	 * run by conversions that need it, see bme680_measure().
+	 */
 	ret = regmap_update_bits(data->regmap, BME680_REG_CTRL_GAS_1,
 				 BME680_RUN_GAS_MASK | BME680_NB_CONV_MASK,
-				 FIELD_PREP(BME680_RUN_GAS_MASK, 1) |
+				 FIELD_PREP(BME680_RUN_GAS_MASK, 0) |
 				 FIELD_PREP(BME680_NB_CONV_MASK, 0));
 	if (ret < 0)
 		dev_err(dev, "failed to write ctrl_gas_1 register\n");
+	data->run_gas = false;
 
 	return ret;
 }
 
-static int bme680_read_temp(struct bme680_data *data,
-			    int *val, int *val2)
+/*
+ * Conversion time of one forced measurement, after the Bosch BME680 API:
+ * https://github.com/BoschSensortec/BME680_driver/blob/63bb5336/bme680.c#L1140
+ */
+static unsigned int bme680_meas_duration_us(struct bme680_data *data,
+					    bool gas)
+{
+	unsigned int dur;
+
+	dur = (data->oversampling_temp + data->oversampling_press +
+	       data->oversampling_humid) * 1963;
+	dur += 477 * 4;	/* TPH switching */
+	dur += 477 * 5;	/* gas measurement */
+	dur += 1000;	/* wake up */
+	if (gas)
+		dur += data->heater_dur * 1000;
+
+	return dur;
+}
+
+/*
+ * Runs one forced conversion, heating the gas sensor only when @gas is set,
+ * reads all result registers in one burst and compensates every channel
+ * from the same t_fine. Called with data->lock held.
+ */
+static int bme680_measure(struct bme680_data *data, bool gas,
+			  struct bme680_snapshot *snap)
 {
 #ifdef REGMAP_SUPPORTS_GET_DEVICE
 	struct device *dev = regmap_get_device(data->regmap);
 #else
 	struct device *dev = data->dev;
 #endif
+	u8 buf[BME680_MEAS_DATA_LEN];
+	unsigned int dur, tries = BME680_MEAS_TRIES;
+	u32 adc_temp, adc_press;
+	u16 adc_humid, adc_gas_res;
 	int ret;
-	__be32 tmp = 0;
-	s32 adc_temp;
-	s16 comp_temp;
+
+	if (gas != data->run_gas) {
+		ret = regmap_update_bits(data->regmap, BME680_REG_CTRL_GAS_1,
+					 BME680_RUN_GAS_MASK,
+					 FIELD_PREP(BME680_RUN_GAS_MASK, gas));
+		if (ret < 0) {
+			dev_err(dev, "failed to write ctrl_gas_1 register\n");
+			return ret;
+		}
+		data->run_gas = gas;
+	}
 
 	/* set forced mode to trigger measurement */
 	ret = bme680_set_mode(data, true);
 	if (ret < 0)
 		return ret;
 
-	ret = regmap_bulk_read(data->regmap, BME680_REG_TEMP_MSB,
-			       (u8 *) &tmp, 3);
-	if (ret < 0) {
-		dev_err(dev, "failed to read temperature\n");
-		return ret;
+	dur = bme680_meas_duration_us(data, gas);
+	if (dur > 20000)
+		msleep(DIV_ROUND_UP(dur, 1000));
+	else
+		usleep_range(dur, dur + 1000);
+
+	for (;;) {
+		ret = regmap_bulk_read(data->regmap, BME680_REG_MEAS_STAT_0,
+				       buf, sizeof(buf));
+		if (ret < 0) {
+			dev_err(dev, "failed to read measurement\n");
+			return ret;
+		}
+
+		if (buf[0] & BME680_NEW_DATA_BIT)
+			break;
+
+		if (!--tries) {
+			dev_err(dev, "measurement incomplete\n");
+			return -EBUSY;
+		}
+		usleep_range(BME680_MEAS_RETRY_US, 2 * BME680_MEAS_RETRY_US);
 	}
 
-	adc_temp = be32_to_cpu(tmp) >> 12;
-	if (adc_temp == BME680_MEAS_SKIPPED) {
+	adc_temp = (buf[BME680_MEAS_TEMP] << 12) |
+		   (buf[BME680_MEAS_TEMP + 1] << 4) |
+		   (buf[BME680_MEAS_TEMP + 2] >> 4);
+	if (adc_temp == BME680_MEAS_SKIPPED_20BIT) {
 		/* reading was skipped */
 		dev_err(dev, "reading temperature skipped\n");
 		return -EINVAL;
 	}
-	comp_temp = bme680_compensate_temp(data, adc_temp);
-	/*
-	 * val might be NULL if we're called by the read_press/read_humid
-	 * routine which is callled to get t_fine value used in
-	 * compensate_press/compensate_humid to get compensated
-	 * pressure/humidity readings.
-	 */
-	if (val && val2) {
-		*val = comp_temp;
-		*val2 = 100;
-		return IIO_VAL_FRACTIONAL;
-	}
-
-	return ret;
-}
-
-static int bme680_read_press(struct bme680_data *data,
-			     int *val, int *val2)
-{
-#ifdef REGMAP_SUPPORTS_GET_DEVICE
-	struct device *dev = regmap_get_device(data->regmap);
-#else
-	struct device *dev = data->dev;
-#endif
-	int ret;
-	__be32 tmp = 0;
-	s32 adc_press;
-
-	/* Read and compensate temperature to get a reading of t_fine */
-	ret = bme680_read_temp(data, NULL, NULL);
-	if (ret < 0)
-		return ret;
-
-	ret = regmap_bulk_read(data->regmap, BME680_REG_PRESS_MSB,
-			       (u8 *) &tmp, 3);
-	if (ret < 0) {
-		dev_err(dev, "failed to read pressure\n");
-		return ret;
-	}
+	/* Also sets t_fine for the other channels */
+	snap->temp = bme680_compensate_temp(data, adc_temp);
 
-	adc_press = be32_to_cpu(tmp) >> 12;
-	if (adc_press == BME680_MEAS_SKIPPED) {
-		/* reading was skipped */
+	adc_press = (buf[BME680_MEAS_PRESS] << 12) |
+		    (buf[BME680_MEAS_PRESS + 1] << 4) |
+		    (buf[BME680_MEAS_PRESS + 2] >> 4);
+	if (adc_press == BME680_MEAS_SKIPPED_20BIT) {
 		dev_err(dev, "reading pressure skipped\n");
 		return -EINVAL;
 	}
+	snap->press = bme680_compensate_press(data, adc_press);
 
-	*val = bme680_compensate_press(data, adc_press);
-	*val2 = 100;
-	return IIO_VAL_FRACTIONAL;
-}
-
-static int bme680_read_humid(struct bme680_data *data,
-			     int *val, int *val2)
-{
-#ifdef REGMAP_SUPPORTS_GET_DEVICE
-	struct device *dev = regmap_get_device(data->regmap);
-#else
-	struct device *dev = data->dev;
-#endif
-	int ret;
-	__be16 tmp = 0;
-	s32 adc_humidity;
-	u32 comp_humidity;
+	adc_humid = (buf[BME680_MEAS_HUMID] << 8) |
+		    buf[BME680_MEAS_HUMID + 1];
+	if (adc_humid == BME680_MEAS_SKIPPED) {
+		dev_err(dev, "reading humidity skipped\n");
+		return -EINVAL;
+	}
+	snap->humid = bme680_compensate_humid(data, adc_humid);
 
-	/* Read and compensate temperature to get a reading of t_fine */
-	ret = bme680_read_temp(data, NULL, NULL);
-	if (ret < 0)
-		return ret;
+	snap->gas = 0;
+	if (!gas)
+		return 0;
 
-	ret = regmap_bulk_read(data->regmap, BM6880_REG_HUMIDITY_MSB,
-			       (u8 *) &tmp, 2);
-	if (ret < 0) {
-		dev_err(dev, "failed to read humidity\n");
-		return ret;
+	/*
+	 * The heater failing to stabilize occurs if either the gas heating
+	 * duration was insuffient to reach the target heater temperature or
+	 * the target heater temperature was too high for the heater sink to
+	 * reach.
+	 */
+	if (!(buf[BME680_MEAS_GAS + 1] & BME680_GAS_STAB_BIT)) {
+		dev_err(dev, "heater failed to reach the target temperature\n");
+		return 0;
 	}
 
-	adc_humidity = be16_to_cpu(tmp);
-	if (adc_humidity == BME680_MEAS_SKIPPED) {
-		/* reading was skipped */
-		dev_err(dev, "reading humidity skipped\n");
-		return -EINVAL;
-	}
-	comp_humidity = bme680_compensate_humid(data, adc_humidity);
+	adc_gas_res = ((buf[BME680_MEAS_GAS] << 8) |
+		       buf[BME680_MEAS_GAS + 1]) >> BME680_ADC_GAS_RES_SHIFT;
+	snap->gas = bme680_compensate_gas(data, adc_gas_res,
+			buf[BME680_MEAS_GAS + 1] & BME680_GAS_RANGE_MASK);
 
-	*val = comp_humidity;
-	*val2 = 1000;
-	return IIO_VAL_FRACTIONAL;
+	return 0;
 }
 
-static int bme680_read_gas(struct bme680_data *data,
-			   int *val)
+static int bme680_read_processed(struct bme680_data *data,
+				 struct iio_chan_spec const *chan,
+				 int *val, int *val2)
 {
-#ifdef REGMAP_SUPPORTS_GET_DEVICE
-	struct device *dev = regmap_get_device(data->regmap);
-#else
-	struct device *dev = data->dev;
-#endif
+	struct bme680_snapshot snap;
+	bool gas = chan->type == IIO_RESISTANCE;
 	int ret;
-	__be16 tmp = 0;
-	unsigned int check;
-	u16 adc_gas_res;
-	u8 gas_range;
-
-	/* Set heater settings */
-	ret = bme680_gas_config(data);
-	if (ret < 0) {
-		dev_err(dev, "failed to set gas config\n");
-		return ret;
-	}
 
-	/* set forced mode to trigger measurement */
-	ret = bme680_set_mode(data, true);
+	mutex_lock(&data->lock);
+	ret = bme680_measure(data, gas, &snap);
+	mutex_unlock(&data->lock);
 	if (ret < 0)
 		return ret;
 
-	ret = regmap_read(data->regmap, BME680_REG_MEAS_STAT_0, &check);
-	if (check & BME680_GAS_MEAS_BIT) {
-		dev_err(dev, "gas measurement incomplete\n");
-		return -EBUSY;
-	}
-
-	ret = regmap_read(data->regmap, BME680_REG_GAS_R_LSB, &check);
-	if (ret < 0) {
-		dev_err(dev, "failed to read gas_r_lsb register\n");
-		return ret;
-	}
-
-	/*
-	 * occurs if either the gas heating duration was insuffient
-	 * to reach the target heater temperature or the target
-	 * heater temperature was too high for the heater sink to
-	 * reach.
-	 */
-	if ((check & BME680_GAS_STAB_BIT) == 0) {
-		dev_err(dev, "heater failed to reach the target temperature\n");
+	switch (chan->type) {
+	case IIO_TEMP:
+		*val = snap.temp;
+		*val2 = 100;
+		return IIO_VAL_FRACTIONAL;
+	case IIO_PRESSURE:
+		*val = snap.press;
+		*val2 = 100;
+		return IIO_VAL_FRACTIONAL;
+	case IIO_HUMIDITYRELATIVE:
+		*val = snap.humid;
+		*val2 = 1000;
+		return IIO_VAL_FRACTIONAL;
+	case IIO_RESISTANCE:
+		if (!snap.gas)
+			return -EINVAL;
+		*val = snap.gas;
+		return IIO_VAL_INT;
+	default:
 		return -EINVAL;
 	}
+}
 
-	ret = regmap_bulk_read(data->regmap, BME680_REG_GAS_MSB,
-			       (u8 *) &tmp, 2);
-	if (ret < 0) {
-		dev_err(dev, "failed to read gas resistance\n");
-		return ret;
-	}
-
-	gas_range = check & BME680_GAS_RANGE_MASK;
-	adc_gas_res = be16_to_cpu(tmp) >> BME680_ADC_GAS_RES_SHIFT;
-
-	*val = bme680_compensate_gas(data, adc_gas_res, gas_range);
-	return IIO_VAL_INT;
+static irqreturn_t bme680_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct bme680_data *data = iio_priv(indio_dev);
+	struct bme680_snapshot snap;
+	u32 vals[BME680_SCAN_TIMESTAMP];
+	int i, j = 0, ret;
+
+	mutex_lock(&data->lock);
+	ret = bme680_measure(data,
+			     test_bit(BME680_SCAN_GAS,
+				      indio_dev->active_scan_mask),
+			     &snap);
+	mutex_unlock(&data->lock);
+	if (ret < 0)
+		goto done;
+
+	vals[BME680_SCAN_TEMP] = (s32)snap.temp;
+	vals[BME680_SCAN_PRESS] = snap.press;
+	vals[BME680_SCAN_HUMID] = snap.humid;
+	vals[BME680_SCAN_GAS] = snap.gas;
+
+	for_each_set_bit(i, indio_dev->active_scan_mask,
+			 indio_dev->masklength)
+		if (i != BME680_SCAN_TIMESTAMP)
+			data->scan[j++] = vals[i];
+
+	iio_push_to_buffers_with_timestamp(indio_dev, data->scan,
+					   pf->timestamp);
+done:
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
 }
 
 static int bme680_read_raw(struct iio_dev *indio_dev,
@@ -811,15 +912,22 @@ static int bme680_read_raw(struct iio_dev *indio_dev,
 
 	switch (mask) {
 	case IIO_CHAN_INFO_PROCESSED:
+		return bme680_read_processed(data, chan, val, val2);
+	case IIO_CHAN_INFO_SCALE:
+		/* Turns buffered values into the processed ones */
 		switch (chan->type) {
 		case IIO_TEMP:
-			return bme680_read_temp(data, val, val2);
 		case IIO_PRESSURE:
-			return bme680_read_press(data, val, val2);
+			*val = 1;
+			*val2 = 100;
+			return IIO_VAL_FRACTIONAL;
 		case IIO_HUMIDITYRELATIVE:
-			return bme680_read_humid(data, val, val2);
+			*val = 1;
+			*val2 = 1000;
+			return IIO_VAL_FRACTIONAL;
 		case IIO_RESISTANCE:
-			return bme680_read_gas(data, val);
+			*val = 1;
+			return IIO_VAL_INT;
 		default:
 			return -EINVAL;
 		}
@@ -857,6 +965,7 @@ static int bme680_write_raw(struct iio_dev *indio_dev,
 {
 #ifdef IIO_SUPPORTS_OVERSAMPLING_RATIO
 	struct bme680_data *data = iio_priv(indio_dev);
+	int ret;
 #endif
 
 	if (val2 != 0)
@@ -883,7 +992,10 @@ static int bme680_write_raw(struct iio_dev *indio_dev,
 			return -EINVAL;
 		}
 
-		return bme680_chip_config(data);
+		mutex_lock(&data->lock);
+		ret = bme680_chip_config(data);
+		mutex_unlock(&data->lock);
+		return ret;
 	}
 #endif
 	default:
@@ -943,6 +1055,7 @@ int bme680_core_probe(struct device *dev, struct regmap *regmap,
 	data = iio_priv(indio_dev);
 	dev_set_drvdata(dev, indio_dev);
 	data->regmap = regmap;
+	mutex_init(&data->lock);
 #ifndef REGMAP_SUPPORTS_GET_DEVICE
 	data->dev = dev;
 #endif
@@ -979,10 +1092,69 @@ int bme680_core_probe(struct device *dev, struct regmap *regmap,
 		return ret;
 	}
 
-	return devm_iio_device_register(dev, indio_dev);
+	ret = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time,
+					 bme680_trigger_handler, NULL);
+	if (ret < 0) {
+		dev_err(dev, "iio triggered buffer setup failed\n");
+		return ret;
+	}
+
+	ret = iio_device_register(indio_dev);
+	if (ret < 0)
+		goto buffer_cleanup;
+
+	return 0;
+
+buffer_cleanup:
+	iio_triggered_buffer_cleanup(indio_dev);
+	return ret;
 }
 EXPORT_SYMBOL_GPL(bme680_core_probe);
 
+void bme680_core_remove(struct device *dev)
+{
+	struct iio_dev *indio_dev = dev_get_drvdata(dev);
+
+	iio_device_unregister(indio_dev);
+	iio_triggered_buffer_cleanup(indio_dev);
+}
+EXPORT_SYMBOL_GPL(bme680_core_remove);
+
+#ifdef CONFIG_PM_SLEEP
+static int bme680_suspend(struct device *dev)
+{
+	struct iio_dev *indio_dev = dev_get_drvdata(dev);
+	struct bme680_data *data = iio_priv(indio_dev);
+
+	/* The supply may go away, so write the whole cache back on resume */
+	mutex_lock(&data->lock);
+	regcache_cache_only(data->regmap, true);
+	regcache_mark_dirty(data->regmap);
+	mutex_unlock(&data->lock);
+
+	return 0;
+}
+
+static int bme680_resume(struct device *dev)
+{
+	struct iio_dev *indio_dev = dev_get_drvdata(dev);
+	struct bme680_data *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->lock);
+	regcache_cache_only(data->regmap, false);
+	ret = regcache_sync(data->regmap);
+	mutex_unlock(&data->lock);
+
+	return ret;
+}
+#endif
+
+const struct dev_pm_ops bme680_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(bme680_suspend, bme680_resume)
+};
+EXPORT_SYMBOL_GPL(bme680_pm_ops);
+
 MODULE_AUTHOR("Himanshu Jha <himanshujha199640@gmail.com>");
 MODULE_DESCRIPTION("Bosch BME680 Driver");
 MODULE_LICENSE("GPL v2");
@@ -58,6 +58,13 @@ static int bme680_i2c_probe(struct i2c_client *client,
 	return bme680_core_probe(&client->dev, regmap, name);
 }
 
+static int bme680_i2c_remove(struct i2c_client *client)
+{
+	bme680_core_remove(&client->dev);
+
+	return 0;
+}
+
 static const struct i2c_device_id bme680_i2c_id[] = {
 	{"bme680", 0},
 	{},
@@ -74,8 +81,10 @@ static struct i2c_driver bme680_i2c_driver = {
 	.driver = {
 		.name			= "bme680_i2c",
 		.acpi_match_table       = ACPI_PTR(bme680_acpi_match),
+		.pm			= &bme680_pm_ops,
 	},
 	.probe = bme680_i2c_probe,
+	.remove = bme680_i2c_remove,
 	.id_table = bme680_i2c_id,
 };
 module_i2c_driver(bme680_i2c_driver);
@@ -98,6 +98,13 @@ static int bme680_spi_probe(struct spi_device *spi)
 	return bme680_core_probe(&spi->dev, regmap, id->name);
 }
 
+static int bme680_spi_remove(struct spi_device *spi)
+{
+	bme680_core_remove(&spi->dev);
+
+	return 0;
+}
+
 static const struct spi_device_id bme680_spi_id[] = {
 	{"bme680", 0},
 	{},
@@ -114,8 +121,10 @@ static struct spi_driver bme680_spi_driver = {
 	.driver = {
 		.name			= "bme680_spi",
 		.acpi_match_table	= ACPI_PTR(bme680_acpi_match),
+		.pm			= &bme680_pm_ops,
 	},
 	.probe = bme680_spi_probe,
+	.remove = bme680_spi_remove,
 	.id_table = bme680_spi_id,
 };
 module_spi_driver(bme680_spi_driver);
@@ -72,6 +72,8 @@
 #include "bmi088.h"
 #include "bmi08x.h"
 #include "bmi08x_defs.h"
+#include "bmi088-regs.h"
+#include "../iio/buffer_n.h"
 
 #define BMI08X_ACCEL_GPIO_NAME                  "bmi088a_pin"
 #define BMI08X_GYRO_GPIO_NAME                   "bmi088g_pin"
@@ -93,7 +95,9 @@
         {                                                               \
                 .type = device_type,                                    \
                 .modified = 1,                                          \
-                .info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED),     \
+                .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |          \
+                        BIT(IIO_CHAN_INFO_PROCESSED),                   \
+                .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),   \
                 .scan_index = si,                                       \
                 .channel2 = mod,                                        \
                 .address = addr,                                        \
@@ -102,22 +106,47 @@
                         .realbits = bitlen,                             \
                         .shift = 0,                                     \
                         .storagebits = bitlen,                          \
+                        .endianness = IIO_CPU,                          \
                 },                                                      \
         }
 
 #define BMI088_TEMP_CHANNEL(si)                                         \
         {                                                               \
                 .type = IIO_TEMP,                                       \
-                .info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED),     \
-                .scan_index = BMI088_SCAN_TEMP,                         \
+                .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |          \
+                        BIT(IIO_CHAN_INFO_PROCESSED) |                  \
+                        BIT(IIO_CHAN_INFO_SCALE) |                      \
+                        BIT(IIO_CHAN_INFO_OFFSET),                      \
+                .scan_index = si,                                       \
                 .scan_type = {                                          \
                         .sign = 's',                                    \
-                        .realbits = 32,                                 \
+                        .realbits = 11,                                 \
                         .shift = 0,                                     \
-                        .storagebits = 32,                              \
+                        .storagebits = 16,                              \
+                        .endianness = IIO_CPU,                          \
                 },                                                      \
         }
 
+/* The temperature sensor only updates every 1.28s */
+#define BMI088_TEMP_PERIOD_MS                   1280
+/* 0.125 degC/LSB, 0 LSB at 23 degC, offset is in LSB */
+#define BMI088_TEMP_SCALE_MILLI_C               125
+#define BMI088_TEMP_OFFSET                      (23000 / BMI088_TEMP_SCALE_MILLI_C)
+
+/* m/s^2 per LSB in nano units, indexed by accel_cfg.range (3g..24g) */
+static const int bmi088_accel_scale_nano[] = {
+        897826, 1795651, 3591302, 7182605,
+};
+
+/* rad/s per LSB in nano units, indexed by gyro_cfg.range (2000..125dps) */
+static const int bmi088_gyro_scale_nano[] = {
+        1065264, 532632, 266316, 133158, 66579,
+};
+
+/* 3x 16-bit + 16-bit temperature + 64-bit timestamp */
+#define BMI088_SCAN_BYTES                       16
+#define BMI088_FIFO_PUSH_BATCH                  16
+
 enum BMI088_AXIS_SCAN {
         BMI088_SCAN_X,
         BMI088_SCAN_Y,
@@ -128,15 +157,24 @@ enum BMI088_AXIS_SCAN {
 
 struct bmi08x_data {
 	struct mutex                    mutex;
-        struct bmi08x_sensor_data       sensor_data;
         struct bmi08x_int_cfg           int_cfg;
-        u8                              buff[16]; /* 3x 16-bit + 32-bit temperature + 32-bit timestamp */
+        s16                             scan[BMI088_SCAN_BYTES / sizeof(s16)] __aligned(8);
         struct bmi08x_dev               *bmi08x_dev;
         struct iio_trigger              *trig;
         struct i2c_client               *client;
         struct regmap                   *regmap;
         int                             gpio_pin;
 	int                             irq;
+        /* Last temperature read, refreshed every BMI088_TEMP_PERIOD_MS */
+        s16                             temp_raw;
+        bool                            temp_valid;
+        unsigned long                   temp_expires;
+        bool                            fifo_enabled;
+        unsigned int                    fifo_wm_frames;
+        s64                             fifo_period_ns;
+        u8                              fifo_buf[BMI088_ACCEL_FIFO_SIZE];
+        u8                              fifo_scans[BMI088_FIFO_PUSH_BATCH * BMI088_SCAN_BYTES] __aligned(8);
+        s64                             fifo_ts[BMI088_FIFO_PUSH_BATCH];
 };
 
 struct bmi08x_info {
@@ -173,6 +211,16 @@ static const struct iio_chan_spec bmi088g_channels[] = {
 
 static struct bmi08x_info bmi08x_info = {0};
 
+static unsigned int fifo_watermark = 0;
+module_param(fifo_watermark, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fifo_watermark,
+                 "Frames buffered in the hardware FIFO before interrupting, 0 interrupts on every new sample");
+
+/* Gyro output data rate for each BMI08X_GYRO_BW_*_ODR_* value */
+static const u16 bmi088_gyro_odr_hz[] = {
+        2000, 2000, 1000, 400, 200, 100, 200, 100,
+};
+
 static int match(struct device *dev, void *data)
 {
         struct i2c_client *client = to_i2c_client(dev);
@@ -1044,146 +1092,184 @@ static void bmi088_delay_milli_sec(u32 period)
         msleep_interruptible(period);
 }
 
+static bool bmi088_is_accel(struct bmi08x_data *data)
+{
+        return data->client->addr == BMI08X_ACCEL_I2C_ADDR_PRIMARY;
+}
+
+/* x, y and z in one burst from the first data register */
+static int bmi088_read_axes(struct bmi08x_data *data, __le16 *axes)
+{
+        return regmap_bulk_read(data->regmap, bmi088_is_accel(data) ? 
+                BMI08X_ACCEL_X_LSB_REG : BMI08X_GYRO_X_LSB_REG, 
+                axes, 3 * sizeof(__le16));
+}
+
+/*
+ * The temperature sensor lives in the accelerometer and only updates every
+ * BMI088_TEMP_PERIOD_MS, so it is read again once that period has elapsed.
+ */
+static int bmi088_update_temp(struct bmi08x_data *data)
+{
+        u8 buf[2];
+        int ret;
+
+        if (data->temp_valid && time_before(jiffies, data->temp_expires))
+                return 0;
+
+        ret = bmi088_read(BMI08X_ACCEL_I2C_ADDR_PRIMARY, BMI08X_TEMP_MSB_REG, 
+                buf, sizeof(buf));
+        if (ret < 0)
+                return ret;
+
+        /* 11-bit two's complement, MSB first */
+        data->temp_raw = sign_extend32((buf[0] << 3) | (buf[1] >> 5), 10);
+        data->temp_valid = true;
+        data->temp_expires = jiffies + msecs_to_jiffies(BMI088_TEMP_PERIOD_MS);
+        return 0;
+}
+
+/* Pack the enabled channels of one sample into a scan */
+static void bmi088_fill_scan(struct iio_dev *indio_dev, const __le16 *axes, 
+                             s16 *scan)
+{
+        struct bmi08x_data *data = iio_priv(indio_dev);
+        int i, j = 0;
+
+        for_each_set_bit(i, indio_dev->active_scan_mask, indio_dev->masklength) {
+                if (i == BMI088_SCAN_TIMESTAMP)
+                        continue;
+
+                scan[j++] = (i == BMI088_SCAN_TEMP) ? 
+                        data->temp_raw : (s16)le16_to_cpu(axes[i]);
+        }
+}
+
 static int bmi088_read_raw(struct iio_dev *indio_dev,
 			   struct iio_chan_spec const *chan,
 			   int *val, int *val2, long mask)
 {
 	struct bmi08x_data *data = iio_priv(indio_dev);
-        s32 temperature;
+        __le16 axes[3];
+        int range;
+        int raw;
         int ret;
-        u8 range;
 
 	mutex_lock(&data->mutex);
 
         switch (mask) {
+	case IIO_CHAN_INFO_RAW:
 	case IIO_CHAN_INFO_PROCESSED:
-        {
                 if (iio_buffer_enabled(indio_dev)) {
                         dev_warn(&indio_dev->dev, "%s(): IIO buffer enabled\n", __func__);
                         ret = -EBUSY;
                         goto exit;
                 }
 
+                if (chan->type == IIO_TEMP) {
+                        ret = bmi088_update_temp(data);
+                        raw = data->temp_raw;
+                }
+                else {
+                        ret = bmi088_read_axes(data, axes);
+                        raw = (s16)le16_to_cpu(axes[chan->scan_index]);
+                }
+
+                if (ret < 0) {
+                        dev_err(&indio_dev->dev, "%s(): read failed(%d)\n", 
+                                __func__, ret);
+                        goto exit;
+                }
+
+                if (mask == IIO_CHAN_INFO_RAW) {
+                        *val = raw;
+                        ret = IIO_VAL_INT;
+                        break;
+                }
+
                 switch (chan->type) {
                 case IIO_TEMP:
-                        ret = bmi08a_get_sensor_temperature(data->bmi08x_dev, &temperature);
-                        if (ret < 0) {
-                                dev_err(&indio_dev->dev, "%s(): bmi08a_get_sensor_temperature() failed(%d)\n", 
-                                        __func__, ret);
-                                ret = -EINVAL;
-                                goto exit;
-                        }
-
-                        *val = temperature;
+                        /* mdegC */
+                        *val = raw * 125 + 23000;
                         *val2 = 1000;
                         ret = IIO_VAL_FRACTIONAL;
                         break;
 
                 case IIO_ACCEL:
-                        ret = bmi088_read(data->client->addr, BMI08X_ACCEL_RANGE_REG, 
-                                &range, sizeof(range));
-                        if (ret < 0) {
-                                dev_err(&indio_dev->dev, "%s(): bmi088_read() failed(%d)\n", 
-                                        __func__, ret);
-                                ret = -EINVAL;
-                                goto exit;
-                        }
+                        /* cm/s^2 */
+                        range = data->bmi08x_dev->accel_cfg.range;
+                        *val = (raw * 3 * 980 * (0x01 << range)) >> 15;
+                        ret = IIO_VAL_INT;
+                        break;
 
-                        ret = bmi08a_get_data(&data->sensor_data, data->bmi08x_dev);
-                        if (ret < 0) {
-                                dev_err(&indio_dev->dev, "%s(): bmi08a_get_data() failed(%d)\n", 
-                                        __func__, ret);
-                                goto exit;
-                        }
+                case IIO_ANGL_VEL:
+                        /* deg/s */
+                        range = data->bmi08x_dev->gyro_cfg.range;
+                        *val = ((raw * 2000) >> range) / 0x7FFF;
+                        ret = IIO_VAL_INT;
+                        break;
 
-                        data->sensor_data.x = (data->sensor_data.x * 3 * 980 * (0x01 << range)) >> 15;
-                        data->sensor_data.y = (data->sensor_data.y * 3 * 980 * (0x01 << range)) >> 15;
-                        data->sensor_data.z = (data->sensor_data.z * 3 * 980 * (0x01 << range)) >> 15;
-
-                        switch (chan->scan_index) {
-                        case BMI088_SCAN_X:
-                                *val = data->sensor_data.x;
-                                ret = IIO_VAL_INT;
-                                break;
-
-                        case BMI088_SCAN_Y:
-                                *val = data->sensor_data.y;
-                                ret = IIO_VAL_INT;
-                                break;
-
-                        case BMI088_SCAN_Z:
-                                *val = data->sensor_data.z;
-                                ret = IIO_VAL_INT;
-                                break;
-
-                        default:
-                                dev_err(&indio_dev->dev, "%s(): unsupported axis(%d)\n", 
-                                        __func__, chan->scan_index);
-			        ret = -EINVAL;
-			        goto exit;
-                        }
+		default:
+                        dev_err(&indio_dev->dev, "%s(): unsupported channel type(%d)\n", 
+                                __func__, chan->type);
+			ret = -EINVAL;
+			goto exit;
+                }
+
+                break;
 
+        /* Turns buffered values into the processed ones */
+	case IIO_CHAN_INFO_SCALE:
+                switch (chan->type) {
+                case IIO_TEMP:
+                        /* mdegC */
+                        *val = BMI088_TEMP_SCALE_MILLI_C;
+                        ret = IIO_VAL_INT;
                         break;
 
-                case IIO_ANGL_VEL:
-                        ret = bmi088_read(data->client->addr, BMI08X_GYRO_RANGE_REG, 
-                                &range, sizeof(range));
-                        if (ret < 0) {
-                                dev_err(&indio_dev->dev, "%s(): bmi088_read() failed(%d)\n", 
-                                        __func__, ret);
+                case IIO_ACCEL:
+                        /* m/s^2 */
+                        range = data->bmi08x_dev->accel_cfg.range;
+                        if (range >= ARRAY_SIZE(bmi088_accel_scale_nano)) {
                                 ret = -EINVAL;
                                 goto exit;
                         }
 
-                        ret = bmi08g_get_data(&data->sensor_data, data->bmi08x_dev);
-                        if (ret < 0) {
-                                dev_err(&indio_dev->dev, "%s(): bmi08g_get_data() failed(%d)\n", 
-                                        __func__, ret);
+                        *val = 0;
+                        *val2 = bmi088_accel_scale_nano[range];
+                        ret = IIO_VAL_INT_PLUS_NANO;
+                        break;
+
+                case IIO_ANGL_VEL:
+                        /* rad/s */
+                        range = data->bmi08x_dev->gyro_cfg.range;
+                        if (range >= ARRAY_SIZE(bmi088_gyro_scale_nano)) {
                                 ret = -EINVAL;
                                 goto exit;
                         }
 
-                        data->sensor_data.x = ((data->sensor_data.x * 2000) >> range) / 0x7FFF;
-                        data->sensor_data.y = ((data->sensor_data.y * 2000) >> range) / 0x7FFF;
-                        data->sensor_data.z = ((data->sensor_data.z * 2000) >> range) / 0x7FFF;
-
-                        dev_dbg(&indio_dev->dev, "%s(): (x, y, z) deg/sec: (%d, %d, %d)\n", 
-                                __func__, data->sensor_data.x, data->sensor_data.y, data->sensor_data.z);
-
-                        switch (chan->scan_index) {
-                        case BMI088_SCAN_X:
-                                *val = data->sensor_data.x;
-                                ret = IIO_VAL_INT;
-                                break;
-
-                        case BMI088_SCAN_Y:
-                                *val = data->sensor_data.y;
-                                ret = IIO_VAL_INT;
-                                break;
-
-                        case BMI088_SCAN_Z:
-                                *val = data->sensor_data.z;
-                                ret = IIO_VAL_INT;
-                                break;
-
-                        default:
-                                dev_err(&indio_dev->dev, "%s(): unsupported axis(%d)\n", 
-                                        __func__, chan->scan_index);
-			        ret = -EINVAL;
-			        goto exit;
-                        }
-
+                        *val = 0;
+                        *val2 = bmi088_gyro_scale_nano[range];
+                        ret = IIO_VAL_INT_PLUS_NANO;
                         break;
 
 		default:
-                        dev_err(&indio_dev->dev, "%s(): unsupported channel type(%d)\n", 
-                                __func__, chan->type);
 			ret = -EINVAL;
 			goto exit;
                 }
 
                 break;
-        }
+
+	case IIO_CHAN_INFO_OFFSET:
+                if (chan->type != IIO_TEMP) {
+                        ret = -EINVAL;
+                        goto exit;
+                }
+
+                *val = BMI088_TEMP_OFFSET;
+                ret = IIO_VAL_INT;
+                break;
+
 	default:
                 dev_err(&indio_dev->dev, "%s(): unsupported mask(%ld)\n", 
                         __func__, mask);
@@ -1204,130 +1290,291 @@ static int bmi088_write_raw(struct iio_dev *indio_dev,
 	return -EINVAL;
 }
 
-static irqreturn_t bmi088_trigger_handler(int irq, void *p)
+static int bmi088_fifo_enable(struct iio_dev *indio_dev)
 {
-        struct iio_poll_func *pf = p;
-        struct iio_dev *indio_dev = pf->indio_dev;
         struct bmi08x_data *data = iio_priv(indio_dev);
-        int64_t time_ns = iio_get_time_ns();
-        s32 sensor_temperature;
-        u32 sensor_time;
+        unsigned int wm, odr;
+        __le16 wtm;
         int ret;
-        u8 range;
 
-        mutex_lock(&data->mutex);
+        if (bmi088_is_accel(data)) {
+                /* Keep one frame of headroom so the FIFO never overflows at wm */
+                wm = clamp_t(unsigned int, fifo_watermark, 1, 
+                        BMI088_ACCEL_FIFO_SIZE / BMI088_ACCEL_FIFO_FRAME_LEN - 1);
+                wtm = cpu_to_le16(wm * BMI088_ACCEL_FIFO_FRAME_LEN);
+
+                ret = regmap_bulk_write(data->regmap, BMI088_ACCEL_FIFO_WTM_0_REG, 
+                        &wtm, sizeof(wtm));
+                if (ret < 0)
+                        return ret;
+
+                ret = regmap_write(data->regmap, BMI088_ACCEL_FIFO_CONFIG_0_REG, 
+                        BMI088_ACCEL_FIFO_MODE_STREAM);
+                if (ret < 0)
+                        return ret;
+
+                ret = regmap_write(data->regmap, BMI088_ACCEL_FIFO_CONFIG_1_REG, 
+                        BMI088_ACCEL_FIFO_CONFIG_1_RESERVED | BMI088_ACCEL_FIFO_ACC_EN);
+                if (ret < 0)
+                        return ret;
+
+                ret = regmap_write(data->regmap, BMI08X_ACCEL_SOFTRESET_REG, 
+                        BMI088_ACCEL_CMD_FIFO_FLUSH);
+                if (ret < 0)
+                        return ret;
+
+                /* ODR is 1600Hz halved for every step below BMI08X_ACCEL_ODR_1600_HZ */
+                odr = clamp_t(unsigned int, data->bmi08x_dev->accel_cfg.odr, 
+                        BMI08X_ACCEL_ODR_12_5_HZ, BMI08X_ACCEL_ODR_1600_HZ);
+                data->fifo_period_ns = div_u64((u64)NSEC_PER_SEC << 
+                        (BMI08X_ACCEL_ODR_1600_HZ - odr), 1600);
+
+                /* Route the watermark instead of data ready to INT2 */
+                ret = regmap_update_bits(data->regmap, 
+                        BMI08X_ACCEL_INT1_INT2_MAP_DATA_REG, 
+                        BMI088_ACCEL_INT2_FWM | BMI088_ACCEL_INT2_DRDY, 
+                        BMI088_ACCEL_INT2_FWM);
+                if (ret < 0)
+                        return ret;
+        }
+        else {
+                wm = clamp_t(unsigned int, fifo_watermark, 1, 
+                        BMI088_GYRO_FIFO_FRAMES - 1);
+
+                ret = regmap_write(data->regmap, BMI088_GYRO_FIFO_CONFIG_0_REG, wm);
+                if (ret < 0)
+                        return ret;
+
+                /* Writing the mode also clears the FIFO */
+                ret = regmap_write(data->regmap, BMI088_GYRO_FIFO_CONFIG_1_REG, 
+                        BMI088_GYRO_FIFO_MODE_STREAM);
+                if (ret < 0)
+                        return ret;
+
+                ret = regmap_write(data->regmap, BMI088_GYRO_FIFO_WM_EN_REG, 
+                        BMI088_GYRO_FIFO_WM_ENABLE);
+                if (ret < 0)
+                        return ret;
+
+                odr = data->bmi08x_dev->gyro_cfg.odr;
+                data->fifo_period_ns = NSEC_PER_SEC / 
+                        bmi088_gyro_odr_hz[odr % ARRAY_SIZE(bmi088_gyro_odr_hz)];
+
+                /* Route the watermark instead of data ready to INT3 */
+                ret = regmap_update_bits(data->regmap, 
+                        BMI08X_GYRO_INT3_INT4_IO_MAP_REG, 
+                        BMI088_GYRO_INT3_DATA | BMI088_GYRO_INT3_FIFO, 
+                        BMI088_GYRO_INT3_FIFO);
+                if (ret < 0)
+                        return ret;
+
+                ret = regmap_write(data->regmap, BMI08X_GYRO_INT_CTRL_REG, 
+                        BMI088_GYRO_INT_CTRL_FIFO_EN);
+                if (ret < 0)
+                        return ret;
+        }
 
-        dev_dbg(&indio_dev->dev, "%s(): I2C addr(0x%04x)\n", 
-                __func__, data->client->addr);
+        data->fifo_wm_frames = wm;
+        data->fifo_enabled = true;
 
-        if (data->client->addr == BMI08X_ACCEL_I2C_ADDR_PRIMARY) {
-                ret = bmi088_read(data->client->addr, BMI08X_ACCEL_RANGE_REG, 
-                        &range, sizeof(range));
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi088_read() failed(%d)\n", 
-                                __func__, ret);
-                        ret = -EINVAL;
-                        goto err;
-                }
+        return 0;
+}
 
-                ret = bmi08a_get_data(&data->sensor_data, data->bmi08x_dev);
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi08a_get_data() failed(%d)\n", 
-                                __func__, ret);
-                        goto err;
-                }
+static int bmi088_fifo_disable(struct iio_dev *indio_dev)
+{
+        struct bmi08x_data *data = iio_priv(indio_dev);
+        int ret;
 
-                ret = bmi08a_get_sensor_temperature(data->bmi08x_dev, &sensor_temperature);
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi08a_get_sensor_temperature() failed(%d)\n", 
-                                __func__, ret);
-                        ret = -EINVAL;
-                        goto err;
-                }
+        data->fifo_enabled = false;
 
-                ret = bmi08a_get_sensor_time(data->bmi08x_dev, &sensor_time);
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi08a_get_sensor_time() failed(%d)\n", 
-                                __func__, ret);
-                        ret = -EINVAL;
-                        goto err;
+        if (bmi088_is_accel(data)) {
+                ret = regmap_update_bits(data->regmap, 
+                        BMI08X_ACCEL_INT1_INT2_MAP_DATA_REG, 
+                        BMI088_ACCEL_INT2_FWM, 0);
+                if (ret < 0)
+                        return ret;
+
+                return regmap_write(data->regmap, BMI088_ACCEL_FIFO_CONFIG_1_REG, 
+                        BMI088_ACCEL_FIFO_CONFIG_1_RESERVED);
+        }
+
+        ret = regmap_write(data->regmap, BMI08X_GYRO_INT_CTRL_REG, 0);
+        if (ret < 0)
+                return ret;
+
+        ret = regmap_update_bits(data->regmap, BMI08X_GYRO_INT3_INT4_IO_MAP_REG, 
+                BMI088_GYRO_INT3_FIFO, 0);
+        if (ret < 0)
+                return ret;
+
+        ret = regmap_write(data->regmap, BMI088_GYRO_FIFO_WM_EN_REG, 
+                BMI088_GYRO_FIFO_WM_DISABLE);
+        if (ret < 0)
+                return ret;
+
+        return regmap_write(data->regmap, BMI088_GYRO_FIFO_CONFIG_1_REG, 0);
+}
+
+/*
+ * Read the whole accel FIFO in one burst and compact its x, y, z frames to
+ * the start of fifo_buf, dropping headers and control frames.
+ */
+static int bmi088_fifo_read_accel(struct bmi08x_data *data)
+{
+        unsigned int len, i = 0, n = 0;
+        __le16 fifo_len;
+        u8 *buf = data->fifo_buf;
+        int ret;
+
+        ret = regmap_bulk_read(data->regmap, BMI088_ACCEL_FIFO_LENGTH_0_REG, 
+                &fifo_len, sizeof(fifo_len));
+        if (ret < 0)
+                return ret;
+
+        len = min_t(unsigned int, 
+                le16_to_cpu(fifo_len) & BMI088_ACCEL_FIFO_LENGTH_MASK, 
+                BMI088_ACCEL_FIFO_SIZE);
+        if (!len)
+                return 0;
+
+        ret = regmap_bulk_read(data->regmap, BMI088_ACCEL_FIFO_DATA_REG, buf, len);
+        if (ret < 0)
+                return ret;
+
+        while (i < len) {
+                switch (buf[i] & BMI088_ACCEL_FIFO_HDR_MASK) {
+                case BMI088_ACCEL_FIFO_HDR_ACC:
+                        if (i + BMI088_ACCEL_FIFO_FRAME_LEN > len)
+                                return n;
+
+                        memmove(&buf[n * BMI088_GYRO_FIFO_FRAME_LEN], &buf[i + 1], 
+                                BMI088_GYRO_FIFO_FRAME_LEN);
+                        n++;
+                        i += BMI088_ACCEL_FIFO_FRAME_LEN;
+                        break;
+
+                case BMI088_ACCEL_FIFO_HDR_SKIP:
+                case BMI088_ACCEL_FIFO_HDR_CONFIG:
+                case BMI088_ACCEL_FIFO_HDR_DROP:
+                        i += 2;
+                        break;
+
+                case BMI088_ACCEL_FIFO_HDR_TIME:
+                        i += 4;
+                        break;
+
+                default:
+                        /* Empty FIFO or an unknown frame */
+                        return n;
                 }
+        }
+
+        return n;
+}
 
-                dev_dbg(&indio_dev->dev, "%s(): range(%u) (x, y, z) raw: (%d, %d, %d)\n", 
-                        __func__, range, data->sensor_data.x, data->sensor_data.y, data->sensor_data.z);
+/* The gyro FIFO only holds headerless x, y, z frames */
+static int bmi088_fifo_read_gyro(struct bmi08x_data *data)
+{
+        unsigned int status, n;
+        int ret;
 
-                data->sensor_data.x = (data->sensor_data.x * 3 * 980 * (0x01 << range)) >> 15;
-                data->sensor_data.y = (data->sensor_data.y * 3 * 980 * (0x01 << range)) >> 15;
-                data->sensor_data.z = (data->sensor_data.z * 3 * 980 * (0x01 << range)) >> 15;
+        ret = regmap_read(data->regmap, BMI088_GYRO_FIFO_STATUS_REG, &status);
+        if (ret < 0)
+                return ret;
 
-                memcpy(data->buff, &data->sensor_data, sizeof(data->sensor_data));
-                memcpy(&data->buff[sizeof(data->sensor_data)], &sensor_temperature, sizeof(sensor_temperature));
-                memcpy(&data->buff[sizeof(data->sensor_data) + sizeof(sensor_temperature)], &sensor_time, sizeof(sensor_time));
+        n = min_t(unsigned int, status & BMI088_GYRO_FIFO_FRAME_COUNT_MASK, 
+                BMI088_GYRO_FIFO_FRAMES);
+        if (!n)
+                return 0;
 
-                dev_dbg(&indio_dev->dev, "%s(): t(%u) %d.%u degC (x, y, z) cm/s^2: (%d, %d, %d)\n", 
-                        __func__, sensor_time, sensor_temperature / 1000, 
-                        (sensor_temperature > 0) ? (sensor_temperature % 1000) : (-sensor_temperature % 1000),
-                        data->sensor_data.x, data->sensor_data.y, data->sensor_data.z);
+        ret = regmap_bulk_read(data->regmap, BMI088_GYRO_FIFO_DATA_REG, 
+                data->fifo_buf, n * BMI088_GYRO_FIFO_FRAME_LEN);
+        if (ret < 0)
+                return ret;
+
+        return n;
+}
+
+/*
+ * Drain the FIFO and push one scan per frame. The interrupt fired when frame
+ * fifo_wm_frames - 1 was written, so that frame is stamped with the interrupt
+ * time and the others are spaced one ODR period apart around it.
+ */
+static void bmi088_fifo_drain(struct iio_dev *indio_dev, s64 irq_ts)
+{
+        struct bmi08x_data *data = iio_priv(indio_dev);
+        unsigned int i, anchor, batch = 0;
+        int n, ret;
+
+        n = bmi088_is_accel(data) ? 
+                bmi088_fifo_read_accel(data) : bmi088_fifo_read_gyro(data);
+        if (n <= 0) {
+                if (n < 0)
+                        dev_err(&indio_dev->dev, "%s(): FIFO read failed(%d)\n", 
+                                __func__, n);
+                return;
         }
-        else if (data->client->addr == BMI08X_GYRO_I2C_ADDR_PRIMARY) {
-                ret = bmi088_read(data->client->addr, BMI08X_GYRO_RANGE_REG, 
-                        &range, sizeof(range));
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi088_read() failed(%d)\n", 
-                                __func__, ret);
-                        ret = -EINVAL;
-                        goto err;
-                }
 
-                ret = bmi08g_get_data(&data->sensor_data, data->bmi08x_dev);
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi08g_get_data() failed(%d)\n", 
-                                __func__, ret);
-                        goto err;
-                }
+        /* The temperature is not in the FIFO, sample it once per drain */
+        if (test_bit(BMI088_SCAN_TEMP, indio_dev->active_scan_mask)) {
+                ret = bmi088_update_temp(data);
+                if (ret < 0)
+                        return;
+        }
 
-                ret = bmi08a_get_sensor_temperature(data->bmi08x_dev, &sensor_temperature);
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi08a_get_sensor_temperature() failed(%d)\n", 
-                                __func__, ret);
-                        ret = -EINVAL;
-                        goto err;
-                }
+        anchor = min_t(unsigned int, n, data->fifo_wm_frames) - 1;
 
-                ret = bmi08a_get_sensor_time(data->bmi08x_dev, &sensor_time);
-                if (ret < 0) {
-                        dev_err(&indio_dev->dev, "%s(): bmi08a_get_sensor_time() failed(%d)\n", 
-                                __func__, ret);
-                        ret = -EINVAL;
-                        goto err;
-                }
+        for (i = 0; i < n; i++) {
+                bmi088_fill_scan(indio_dev, 
+                        (__le16 *)&data->fifo_buf[i * BMI088_GYRO_FIFO_FRAME_LEN], 
+                        (s16 *)&data->fifo_scans[batch * indio_dev->scan_bytes]);
 
-                dev_dbg(&indio_dev->dev, "%s(): range(%u) (x, y, z) raw: (%d, %d, %d)\n", 
-                        __func__, range, data->sensor_data.x, data->sensor_data.y, data->sensor_data.z);
+                data->fifo_ts[batch] = irq_ts + 
+                        ((s64)i - anchor) * data->fifo_period_ns;
+                if (++batch == BMI088_FIFO_PUSH_BATCH || i == n - 1) {
+                        iio_push_to_buffers_with_timestamps_n(indio_dev, 
+                                data->fifo_scans, data->fifo_ts, batch);
+                        batch = 0;
+                }
+        }
+}
 
-                data->sensor_data.x = ((data->sensor_data.x * 2000) >> range) / 0x7FFF;
-                data->sensor_data.y = ((data->sensor_data.y * 2000) >> range) / 0x7FFF;
-                data->sensor_data.z = ((data->sensor_data.z * 2000) >> range) / 0x7FFF;
+static irqreturn_t bmi088_trigger_handler(int irq, void *p)
+{
+        struct iio_poll_func *pf = p;
+        struct iio_dev *indio_dev = pf->indio_dev;
+        struct bmi08x_data *data = iio_priv(indio_dev);
+        __le16 axes[3];
+        int ret;
 
-                memcpy(data->buff, &data->sensor_data, sizeof(data->sensor_data));
-                memcpy(&data->buff[sizeof(data->sensor_data)], &sensor_temperature, sizeof(sensor_temperature));
-                memcpy(&data->buff[sizeof(data->sensor_data) + sizeof(sensor_temperature)], &sensor_time, sizeof(sensor_time));
+        mutex_lock(&data->mutex);
 
-                dev_dbg(&indio_dev->dev, "%s(): t(%u) %d.%u degC (x, y, z) deg/sec: (%d, %d, %d)\n", 
-                        __func__, sensor_time, sensor_temperature / 1000,
-                        (sensor_temperature > 0) ? (sensor_temperature % 1000) : (-sensor_temperature % 1000),
-                        data->sensor_data.x, data->sensor_data.y, data->sensor_data.z);
+        if (data->fifo_enabled) {
+                bmi088_fifo_drain(indio_dev, pf->timestamp);
+                goto err;
         }
-        else {
-                dev_err(&indio_dev->dev, "%s(): unsupported I2C addr(0x%04x)\n", 
-                        __func__, data->client->addr);
+
+        ret = bmi088_read_axes(data, axes);
+        if (ret < 0) {
+                dev_err(&indio_dev->dev, "%s(): bmi088_read_axes() failed(%d)\n", 
+                        __func__, ret);
                 goto err;
         }
 
+        if (test_bit(BMI088_SCAN_TEMP, indio_dev->active_scan_mask)) {
+                ret = bmi088_update_temp(data);
+                if (ret < 0) {
+                        dev_err(&indio_dev->dev, "%s(): bmi088_update_temp() failed(%d)\n", 
+                                __func__, ret);
+                        goto err;
+                }
+        }
+
+        bmi088_fill_scan(indio_dev, axes, data->scan);
+        iio_push_to_buffers_with_timestamp(indio_dev, data->scan, pf->timestamp);
+
 err:
         mutex_unlock(&data->mutex);
-        iio_push_to_buffers_with_timestamp(indio_dev, &data->buff, time_ns);
-        
         iio_trigger_notify_done(indio_dev->trig);
         return IRQ_HANDLED;
 }
@@ -1425,7 +1672,26 @@ static int bmi088_data_rdy_trigger_set_state(struct iio_trigger *trig,
                 bool state)
 {
         struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
-        return bmi088_set_new_data_intr_state(indio_dev, state);
+        struct bmi08x_data *data = iio_priv(indio_dev);
+        int ret;
+
+        ret = bmi088_set_new_data_intr_state(indio_dev, state);
+        if (ret < 0)
+                return ret;
+
+        /* The FIFO watermark replaces data ready on the same pin */
+        mutex_lock(&data->mutex);
+        if (state && fifo_watermark)
+                ret = bmi088_fifo_enable(indio_dev);
+        else if (!state && data->fifo_enabled)
+                ret = bmi088_fifo_disable(indio_dev);
+        mutex_unlock(&data->mutex);
+
+        if (ret < 0)
+                dev_err(&indio_dev->dev, "%s(): FIFO setup failed(%d)\n", 
+                        __func__, ret);
+
+        return ret;
 }
 
 static int bmi088_trig_try_reen(struct iio_trigger *trig)
@@ -1638,7 +1904,7 @@ static int bmi088_probe(struct i2c_client *client,
                 goto failed_gpio_req;
         }
 
-        ret = iio_triggered_buffer_setup(indio_dev, NULL,
+        ret = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time,
                 bmi088_trigger_handler, NULL);
         if (ret < 0) {
                 dev_err(&client->dev, "%s(): iio_triggered_buffer_setup() failed(%d)\n", 
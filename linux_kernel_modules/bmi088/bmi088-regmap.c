@@ -3,6 +3,7 @@
 #include <linux/regmap.h>
 
 #include "bmi08x_defs.h"
+#include "bmi088-regs.h"
 
 static bool bmi088a_is_writeable_reg(struct device *dev, unsigned int reg)
 {
@@ -20,6 +21,10 @@ static bool bmi088a_is_writeable_reg(struct device *dev, unsigned int reg)
         case BMI08X_ACCEL_INT2_IO_CONF_REG:
         case BMI08X_ACCEL_RANGE_REG:
         case BMI08X_ACCEL_CONF_REG:
+        case BMI088_ACCEL_FIFO_WTM_0_REG:
+        case BMI088_ACCEL_FIFO_WTM_1_REG:
+        case BMI088_ACCEL_FIFO_CONFIG_0_REG:
+        case BMI088_ACCEL_FIFO_CONFIG_1_REG:
                 return true;
 
 	default:
@@ -53,6 +58,13 @@ static bool bmi088a_is_volatile_reg(struct device *dev, unsigned int reg)
         case BMI08X_ACCEL_STATUS_REG:
         case BMI08X_ACCEL_ERR_REG:
         case BMI08X_ACCEL_CHIP_ID_REG:
+        case BMI088_ACCEL_FIFO_LENGTH_0_REG:
+        case BMI088_ACCEL_FIFO_LENGTH_1_REG:
+        case BMI088_ACCEL_FIFO_DATA_REG:
+        case BMI088_ACCEL_FIFO_WTM_0_REG:
+        case BMI088_ACCEL_FIFO_WTM_1_REG:
+        case BMI088_ACCEL_FIFO_CONFIG_0_REG:
+        case BMI088_ACCEL_FIFO_CONFIG_1_REG:
                 return true;
 
         default:
@@ -85,6 +97,9 @@ static bool bmi088g_is_writeable_reg(struct device *dev, unsigned int reg)
         case BMI08X_GYRO_LPM1_REG:
         case BMI08X_GYRO_BANDWIDTH_REG:
         case BMI08X_GYRO_RANGE_REG:
+        case BMI088_GYRO_FIFO_WM_EN_REG:
+        case BMI088_GYRO_FIFO_CONFIG_0_REG:
+        case BMI088_GYRO_FIFO_CONFIG_1_REG:
                 return true;
 
 	default:
@@ -111,6 +126,11 @@ static bool bmi088g_is_volatile_reg(struct device *dev, unsigned int reg)
         case BMI08X_GYRO_X_MSB_REG:
         case BMI08X_GYRO_X_LSB_REG:
         case BMI08X_GYRO_CHIP_ID_REG:
+        case BMI088_GYRO_FIFO_STATUS_REG:
+        case BMI088_GYRO_FIFO_WM_EN_REG:
+        case BMI088_GYRO_FIFO_CONFIG_0_REG:
+        case BMI088_GYRO_FIFO_CONFIG_1_REG:
+        case BMI088_GYRO_FIFO_DATA_REG:
                 return true;
 
         default:
@@ -124,7 +144,7 @@ const struct regmap_config bmi088g_regmap_config = {
 	.reg_bits = 8,
 	.val_bits = 8,
 
-	.max_register = BMI08X_GYRO_SELF_TEST_REG,
+	.max_register = BMI088_GYRO_FIFO_DATA_REG,
 	.cache_type = REGCACHE_NONE,
 
 	.writeable_reg = bmi088g_is_writeable_reg,
@@ -0,0 +1,62 @@
+/*
+ * BMI088 FIFO registers, which the BMI08x sensor API does not cover.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef _BMI088_REGS_H_
+#define _BMI088_REGS_H_
+
+#include <linux/bitops.h>
+
+/* Accelerometer */
+#define BMI088_ACCEL_FIFO_LENGTH_0_REG          0x24
+#define BMI088_ACCEL_FIFO_LENGTH_1_REG          0x25
+#define BMI088_ACCEL_FIFO_DATA_REG              0x26
+#define BMI088_ACCEL_FIFO_WTM_0_REG             0x46
+#define BMI088_ACCEL_FIFO_WTM_1_REG             0x47
+#define BMI088_ACCEL_FIFO_CONFIG_0_REG          0x48
+#define BMI088_ACCEL_FIFO_CONFIG_1_REG          0x49
+
+#define BMI088_ACCEL_FIFO_LENGTH_MASK           0x3FFF
+#define BMI088_ACCEL_FIFO_MODE_STREAM           0x02
+/* Bit 4 of FIFO_CONFIG_1 must always be written as 1 */
+#define BMI088_ACCEL_FIFO_CONFIG_1_RESERVED     BIT(4)
+#define BMI088_ACCEL_FIFO_ACC_EN                BIT(6)
+#define BMI088_ACCEL_INT2_FWM                   BIT(5)
+#define BMI088_ACCEL_INT2_DRDY                  BIT(6)
+#define BMI088_ACCEL_CMD_FIFO_FLUSH             0xB0
+
+#define BMI088_ACCEL_FIFO_SIZE                  1024
+/* Header byte followed by x, y, z */
+#define BMI088_ACCEL_FIFO_FRAME_LEN             7
+#define BMI088_ACCEL_FIFO_HDR_MASK              0xFC
+#define BMI088_ACCEL_FIFO_HDR_ACC               0x84
+#define BMI088_ACCEL_FIFO_HDR_SKIP              0x40
+#define BMI088_ACCEL_FIFO_HDR_TIME              0x44
+#define BMI088_ACCEL_FIFO_HDR_CONFIG            0x48
+#define BMI088_ACCEL_FIFO_HDR_DROP              0x50
+
+/* Gyroscope */
+#define BMI088_GYRO_FIFO_STATUS_REG             0x0E
+#define BMI088_GYRO_FIFO_WM_EN_REG              0x1E
+#define BMI088_GYRO_FIFO_CONFIG_0_REG           0x3D
+#define BMI088_GYRO_FIFO_CONFIG_1_REG           0x3E
+#define BMI088_GYRO_FIFO_DATA_REG               0x3F
+
+#define BMI088_GYRO_FIFO_FRAME_COUNT_MASK       0x7F
+#define BMI088_GYRO_FIFO_MODE_STREAM            0x80
+#define BMI088_GYRO_FIFO_WM_ENABLE              0x88
+#define BMI088_GYRO_FIFO_WM_DISABLE             0x08
+#define BMI088_GYRO_INT_CTRL_FIFO_EN            BIT(6)
+#define BMI088_GYRO_INT_CTRL_DATA_EN            BIT(7)
+#define BMI088_GYRO_INT3_DATA                   BIT(0)
+#define BMI088_GYRO_INT3_FIFO                   BIT(2)
+
+#define BMI088_GYRO_FIFO_FRAMES                 100
+/* x, y, z, no header */
+#define BMI088_GYRO_FIFO_FRAME_LEN              6
+
+#endif /* _BMI088_REGS_H_ */
@@ -3,9 +3,10 @@
 #define BMI160_H_
 
 extern const struct regmap_config bmi160_regmap_config;
+extern const struct dev_pm_ops bmi160_pm_ops;
 
 int bmi160_core_probe(struct device *dev, struct regmap *regmap,
-		      const char *name, bool use_spi);
+		      const char *name, bool use_spi, int irq);
 void bmi160_core_remove(struct device *dev);
 
 #endif  /* BMI160_H_ */
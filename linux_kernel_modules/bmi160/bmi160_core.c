@@ -9,15 +9,19 @@
  *
  * IIO core driver for BMI160, with support for I2C/SPI busses
  *
- * TODO: magnetometer, interrupts, hardware FIFO
+ * TODO: magnetometer
  */
 #include <linux/module.h>
 #include <linux/regmap.h>
 #include <linux/acpi.h>
 #include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/mutex.h>
+#include <linux/pm.h>
 
 #include <linux/iio/iio.h>
 #include <linux/iio/triggered_buffer.h>
+#include <linux/iio/trigger.h>
 #include <linux/iio/trigger_consumer.h>
 #include <linux/iio/buffer.h>
 #include <linux/iio/sysfs.h>
@@ -33,6 +37,7 @@
 #endif
 
 #include "bmi160.h"
+#include "../iio/buffer_n.h"
 
 #define BMI160_REG_CHIP_ID			0x00
 #define BMI160_CHIP_ID_VAL			0xD1
@@ -97,6 +102,10 @@
 #define BMI160_REG_TEMPERATURE_0		0x20
 #define BMI160_REG_TEMPERATURE_1		0x21
 
+#define BMI160_REG_FIFO_LENGTH			0x22
+#define BMI160_FIFO_LENGTH_MASK			GENMASK(10, 0)
+#define BMI160_REG_FIFO_DATA			0x24
+
 #define BMI160_REG_ACCEL_CONFIG			0x40
 #define BMI160_ACCEL_CONFIG_ODR_MASK		GENMASK(3, 0)
 #define BMI160_ACCEL_CONFIG_BWP_MASK		GENMASK(6, 4)
@@ -118,6 +127,18 @@
 #define BMI160_GYRO_RANGE_250DPS		0x03
 #define BMI160_GYRO_RANGE_125DPS		0x04
 
+/* Watermark level in units of BMI160_FIFO_WM_UNIT bytes */
+#define BMI160_REG_FIFO_CONFIG_0		0x46
+
+#define BMI160_REG_FIFO_CONFIG_1		0x47
+#define BMI160_FIFO_CONFIG_1_TIME_EN		BIT(1)
+#define BMI160_FIFO_CONFIG_1_TAG_INT2		BIT(2)
+#define BMI160_FIFO_CONFIG_1_TAG_INT1		BIT(3)
+#define BMI160_FIFO_CONFIG_1_HEADER_EN		BIT(4)
+#define BMI160_FIFO_CONFIG_1_MAG_EN		BIT(5)
+#define BMI160_FIFO_CONFIG_1_ACC_EN		BIT(6)
+#define BMI160_FIFO_CONFIG_1_GYR_EN		BIT(7)
+
 #define BMI160_REG_INT_EN_0			0x50
 #define BMI160_INT_EN_0_ANYM_X			BIT(0)
 #define BMI160_INT_EN_0_ANYM_Y			BIT(1)
@@ -264,6 +285,16 @@
 #define BMI160_GYRO_PMU_MIN_USLEEP		80000
 #define BMI160_SOFTRESET_USLEEP			1000
 
+#define BMI160_FIFO_SIZE			1024
+#define BMI160_FIFO_WM_UNIT			4
+/* Bytes contributed by one sensor to a headerless FIFO frame */
+#define BMI160_FIFO_SENSOR_BYTES		(3 * sizeof(__le16))
+#define BMI160_FIFO_IRQ_NAME			"bmi160_fifo"
+/* Scans built from FIFO frames before being pushed together */
+#define BMI160_FIFO_PUSH_BATCH			16
+/* 6 x __le16 data + __le16 temp + pad + 4 x __le16 tstamp */
+#define BMI160_SCAN_MAX_BYTES			(16 * sizeof(__le16))
+
 #define BMI160_CHANNEL(_type, _axis, _index) {			\
 	.type = _type,						\
 	.modified = 1,						\
@@ -320,11 +351,59 @@ struct bmi160_data {
 	 */
 	struct device *dev;
 #endif
+	/* Serializes FIFO (re)configuration against FIFO draining */
+	struct mutex mutex;
+	int irq;
+	struct iio_trigger *fifo_trig;
+	bool fifo_enabled;
+	/* Headerless frame: gyro then accel, each only if enabled */
+	unsigned int fifo_frame_len;
+	unsigned int fifo_wm_frames;
+	s64 fifo_period_ns;
+	__le16 fifo_buf[BMI160_FIFO_SIZE / sizeof(__le16)];
+	u8 fifo_scans[BMI160_FIFO_PUSH_BATCH * BMI160_SCAN_MAX_BYTES]
+		__aligned(8);
+	s64 fifo_ts[BMI160_FIFO_PUSH_BATCH];
+	/* Register span covering the active scan, fetched in one transfer */
+	unsigned int scan_reg;
+	unsigned int scan_len;
+	__le16 scan_regs[(BMI160_REG_TEMPERATURE_1 + 1 -
+			  BMI160_REG_DATA_MAGN_XOUT_L) / sizeof(__le16)];
 };
 
+static unsigned int fifo_watermark = 32;
+module_param(fifo_watermark, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fifo_watermark,
+		 "Frames buffered in the hardware FIFO before interrupting");
+
+/*
+ * Only the sensor and interrupt configuration is cached, so changing it costs
+ * a single write and resume can restore it with regcache_sync().
+ */
+static bool bmi160_is_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case BMI160_REG_ACCEL_CONFIG ... BMI160_REG_FIFO_CONFIG_1:
+	case BMI160_REG_INT_EN_0 ... BMI160_REG_INT_MOTION_3:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/* Reading FIFO_DATA pops frames off the FIFO */
+static bool bmi160_is_precious_reg(struct device *dev, unsigned int reg)
+{
+	return reg == BMI160_REG_FIFO_DATA;
+}
+
 const struct regmap_config bmi160_regmap_config = {
 	.reg_bits = 8,
 	.val_bits = 8,
+
+	.cache_type = REGCACHE_RBTREE,
+	.volatile_reg = bmi160_is_volatile_reg,
+	.precious_reg = bmi160_is_precious_reg,
 };
 EXPORT_SYMBOL(bmi160_regmap_config);
 
@@ -620,6 +699,230 @@ static int bmi160_get_odr(struct bmi160_data *data, enum bmi160_sensor_type t,
 	return 0;
 }
 
+static bool bmi160_scan_has_sensor(const unsigned long *mask, int first)
+{
+	return test_bit(first, mask) || test_bit(first + 1, mask) ||
+	       test_bit(first + 2, mask);
+}
+
+static int bmi160_fifo_enable(struct bmi160_data *data,
+			      const unsigned long *mask)
+{
+	bool gyro = bmi160_scan_has_sensor(mask, BMI160_SCAN_GYRO_X);
+	bool accel = bmi160_scan_has_sensor(mask, BMI160_SCAN_ACCEL_X);
+	unsigned int cfg = 0, frame_len = 0, wm;
+	int odr = 0, uodr = 0, godr, guodr, ret;
+
+	if (accel) {
+		ret = bmi160_get_odr(data, BMI160_ACCEL, &odr, &uodr);
+		if (ret < 0)
+			return ret;
+
+		cfg |= BMI160_FIFO_CONFIG_1_ACC_EN;
+		frame_len += BMI160_FIFO_SENSOR_BYTES;
+	}
+
+	if (gyro) {
+		ret = bmi160_get_odr(data, BMI160_GYRO, &godr, &guodr);
+		if (ret < 0)
+			return ret;
+
+		/* Headerless frames require a common ODR for all sensors */
+		if (accel && (godr != odr || guodr != uodr))
+			return -EINVAL;
+
+		odr = godr;
+		uodr = guodr;
+		cfg |= BMI160_FIFO_CONFIG_1_GYR_EN;
+		frame_len += BMI160_FIFO_SENSOR_BYTES;
+	}
+
+	if (!frame_len)
+		return -EINVAL;
+
+	/* Keep one frame of headroom so the FIFO never overflows at wm */
+	wm = clamp_t(unsigned int, fifo_watermark, 1,
+		     BMI160_FIFO_SIZE / frame_len - 1);
+
+	ret = regmap_write(data->regmap, BMI160_REG_FIFO_CONFIG_0,
+			   DIV_ROUND_UP(wm * frame_len, BMI160_FIFO_WM_UNIT));
+	if (ret < 0)
+		return ret;
+
+	ret = regmap_write(data->regmap, BMI160_REG_FIFO_CONFIG_1, cfg);
+	if (ret < 0)
+		return ret;
+
+	ret = regmap_write(data->regmap, BMI160_REG_CMD, BMI160_CMD_FIFO_FLUSH);
+	if (ret < 0)
+		return ret;
+
+	data->fifo_frame_len = frame_len;
+	data->fifo_wm_frames = wm;
+	data->fifo_period_ns = div_u64(NSEC_PER_SEC * 1000000ULL,
+				       (u32)odr * 1000000 + uodr);
+
+	ret = regmap_update_bits(data->regmap, BMI160_REG_INT_EN_1,
+				 BMI160_INT_EN_1_FWM, BMI160_INT_EN_1_FWM);
+	if (ret < 0)
+		return ret;
+
+	data->fifo_enabled = true;
+
+	return 0;
+}
+
+static int bmi160_fifo_disable(struct bmi160_data *data)
+{
+	int ret;
+
+	data->fifo_enabled = false;
+
+	ret = regmap_update_bits(data->regmap, BMI160_REG_INT_EN_1,
+				 BMI160_INT_EN_1_FWM, 0);
+	if (ret < 0)
+		return ret;
+
+	ret = regmap_write(data->regmap, BMI160_REG_FIFO_CONFIG_1, 0);
+	if (ret < 0)
+		return ret;
+
+	return regmap_write(data->regmap, BMI160_REG_CMD,
+			    BMI160_CMD_FIFO_FLUSH);
+}
+
+/*
+ * Drain every complete frame from the FIFO in a single burst and push one
+ * scan per frame. The interrupt fired when frame fifo_wm_frames - 1 was
+ * written, so that frame is stamped with the interrupt time and the others
+ * are spaced one ODR period apart around it.
+ */
+static void bmi160_fifo_drain(struct iio_dev *indio_dev, s64 irq_ts)
+{
+	struct bmi160_data *data = iio_priv(indio_dev);
+	__le16 regs[BMI160_SCAN_TEMPERATURE + 1];
+	__le16 fifo_len;
+	unsigned int i, n, words, anchor, batch = 0;
+	__le16 *buf;
+	int j, k, ret;
+	bool accel, gyro;
+
+	mutex_lock(&data->mutex);
+	if (!data->fifo_enabled)
+		goto unlock;
+
+	ret = regmap_bulk_read(data->regmap, BMI160_REG_FIFO_LENGTH,
+			       &fifo_len, sizeof(fifo_len));
+	if (ret < 0)
+		goto unlock;
+
+	/* The length field counts up to 2047, fifo_buf only holds 1024 */
+	n = min_t(unsigned int, le16_to_cpu(fifo_len) & BMI160_FIFO_LENGTH_MASK,
+		  BMI160_FIFO_SIZE) / data->fifo_frame_len;
+	if (!n)
+		goto unlock;
+
+	/*
+	 * FIFO_DATA does not auto-increment, so this is one burst. The
+	 * registers it would span past 0x3f are cached, and regmap only does
+	 * a raw burst over cached registers with the cache bypassed. Config
+	 * writes hold data->mutex, so none of them can miss the cache here.
+	 */
+	regcache_cache_bypass(data->regmap, true);
+	ret = regmap_raw_read(data->regmap, BMI160_REG_FIFO_DATA,
+			      data->fifo_buf, n * data->fifo_frame_len);
+	regcache_cache_bypass(data->regmap, false);
+	if (ret < 0) {
+		/* Frame alignment is unknown after a failed read, start over */
+		regmap_write(data->regmap, BMI160_REG_CMD,
+			     BMI160_CMD_FIFO_FLUSH);
+		goto unlock;
+	}
+
+	/* The temperature is not in the FIFO, sample it once per drain */
+	if (test_bit(BMI160_SCAN_TEMPERATURE, indio_dev->active_scan_mask)) {
+		ret = regmap_bulk_read(data->regmap, BMI160_REG_TEMPERATURE_0,
+				       &regs[BMI160_SCAN_TEMPERATURE],
+				       sizeof(__le16));
+		if (ret < 0)
+			goto unlock;
+	}
+
+	gyro = bmi160_scan_has_sensor(indio_dev->active_scan_mask,
+				      BMI160_SCAN_GYRO_X);
+	accel = bmi160_scan_has_sensor(indio_dev->active_scan_mask,
+				       BMI160_SCAN_ACCEL_X);
+	words = data->fifo_frame_len / sizeof(__le16);
+	anchor = min(n, data->fifo_wm_frames) - 1;
+
+	for (i = 0; i < n; i++) {
+		const __le16 *frame = &data->fifo_buf[i * words];
+
+		/* Frames hold the gyro before the accel, as in DATA regs */
+		if (gyro) {
+			memcpy(&regs[BMI160_SCAN_GYRO_X], frame,
+			       BMI160_FIFO_SENSOR_BYTES);
+			frame += 3;
+		}
+		if (accel)
+			memcpy(&regs[BMI160_SCAN_ACCEL_X], frame,
+			       BMI160_FIFO_SENSOR_BYTES);
+
+		buf = (__le16 *)&data->fifo_scans[batch *
+						   indio_dev->scan_bytes];
+		k = 0;
+		for_each_set_bit(j, indio_dev->active_scan_mask,
+				 indio_dev->masklength)
+			if (j != BMI160_SCAN_TIMESTAMP)
+				buf[k++] = regs[j];
+
+		data->fifo_ts[batch] = irq_ts +
+				       ((s64)i - anchor) * data->fifo_period_ns;
+		if (++batch == BMI160_FIFO_PUSH_BATCH || i == n - 1) {
+			iio_push_to_buffers_with_timestamps_n(indio_dev,
+				data->fifo_scans, data->fifo_ts, batch);
+			batch = 0;
+		}
+	}
+
+unlock:
+	mutex_unlock(&data->mutex);
+}
+
+static unsigned int bmi160_scan_reg(int scan_index)
+{
+	if (scan_index == BMI160_SCAN_TEMPERATURE)
+		return BMI160_REG_TEMPERATURE_0;
+
+	return BMI160_REG_DATA_MAGN_XOUT_L + scan_index * sizeof(__le16);
+}
+
+static int bmi160_update_scan_mode(struct iio_dev *indio_dev,
+				   const unsigned long *scan_mask)
+{
+	struct bmi160_data *data = iio_priv(indio_dev);
+	unsigned int reg, first = UINT_MAX, last = 0;
+	int i;
+
+	for_each_set_bit(i, scan_mask, indio_dev->masklength) {
+		if (i == BMI160_SCAN_TIMESTAMP)
+			continue;
+		reg = bmi160_scan_reg(i);
+		first = min(first, reg);
+		last = max(last, reg);
+	}
+
+	if (first > last) {
+		data->scan_len = 0;
+		return 0;
+	}
+
+	data->scan_reg = first;
+	data->scan_len = last + sizeof(__le16) - first;
+
+	return 0;
+}
+
 static irqreturn_t bmi160_trigger_handler(int irq, void *p)
 {
 	struct iio_poll_func *pf = p;
@@ -627,23 +930,33 @@ static irqreturn_t bmi160_trigger_handler(int irq, void *p)
 	struct bmi160_data *data = iio_priv(indio_dev);
 	__le16 buf[16];
 	/* 3 sens x 3 axis x __le16 + 3 x __le16 pad + 4 x __le16 tstamp */
-	int i, ret, j = 0, base = BMI160_REG_DATA_MAGN_XOUT_L;
-	__le16 sample;
+	int i, ret, j = 0;
 
-	for_each_set_bit(i, indio_dev->active_scan_mask,
-			 indio_dev->masklength) {
-		ret = regmap_bulk_read(data->regmap, base + i * sizeof(sample),
-				       &sample, sizeof(sample));
+	if (data->fifo_trig && indio_dev->trig == data->fifo_trig) {
+		bmi160_fifo_drain(indio_dev, pf->timestamp);
+		goto done;
+	}
+
+	/*
+	 * The data and temperature registers are adjacent, so read the whole
+	 * span of enabled channels at once and pick the samples out of it.
+	 */
+	if (data->scan_len) {
+		ret = regmap_bulk_read(data->regmap, data->scan_reg,
+				       data->scan_regs, data->scan_len);
 		if (ret < 0)
 			goto done;
-		buf[j++] = sample;
 	}
 
-	iio_push_to_buffers_with_timestamp(indio_dev, buf, iio_get_time_ns(
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
-						   indio_dev
-#endif
-						   ));
+	for_each_set_bit(i, indio_dev->active_scan_mask,
+			 indio_dev->masklength) {
+		if (i == BMI160_SCAN_TIMESTAMP)
+			continue;
+		buf[j++] = data->scan_regs[(bmi160_scan_reg(i) -
+					    data->scan_reg) / sizeof(__le16)];
+	}
+
+	iio_push_to_buffers_with_timestamp(indio_dev, buf, pf->timestamp);
 done:
 	iio_trigger_notify_done(indio_dev->trig);
 	return IRQ_HANDLED;
@@ -735,20 +1048,30 @@ static int bmi160_write_raw(struct iio_dev *indio_dev,
 			    int val, int val2, long mask)
 {
 	struct bmi160_data *data = iio_priv(indio_dev);
+	int ret;
 
+	/* Serialized against bmi160_fifo_drain(), which bypasses the cache */
+	mutex_lock(&data->mutex);
 	switch (mask) {
 	case IIO_CHAN_INFO_SCALE:
-		return bmi160_set_scale(data,
-					bmi160_to_sensor(chan->type), val2);
+		ret = bmi160_set_scale(data,
+				       bmi160_to_sensor(chan->type), val2);
 		break;
 	case IIO_CHAN_INFO_SAMP_FREQ:
-		return bmi160_set_odr(data, bmi160_to_sensor(chan->type),
-				      val, val2);
+		/* FIFO timestamps are derived from the ODR it was started at */
+		if (data->fifo_enabled)
+			ret = -EBUSY;
+		else
+			ret = bmi160_set_odr(data, bmi160_to_sensor(chan->type),
+					     val, val2);
+		break;
 	default:
-		return -EINVAL;
+		ret = -EINVAL;
+		break;
 	}
+	mutex_unlock(&data->mutex);
 
-	return 0;
+	return ret;
 }
 
 static int bmi160_setup_sigmot_int(struct bmi160_data *data)
@@ -825,6 +1148,53 @@ static int bmi160_setup_sigmot_int(struct bmi160_data *data)
 	return ret;
 }
 
+/*
+ * The FIFO watermark interrupt goes out on INT1 so that INT2 stays dedicated to
+ * significant motion. The latch mode programmed for significant motion does
+ * not apply to the FIFO interrupts, which clear as soon as the FIFO is read.
+ */
+static int bmi160_setup_fifo_int(struct bmi160_data *data)
+{
+	int ret;
+
+	ret = regmap_update_bits(data->regmap, BMI160_REG_INT_MAP_1,
+				 BMI160_INT_MAP_1_INT1_FWM,
+				 BMI160_INT_MAP_1_INT1_FWM);
+	if (ret < 0)
+		return ret;
+
+	/* Rising edge on INT1 pin */
+	return regmap_update_bits(data->regmap, BMI160_REG_INT_OUT_CTRL,
+				  (BMI160_INT_OUT_CTRL_INT1_EDGE |
+				   BMI160_INT_OUT_CTRL_INT1_LVL |
+				   BMI160_INT_OUT_CTRL_INT1_OD |
+				   BMI160_INT_OUT_CTRL_INT1_OUTPUT_EN),
+				  (BMI160_INT_OUT_CTRL_INT1_EDGE |
+				   BMI160_INT_OUT_CTRL_INT1_LVL |
+				   BMI160_INT_OUT_CTRL_INT1_OUTPUT_EN));
+}
+
+static int bmi160_fifo_trigger_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct bmi160_data *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->mutex);
+	if (state)
+		ret = bmi160_fifo_enable(data, indio_dev->active_scan_mask);
+	else
+		ret = bmi160_fifo_disable(data);
+	mutex_unlock(&data->mutex);
+
+	return ret;
+}
+
+static const struct iio_trigger_ops bmi160_fifo_trigger_ops = {
+	.set_trigger_state = bmi160_fifo_trigger_set_state,
+	.validate_device = iio_trigger_validate_own_device,
+};
+
 static
 IIO_CONST_ATTR(in_accel_sampling_frequency_available,
 	       "0.78125 1.5625 3.125 6.25 12.5 25 50 100 200 400 800 1600");
@@ -853,6 +1223,7 @@ static const struct attribute_group bmi160_attrs_group = {
 static const struct iio_info bmi160_info = {
 	.read_raw = bmi160_read_raw,
 	.write_raw = bmi160_write_raw,
+	.update_scan_mode = bmi160_update_scan_mode,
 	.attrs = &bmi160_attrs_group,
 };
 
@@ -931,7 +1302,7 @@ static void bmi160_chip_uninit(struct bmi160_data *data)
 }
 
 int bmi160_core_probe(struct device *dev, struct regmap *regmap,
-		      const char *name, bool use_spi)
+		      const char *name, bool use_spi, int irq)
 {
 	struct iio_dev *indio_dev;
 	struct bmi160_data *data;
@@ -947,6 +1318,8 @@ int bmi160_core_probe(struct device *dev, struct regmap *regmap,
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 16, 0)
 	data->dev = dev;
 #endif
+	data->irq = irq;
+	mutex_init(&data->mutex);
 
 	ret = bmi160_chip_init(data, use_spi);
 	if (ret < 0)
@@ -962,10 +1335,39 @@ int bmi160_core_probe(struct device *dev, struct regmap *regmap,
 	indio_dev->modes = INDIO_DIRECT_MODE;
 	indio_dev->info = &bmi160_info;
 
-	ret = iio_triggered_buffer_setup(indio_dev, NULL,
+	if (irq > 0) {
+		ret = bmi160_setup_fifo_int(data);
+		if (ret < 0)
+			goto uninit;
+
+		data->fifo_trig = devm_iio_trigger_alloc(dev, "%s-fifo-dev%d",
+							 indio_dev->name,
+							 indio_dev->id);
+		if (!data->fifo_trig) {
+			ret = -ENOMEM;
+			goto uninit;
+		}
+
+		data->fifo_trig->dev.parent = dev;
+		data->fifo_trig->ops = &bmi160_fifo_trigger_ops;
+		iio_trigger_set_drvdata(data->fifo_trig, indio_dev);
+		ret = iio_trigger_register(data->fifo_trig);
+		if (ret < 0)
+			goto uninit;
+
+		ret = request_irq(irq, iio_trigger_generic_data_rdy_poll,
+				  IRQF_TRIGGER_RISING, BMI160_FIFO_IRQ_NAME,
+				  data->fifo_trig);
+		if (ret < 0) {
+			dev_err(dev, "request irq %d failed\n", irq);
+			goto trigger_unregister;
+		}
+	}
+
+	ret = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time,
 					 bmi160_trigger_handler, NULL);
 	if (ret < 0)
-		goto uninit;
+		goto free_irq;
 
 	ret = iio_device_register(indio_dev);
 	if (ret < 0)
@@ -974,6 +1376,12 @@ int bmi160_core_probe(struct device *dev, struct regmap *regmap,
 	return 0;
 buffer_cleanup:
 	iio_triggered_buffer_cleanup(indio_dev);
+free_irq:
+	if (irq > 0)
+		free_irq(irq, data->fifo_trig);
+trigger_unregister:
+	if (data->fifo_trig)
+		iio_trigger_unregister(data->fifo_trig);
 uninit:
 	bmi160_chip_uninit(data);
 	return ret;
@@ -987,10 +1395,59 @@ void bmi160_core_remove(struct device *dev)
 
 	iio_device_unregister(indio_dev);
 	iio_triggered_buffer_cleanup(indio_dev);
+	if (data->irq > 0)
+		free_irq(data->irq, data->fifo_trig);
+	if (data->fifo_trig)
+		iio_trigger_unregister(data->fifo_trig);
 	bmi160_chip_uninit(data);
 }
 EXPORT_SYMBOL_GPL(bmi160_core_remove);
 
+#ifdef CONFIG_PM_SLEEP
+static int bmi160_suspend(struct device *dev)
+{
+	struct iio_dev *indio_dev = dev_get_drvdata(dev);
+	struct bmi160_data *data = iio_priv(indio_dev);
+
+	/* The supply may go away, so write the whole cache back on resume */
+	mutex_lock(&data->mutex);
+	regcache_cache_only(data->regmap, true);
+	regcache_mark_dirty(data->regmap);
+	mutex_unlock(&data->mutex);
+
+	return 0;
+}
+
+static int bmi160_resume(struct device *dev)
+{
+	struct iio_dev *indio_dev = dev_get_drvdata(dev);
+	struct bmi160_data *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->mutex);
+	regcache_cache_only(data->regmap, false);
+	ret = regcache_sync(data->regmap);
+	if (ret < 0)
+		goto unlock;
+
+	/* Power modes are set through the uncached command register */
+	ret = bmi160_set_mode(data, BMI160_ACCEL, BMI160_PMU_STATE_NORMAL);
+	if (ret < 0)
+		goto unlock;
+
+	ret = bmi160_set_mode(data, BMI160_GYRO, BMI160_PMU_STATE_NORMAL);
+
+unlock:
+	mutex_unlock(&data->mutex);
+	return ret;
+}
+#endif
+
+const struct dev_pm_ops bmi160_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(bmi160_suspend, bmi160_resume)
+};
+EXPORT_SYMBOL_GPL(bmi160_pm_ops);
+
 MODULE_AUTHOR("Daniel Baluta <daniel.baluta@intel.com");
 MODULE_DESCRIPTION("Bosch BMI160 driver");
 MODULE_LICENSE("GPL v2");
@@ -53,6 +53,7 @@
 #define BMC150_MAGN_REG_RHALL_L			0x48
 #define BMC150_MAGN_REG_RHALL_M			0x49
 #define BMC150_MAGN_SHIFT_RHALL_L		2
+#define BMC150_MAGN_MASK_DRDY_STATUS		BIT(0)
 
 #define BMC150_MAGN_REG_INT_STATUS		0x4A
 
@@ -98,6 +99,8 @@
 
 #define BMC150_MAGN_AUTO_SUSPEND_DELAY_MS	2000
 
+#define BMC150_MAGN_MAX_DECIMATION		32
+
 #define BMC150_MAGN_REGVAL_TO_REPXY(regval) (((regval) * 2) + 1)
 #define BMC150_MAGN_REGVAL_TO_REPZ(regval) ((regval) + 1)
 #define BMC150_MAGN_REPXY_TO_REGVAL(rep) (((rep) - 1) / 2)
@@ -146,8 +149,18 @@ struct bmc150_magn_data {
 	 */
 	struct mutex mutex;
 	struct regmap *regmap;
+	/* Read once at init, they never change */
+	struct bmc150_magn_trim_regs tregs;
 	/* 4 x 32 bits for x, y z, 4 bytes align, 64 bits timestamp */
 	s32 buffer[6];
+	/* Raw samples averaged into the next buffered scan */
+	__le16 raw[BMC150_MAGN_MAX_DECIMATION][AXIS_XYZR_MAX];
+	unsigned int nr_raw;
+	unsigned int decimation;
+	/* Set by the interrupt, cleared when the sample is read */
+	atomic_t new_data;
+	/* Data ready is enabled to track new samples for other triggers */
+	bool drdy_tracking;
 	struct iio_trigger *dready_trig;
 	bool dready_trigger_on;
 	int max_odr;
@@ -217,6 +230,10 @@ static const struct bmc150_magn_preset {
 
 #define BMC150_MAGN_DEFAULT_PRESET REGULAR_PRESET
 
+static unsigned int decimation = 1;
+module_param(decimation, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(decimation, "New samples averaged into each buffered scan");
+
 static bool bmc150_magn_is_writeable_reg(struct device *dev, unsigned int reg)
 {
 	switch (reg) {
@@ -398,48 +415,40 @@ static int bmc150_magn_set_max_odr(struct bmc150_magn_data *data, int rep_xy,
 	return 0;
 }
 
-static s32 bmc150_magn_compensate_x(struct bmc150_magn_trim_regs *tregs, s16 x,
-				    u16 rhall)
+static s32 bmc150_magn_compensate_xy_axis(s16 raw, s32 xy, s8 t1, s8 t2)
 {
 	s16 val;
-	u16 xyz1 = le16_to_cpu(tregs->xyz1);
 
-	if (x == BMC150_MAGN_XY_OVERFLOW_VAL)
+	if (raw == BMC150_MAGN_XY_OVERFLOW_VAL)
 		return S32_MIN;
 
-	if (!rhall)
-		rhall = xyz1;
-
-	val = ((s16)(((u16)((((s32)xyz1) << 14) / rhall)) - ((u16)0x4000)));
-	val = ((s16)((((s32)x) * ((((((((s32)tregs->xy2) * ((((s32)val) *
-	      ((s32)val)) >> 7)) + (((s32)val) *
-	      ((s32)(((s16)tregs->xy1) << 7)))) >> 9) + ((s32)0x100000)) *
-	      ((s32)(((s16)tregs->x2) + ((s16)0xA0)))) >> 12)) >> 13)) +
-	      (((s16)tregs->x1) << 3);
+	val = ((s16)((((s32)raw) * ((xy *
+	      ((s32)(((s16)t2) + ((s16)0xA0)))) >> 12)) >> 13)) +
+	      (((s16)t1) << 3);
 
 	return (s32)val;
 }
 
-static s32 bmc150_magn_compensate_y(struct bmc150_magn_trim_regs *tregs, s16 y,
-				    u16 rhall)
+/* x and y share the rhall term, so it is only worked out once */
+static void bmc150_magn_compensate_xy(struct bmc150_magn_trim_regs *tregs,
+				      s16 x, s16 y, u16 rhall, s32 *buffer)
 {
 	s16 val;
+	s32 xy;
 	u16 xyz1 = le16_to_cpu(tregs->xyz1);
 
-	if (y == BMC150_MAGN_XY_OVERFLOW_VAL)
-		return S32_MIN;
-
 	if (!rhall)
 		rhall = xyz1;
 
 	val = ((s16)(((u16)((((s32)xyz1) << 14) / rhall)) - ((u16)0x4000)));
-	val = ((s16)((((s32)y) * ((((((((s32)tregs->xy2) * ((((s32)val) *
-	      ((s32)val)) >> 7)) + (((s32)val) *
-	      ((s32)(((s16)tregs->xy1) << 7)))) >> 9) + ((s32)0x100000)) *
-	      ((s32)(((s16)tregs->y2) + ((s16)0xA0)))) >> 12)) >> 13)) +
-	      (((s16)tregs->y1) << 3);
-
-	return (s32)val;
+	xy = (((((s32)tregs->xy2) * ((((s32)val) * ((s32)val)) >> 7)) +
+	     (((s32)val) * ((s32)(((s16)tregs->xy1) << 7)))) >> 9) +
+	     ((s32)0x100000);
+
+	buffer[AXIS_X] = bmc150_magn_compensate_xy_axis(x, xy, tregs->x1,
+							tregs->x2);
+	buffer[AXIS_Y] = bmc150_magn_compensate_xy_axis(y, xy, tregs->y1,
+							tregs->y2);
 }
 
 static s32 bmc150_magn_compensate_z(struct bmc150_magn_trim_regs *tregs, s16 z,
@@ -462,32 +471,59 @@ static s32 bmc150_magn_compensate_z(struct bmc150_magn_trim_regs *tregs, s16 z,
 	return val;
 }
 
-static int bmc150_magn_read_xyz(struct bmc150_magn_data *data, s32 *buffer)
+/*
+ * Compensate n raw samples and average them into buffer. Overflowed samples
+ * are left out of the average of their axis.
+ */
+static void bmc150_magn_compensate_n(struct bmc150_magn_data *data,
+				     __le16 (*raw)[AXIS_XYZR_MAX],
+				     unsigned int n, s32 *buffer)
 {
-	int ret;
-	__le16 values[AXIS_XYZR_MAX];
+	s64 sum[AXIS_XYZ_MAX] = { 0 };
+	unsigned int count[AXIS_XYZ_MAX] = { 0 };
+	s32 values[AXIS_XYZ_MAX];
+	unsigned int i, axis;
 	s16 raw_x, raw_y, raw_z;
 	u16 rhall;
-	struct bmc150_magn_trim_regs tregs;
 
-	ret = regmap_bulk_read(data->regmap, BMC150_MAGN_REG_X_L,
-			       values, sizeof(values));
-	if (ret < 0)
-		return ret;
+	for (i = 0; i < n; i++) {
+		raw_x = (s16)le16_to_cpu(raw[i][AXIS_X]) >>
+			BMC150_MAGN_SHIFT_XY_L;
+		raw_y = (s16)le16_to_cpu(raw[i][AXIS_Y]) >>
+			BMC150_MAGN_SHIFT_XY_L;
+		raw_z = (s16)le16_to_cpu(raw[i][AXIS_Z]) >>
+			BMC150_MAGN_SHIFT_Z_L;
+		rhall = le16_to_cpu(raw[i][RHALL]) >> BMC150_MAGN_SHIFT_RHALL_L;
+
+		bmc150_magn_compensate_xy(&data->tregs, raw_x, raw_y, rhall,
+					  values);
+		values[AXIS_Z] = bmc150_magn_compensate_z(&data->tregs, raw_z,
+							  rhall);
+
+		for (axis = 0; axis < AXIS_XYZ_MAX; axis++) {
+			if (values[axis] == S32_MIN)
+				continue;
+			sum[axis] += values[axis];
+			count[axis]++;
+		}
+	}
 
-	raw_x = (s16)le16_to_cpu(values[AXIS_X]) >> BMC150_MAGN_SHIFT_XY_L;
-	raw_y = (s16)le16_to_cpu(values[AXIS_Y]) >> BMC150_MAGN_SHIFT_XY_L;
-	raw_z = (s16)le16_to_cpu(values[AXIS_Z]) >> BMC150_MAGN_SHIFT_Z_L;
-	rhall = le16_to_cpu(values[RHALL]) >> BMC150_MAGN_SHIFT_RHALL_L;
+	for (axis = 0; axis < AXIS_XYZ_MAX; axis++)
+		buffer[axis] = count[axis] ?
+			       div_s64(sum[axis], count[axis]) : S32_MIN;
+}
 
-	ret = regmap_bulk_read(data->regmap, BMC150_MAGN_REG_TRIM_START,
-			       &tregs, sizeof(tregs));
+static int bmc150_magn_read_xyz(struct bmc150_magn_data *data, s32 *buffer)
+{
+	int ret;
+	__le16 values[1][AXIS_XYZR_MAX];
+
+	ret = regmap_bulk_read(data->regmap, BMC150_MAGN_REG_X_L,
+			       values, sizeof(values));
 	if (ret < 0)
 		return ret;
 
-	buffer[AXIS_X] = bmc150_magn_compensate_x(&tregs, raw_x, rhall);
-	buffer[AXIS_Y] = bmc150_magn_compensate_y(&tregs, raw_y, rhall);
-	buffer[AXIS_Z] = bmc150_magn_compensate_z(&tregs, raw_z, rhall);
+	bmc150_magn_compensate_n(data, values, 1, buffer);
 
 	return 0;
 }
@@ -701,17 +737,38 @@ static irqreturn_t bmc150_magn_trigger_handler(int irq, void *p)
 	struct iio_poll_func *pf = p;
 	struct iio_dev *indio_dev = pf->indio_dev;
 	struct bmc150_magn_data *data = iio_priv(indio_dev);
+	__le16 *raw;
 	int ret;
 
 	mutex_lock(&data->mutex);
-	ret = bmc150_magn_read_xyz(data, data->buffer);
+
+	/*
+	 * Another, faster trigger may drive the buffer. Without a new data
+	 * ready interrupt since the last read there is nothing to fetch.
+	 */
+	if (data->drdy_tracking && !atomic_xchg(&data->new_data, 0))
+		goto unlock;
+
+	/* x, y, z and rhall in one burst, which also clears data ready */
+	raw = data->raw[data->nr_raw];
+	ret = regmap_bulk_read(data->regmap, BMC150_MAGN_REG_X_L, raw,
+			       sizeof(data->raw[0]));
 	if (ret < 0)
-		goto err;
+		goto unlock;
+
+	if (!(le16_to_cpu(raw[RHALL]) & BMC150_MAGN_MASK_DRDY_STATUS))
+		goto unlock;
+
+	if (++data->nr_raw < data->decimation)
+		goto unlock;
+
+	bmc150_magn_compensate_n(data, data->raw, data->nr_raw, data->buffer);
+	data->nr_raw = 0;
 
 	iio_push_to_buffers_with_timestamp(indio_dev, data->buffer,
 					   pf->timestamp);
 
-err:
+unlock:
 	mutex_unlock(&data->mutex);
 	iio_trigger_notify_done(indio_dev->trig);
 
@@ -743,6 +800,13 @@ static int bmc150_magn_init(struct bmc150_magn_data *data)
 	}
 	dev_dbg(data->dev, "Chip id %x\n", chip_id);
 
+	ret = regmap_bulk_read(data->regmap, BMC150_MAGN_REG_TRIM_START,
+			       &data->tregs, sizeof(data->tregs));
+	if (ret < 0) {
+		dev_err(data->dev, "Failed reading trim registers\n");
+		goto err_poweroff;
+	}
+
 	preset = bmc150_magn_presets_table[BMC150_MAGN_DEFAULT_PRESET];
 	ret = bmc150_magn_set_odr(data, preset.odr);
 	if (ret < 0) {
@@ -797,6 +861,31 @@ static int bmc150_magn_reset_intr(struct bmc150_magn_data *data)
 	return regmap_read(data->regmap, BMC150_MAGN_REG_X_L, &tmp);
 }
 
+static int bmc150_magn_update_drdy(struct bmc150_magn_data *data)
+{
+	bool on = data->dready_trigger_on || data->drdy_tracking;
+
+	return regmap_update_bits(data->regmap, BMC150_MAGN_REG_INT_DRDY,
+				  BMC150_MAGN_MASK_DRDY_EN,
+				  on << BMC150_MAGN_SHIFT_DRDY_EN);
+}
+
+static irqreturn_t bmc150_magn_irq_handler(int irq, void *private)
+{
+	struct iio_dev *indio_dev = private;
+	struct bmc150_magn_data *data = iio_priv(indio_dev);
+
+	atomic_set(&data->new_data, 1);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+	iio_trigger_poll(data->dready_trig);
+#else
+	iio_trigger_poll(data->dready_trig, iio_get_time_ns());
+#endif
+
+	return IRQ_HANDLED;
+}
+
 static int bmc150_magn_trig_try_reen(struct iio_trigger *trig)
 {
 	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
@@ -824,14 +913,14 @@ static int bmc150_magn_data_rdy_trigger_set_state(struct iio_trigger *trig,
 	if (state == data->dready_trigger_on)
 		goto err_unlock;
 
-	ret = regmap_update_bits(data->regmap, BMC150_MAGN_REG_INT_DRDY,
-				 BMC150_MAGN_MASK_DRDY_EN,
-				 state << BMC150_MAGN_SHIFT_DRDY_EN);
-	if (ret < 0)
-		goto err_unlock;
-
 	data->dready_trigger_on = state;
 
+	ret = bmc150_magn_update_drdy(data);
+	if (ret < 0) {
+		data->dready_trigger_on = !state;
+		goto err_unlock;
+	}
+
 	if (state) {
 		ret = bmc150_magn_reset_intr(data);
 		if (ret < 0)
@@ -854,14 +943,48 @@ static const struct iio_trigger_ops bmc150_magn_trigger_ops = {
 static int bmc150_magn_buffer_preenable(struct iio_dev *indio_dev)
 {
 	struct bmc150_magn_data *data = iio_priv(indio_dev);
+	int ret;
+
+	ret = bmc150_magn_set_power_state(data, true);
+	if (ret < 0)
+		return ret;
 
-	return bmc150_magn_set_power_state(data, true);
+	mutex_lock(&data->mutex);
+	data->decimation = clamp_t(unsigned int, decimation, 1,
+				   BMC150_MAGN_MAX_DECIMATION);
+	data->nr_raw = 0;
+
+	/*
+	 * Keep data ready on whatever the trigger, so that a faster one only
+	 * reads the chip when it has a new sample. The first trigger reads
+	 * unconditionally, which also releases a data ready left pending.
+	 */
+	if (data->irq > 0) {
+		data->drdy_tracking = true;
+		atomic_set(&data->new_data, 1);
+		ret = bmc150_magn_update_drdy(data);
+		if (ret < 0)
+			data->drdy_tracking = false;
+	}
+	mutex_unlock(&data->mutex);
+
+	if (ret < 0)
+		bmc150_magn_set_power_state(data, false);
+
+	return ret;
 }
 
 static int bmc150_magn_buffer_postdisable(struct iio_dev *indio_dev)
 {
 	struct bmc150_magn_data *data = iio_priv(indio_dev);
 
+	mutex_lock(&data->mutex);
+	if (data->drdy_tracking) {
+		data->drdy_tracking = false;
+		bmc150_magn_update_drdy(data);
+	}
+	mutex_unlock(&data->mutex);
+
 	return bmc150_magn_set_power_state(data, false);
 }
 
@@ -904,6 +1027,7 @@ int bmc150_magn_probe(struct device *dev, struct regmap *regmap,
 		name = bmc150_magn_match_acpi_device(dev);
 
 	mutex_init(&data->mutex);
+	atomic_set(&data->new_data, 0);
 
 	ret = bmc150_magn_init(data);
 	if (ret < 0)
@@ -938,11 +1062,11 @@ int bmc150_magn_probe(struct device *dev, struct regmap *regmap,
 		}
 
 		ret = request_threaded_irq(irq,
-					   iio_trigger_generic_data_rdy_poll,
+					   bmc150_magn_irq_handler,
 					   NULL,
 					   IRQF_TRIGGER_RISING | IRQF_ONESHOT,
 					   BMC150_MAGN_IRQ_NAME,
-					   data->dready_trig);
+					   indio_dev);
 		if (ret < 0) {
 			dev_err(dev, "request irq %d failed\n", irq);
 			goto err_trigger_unregister;
@@ -980,7 +1104,7 @@ err_buffer_cleanup:
 	iio_triggered_buffer_cleanup(indio_dev);
 err_free_irq:
 	if (irq > 0)
-		free_irq(irq, data->dready_trig);
+		free_irq(irq, indio_dev);
 err_trigger_unregister:
 	if (data->dready_trig)
 		iio_trigger_unregister(data->dready_trig);
@@ -1004,7 +1128,7 @@ int bmc150_magn_remove(struct device *dev)
 	iio_triggered_buffer_cleanup(indio_dev);
 
 	if (data->irq > 0)
-		free_irq(data->irq, data->dready_trig);
+		free_irq(data->irq, indio_dev);
 
 	if (data->dready_trig)
 		iio_trigger_unregister(data->dready_trig);
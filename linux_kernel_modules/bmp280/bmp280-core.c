@@ -25,6 +25,9 @@
 #include <linux/delay.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/gpio/consumer.h>
 #include <linux/regulator/consumer.h>
 #include <linux/interrupt.h>
@@ -56,6 +59,34 @@ struct bmp180_calib {
 	s16 MD;
 };
 
+struct bmp280_calib {
+	u16 T1;
+	s16 T2;
+	s16 T3;
+	u16 P1;
+	s16 P2;
+	s16 P3;
+	s16 P4;
+	s16 P5;
+	s16 P6;
+	s16 P7;
+	s16 P8;
+	s16 P9;
+	u8  H1;
+	s16 H2;
+	u8  H3;
+	s16 H4;
+	s16 H5;
+	s8  H6;
+};
+
+enum bmp280_scan {
+	BMP280_SCAN_PRESS,
+	BMP280_SCAN_TEMP,
+	BMP280_SCAN_HUMID,
+	BMP280_SCAN_TIMESTAMP,
+};
+
 struct bmp280_data {
 	struct device *dev;
 	struct mutex lock;
@@ -63,7 +94,10 @@ struct bmp280_data {
 	struct completion done;
 	bool use_eoc;
 	const struct bmp280_chip_info *chip_info;
-	struct bmp180_calib calib;
+	union {
+		struct bmp180_calib bmp180;
+		struct bmp280_calib bmp280;
+	} calib;
 	struct regulator *vddd;
 	struct regulator *vdda;
 	unsigned int start_up_time; /* in milliseconds */
@@ -78,6 +112,9 @@ struct bmp280_data {
 	 * calculation.
 	 */
 	s32 t_fine;
+
+	/* Up to three channels, padding and the timestamp */
+	u32 scan[6] __aligned(8);
 };
 
 struct bmp280_chip_info {
@@ -94,6 +131,9 @@ struct bmp280_chip_info {
 	int (*read_temp)(struct bmp280_data *, int *);
 	int (*read_press)(struct bmp280_data *, int *, int *);
 	int (*read_humid)(struct bmp280_data *, int *, int *);
+
+	/* NULL if the chip has no buffered capture */
+	irqreturn_t (*trigger_handler)(int, void *);
 };
 
 /*
@@ -103,96 +143,148 @@ struct bmp280_chip_info {
 enum { T1, T2, T3 };
 enum { P1, P2, P3, P4, P5, P6, P7, P8, P9 };
 
-static const struct iio_chan_spec bmp280_channels[] = {
-	{
-		.type = IIO_PRESSURE,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED)
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
-		| BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO)
-#endif
-		,
-    },
-	{
-		.type = IIO_TEMP,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED)
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
-		| BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO)
-#endif
-		,
-	},
-	{
-		.type = IIO_HUMIDITYRELATIVE,
-		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED)
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
-		| BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO)
+#define BMP280_INFO_OVERSAMPLING_RATIO	BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO)
+#else
+#define BMP280_INFO_OVERSAMPLING_RATIO	0
 #endif
-		,
-	},
+
+#define BMP280_CHANNEL(_type, _info, _index, _sign) {			\
+	.type = _type,							\
+	.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) |		\
+			      BMP280_INFO_OVERSAMPLING_RATIO | (_info),	\
+	.scan_index = _index,						\
+	.scan_type = {							\
+		.sign = _sign,						\
+		.realbits = 32,						\
+		.storagebits = 32,					\
+		.endianness = IIO_CPU,					\
+	},								\
+}
+
+static const struct iio_chan_spec bmp180_channels[] = {
+	BMP280_CHANNEL(IIO_PRESSURE, 0, -1, 'u'),
+	BMP280_CHANNEL(IIO_TEMP, 0, -1, 's'),
+};
+
+static const struct iio_chan_spec bmp280_channels[] = {
+	BMP280_CHANNEL(IIO_PRESSURE, BIT(IIO_CHAN_INFO_SCALE),
+		       BMP280_SCAN_PRESS, 'u'),
+	BMP280_CHANNEL(IIO_TEMP, BIT(IIO_CHAN_INFO_SCALE),
+		       BMP280_SCAN_TEMP, 's'),
+	IIO_CHAN_SOFT_TIMESTAMP(BMP280_SCAN_TIMESTAMP),
+};
+
+static const struct iio_chan_spec bme280_channels[] = {
+	BMP280_CHANNEL(IIO_PRESSURE, BIT(IIO_CHAN_INFO_SCALE),
+		       BMP280_SCAN_PRESS, 'u'),
+	BMP280_CHANNEL(IIO_TEMP, BIT(IIO_CHAN_INFO_SCALE),
+		       BMP280_SCAN_TEMP, 's'),
+	BMP280_CHANNEL(IIO_HUMIDITYRELATIVE, BIT(IIO_CHAN_INFO_SCALE),
+		       BMP280_SCAN_HUMID, 'u'),
+	IIO_CHAN_SOFT_TIMESTAMP(BMP280_SCAN_TIMESTAMP),
 };
 
 /*
- * Returns humidity in percent, resolution is 0.01 percent. Output value of
- * "47445" represents 47445/1024 = 46.333 %RH.
- *
- * Taken from BME280 datasheet, Section 4.2.3, "Compensation formula".
+ * Reads the compensation parameters out of the NVM. They never change, so
+ * this is done once at probe time rather than for every conversion.
  */
-
-static u32 bmp280_compensate_humidity(struct bmp280_data *data,
-				      s32 adc_humidity)
+static int bmp280_read_calib(struct bmp280_data *data,
+			     struct bmp280_calib *calib,
+			     unsigned int chip)
 {
-	struct device *dev = data->dev;
-	unsigned int H1, H3, tmp;
-	int H2, H4, H5, H6, ret, var;
+	int ret;
+	unsigned int tmp;
+	__le16 t_buf[BMP280_COMP_TEMP_REG_COUNT / 2];
+	__le16 p_buf[BMP280_COMP_PRESS_REG_COUNT / 2];
+	u8 h_buf[BMP280_COMP_H2_H6_REG_COUNT];
 
-	ret = regmap_read(data->regmap, BMP280_REG_COMP_H1, &H1);
+	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_TEMP_START,
+			       t_buf, BMP280_COMP_TEMP_REG_COUNT);
 	if (ret < 0) {
-		dev_err(dev, "failed to read H1 comp value\n");
+		dev_err(data->dev,
+			"failed to read temperature calibration parameters\n");
 		return ret;
 	}
 
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_H2, &tmp, 2);
-	if (ret < 0) {
-		dev_err(dev, "failed to read H2 comp value\n");
-		return ret;
-	}
-	H2 = sign_extend32(le16_to_cpu(tmp), 15);
+	/* Toss the calibration data into the entropy pool */
+	add_device_randomness(t_buf, sizeof(t_buf));
 
-	ret = regmap_read(data->regmap, BMP280_REG_COMP_H3, &H3);
-	if (ret < 0) {
-		dev_err(dev, "failed to read H3 comp value\n");
-		return ret;
-	}
+	calib->T1 = le16_to_cpu(t_buf[T1]);
+	calib->T2 = le16_to_cpu(t_buf[T2]);
+	calib->T3 = le16_to_cpu(t_buf[T3]);
 
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_H4, &tmp, 2);
+	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_PRESS_START,
+			       p_buf, BMP280_COMP_PRESS_REG_COUNT);
 	if (ret < 0) {
-		dev_err(dev, "failed to read H4 comp value\n");
+		dev_err(data->dev,
+			"failed to read pressure calibration parameters\n");
 		return ret;
 	}
-	H4 = sign_extend32(((be16_to_cpu(tmp) >> 4) & 0xff0) |
-			  (be16_to_cpu(tmp) & 0xf), 11);
 
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_H5, &tmp, 2);
+	/* Toss the calibration data into the entropy pool */
+	add_device_randomness(p_buf, sizeof(p_buf));
+
+	calib->P1 = le16_to_cpu(p_buf[P1]);
+	calib->P2 = le16_to_cpu(p_buf[P2]);
+	calib->P3 = le16_to_cpu(p_buf[P3]);
+	calib->P4 = le16_to_cpu(p_buf[P4]);
+	calib->P5 = le16_to_cpu(p_buf[P5]);
+	calib->P6 = le16_to_cpu(p_buf[P6]);
+	calib->P7 = le16_to_cpu(p_buf[P7]);
+	calib->P8 = le16_to_cpu(p_buf[P8]);
+	calib->P9 = le16_to_cpu(p_buf[P9]);
+
+	if (chip != BME280_CHIP_ID)
+		return 0;
+
+	ret = regmap_read(data->regmap, BMP280_REG_COMP_H1, &tmp);
 	if (ret < 0) {
-		dev_err(dev, "failed to read H5 comp value\n");
+		dev_err(data->dev, "failed to read H1 comp value\n");
 		return ret;
 	}
-	H5 = sign_extend32(((le16_to_cpu(tmp) >> 4) & 0xfff), 11);
+	calib->H1 = tmp;
 
-	ret = regmap_read(data->regmap, BMP280_REG_COMP_H6, &tmp);
+	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_H2, h_buf,
+			       BMP280_COMP_H2_H6_REG_COUNT);
 	if (ret < 0) {
-		dev_err(dev, "failed to read H6 comp value\n");
+		dev_err(data->dev, "failed to read H2-H6 comp values\n");
 		return ret;
 	}
-	H6 = sign_extend32(tmp, 7);
+
+	/* H4 and H5 are 12-bit values sharing the nibbles of 0xE5 */
+	calib->H2 = (s16)((h_buf[1] << 8) | h_buf[0]);
+	calib->H3 = h_buf[2];
+	calib->H4 = sign_extend32((h_buf[3] << 4) | (h_buf[4] & 0xf), 11);
+	calib->H5 = sign_extend32((h_buf[5] << 4) | (h_buf[4] >> 4), 11);
+	calib->H6 = (s8)h_buf[6];
+
+	return 0;
+}
+
+/*
+ * Returns humidity in percent, resolution is 0.01 percent. Output value of
+ * "47445" represents 47445/1024 = 46.333 %RH.
+ *
+ * Taken from BME280 datasheet, Section 4.2.3, "Compensation formula".
+ */
+
+static u32 bmp280_compensate_humidity(struct bmp280_data *data,
+				      s32 adc_humidity)
+{
+	struct bmp280_calib *calib = &data->calib.bmp280;
+	s32 var;
 
 	var = ((s32)data->t_fine) - 76800;
-	var = ((((adc_humidity << 14) - (H4 << 20) - (H5 * var)) + 16384) >> 15)
-		* (((((((var * H6) >> 10) * (((var * H3) >> 11) + 32768)) >> 10)
-		+ 2097152) * H2 + 8192) >> 14);
-	var -= ((((var >> 15) * (var >> 15)) >> 7) * H1) >> 4;
+	var = ((((adc_humidity << 14) - (calib->H4 << 20) - (calib->H5 * var))
+		+ 16384) >> 15) * (((((((var * calib->H6) >> 10)
+		* (((var * (s32)calib->H3) >> 11) + 32768)) >> 10)
+		+ 2097152) * calib->H2 + 8192) >> 14);
+	var -= ((((var >> 15) * (var >> 15)) >> 7) * (s32)calib->H1) >> 4;
+	var = clamp_val(var, 0, 419430400);
 
 	return var >> 12;
-};
+}
 
 /*
  * Returns temperature in DegC, resolution is 0.01 DegC.  Output value of
@@ -204,31 +296,18 @@ static u32 bmp280_compensate_humidity(struct bmp280_data *data,
 static s32 bmp280_compensate_temp(struct bmp280_data *data,
 				  s32 adc_temp)
 {
-	int ret;
+	struct bmp280_calib *calib = &data->calib.bmp280;
 	s32 var1, var2;
-	__le16 buf[BMP280_COMP_TEMP_REG_COUNT / 2];
-
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_TEMP_START,
-			       buf, BMP280_COMP_TEMP_REG_COUNT);
-	if (ret < 0) {
-		dev_err(data->dev,
-			"failed to read temperature calibration parameters\n");
-		return ret;
-	}
 
 	/*
-	 * The double casts are necessary because le16_to_cpu returns an
-	 * unsigned 16-bit value.  Casting that value directly to a
-	 * signed 32-bit will not do proper sign extension.
-	 *
-	 * Conversely, T1 and P1 are unsigned values, so they can be
-	 * cast straight to the larger type.
+	 * T1 and P1 are unsigned values, so they can be cast straight to
+	 * the larger type; the others are sign extended.
 	 */
-	var1 = (((adc_temp >> 3) - ((s32)le16_to_cpu(buf[T1]) << 1)) *
-		((s32)(s16)le16_to_cpu(buf[T2]))) >> 11;
-	var2 = (((((adc_temp >> 4) - ((s32)le16_to_cpu(buf[T1]))) *
-		  ((adc_temp >> 4) - ((s32)le16_to_cpu(buf[T1])))) >> 12) *
-		((s32)(s16)le16_to_cpu(buf[T3]))) >> 14;
+	var1 = (((adc_temp >> 3) - ((s32)calib->T1 << 1)) *
+		((s32)calib->T2)) >> 11;
+	var2 = (((((adc_temp >> 4) - ((s32)calib->T1)) *
+		  ((adc_temp >> 4) - ((s32)calib->T1))) >> 12) *
+		((s32)calib->T3)) >> 14;
 	data->t_fine = var1 + var2;
 
 	return (data->t_fine * 5 + 128) >> 8;
@@ -244,89 +323,116 @@ static s32 bmp280_compensate_temp(struct bmp280_data *data,
 static u32 bmp280_compensate_press(struct bmp280_data *data,
 				   s32 adc_press)
 {
-	int ret;
+	struct bmp280_calib *calib = &data->calib.bmp280;
 	s64 var1, var2, p;
-	__le16 buf[BMP280_COMP_PRESS_REG_COUNT / 2];
-
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_COMP_PRESS_START,
-			       buf, BMP280_COMP_PRESS_REG_COUNT);
-	if (ret < 0) {
-		dev_err(data->dev,
-			"failed to read pressure calibration parameters\n");
-		return ret;
-	}
 
 	var1 = ((s64)data->t_fine) - 128000;
-	var2 = var1 * var1 * (s64)(s16)le16_to_cpu(buf[P6]);
-	var2 += (var1 * (s64)(s16)le16_to_cpu(buf[P5])) << 17;
-	var2 += ((s64)(s16)le16_to_cpu(buf[P4])) << 35;
-	var1 = ((var1 * var1 * (s64)(s16)le16_to_cpu(buf[P3])) >> 8) +
-		((var1 * (s64)(s16)le16_to_cpu(buf[P2])) << 12);
-	var1 = ((((s64)1) << 47) + var1) * ((s64)le16_to_cpu(buf[P1])) >> 33;
+	var2 = var1 * var1 * (s64)calib->P6;
+	var2 += (var1 * (s64)calib->P5) << 17;
+	var2 += ((s64)calib->P4) << 35;
+	var1 = ((var1 * var1 * (s64)calib->P3) >> 8) +
+		((var1 * (s64)calib->P2) << 12);
+	var1 = ((((s64)1) << 47) + var1) * ((s64)calib->P1) >> 33;
 
 	if (var1 == 0)
 		return 0;
 
 	p = ((((s64)1048576 - adc_press) << 31) - var2) * 3125;
 	p = div64_s64(p, var1);
-	var1 = (((s64)(s16)le16_to_cpu(buf[P9])) * (p >> 13) * (p >> 13)) >> 25;
-	var2 = (((s64)(s16)le16_to_cpu(buf[P8])) * p) >> 19;
-	p = ((p + var1 + var2) >> 8) + (((s64)(s16)le16_to_cpu(buf[P7])) << 4);
+	var1 = (((s64)calib->P9) * (p >> 13) * (p >> 13)) >> 25;
+	var2 = (((s64)calib->P8) * p) >> 19;
+	p = ((p + var1 + var2) >> 8) + (((s64)calib->P7) << 4);
 
 	return (u32)p;
 }
 
-static int bmp280_read_temp(struct bmp280_data *data,
-			    int *val)
+/* Offset of a result register within the burst starting at PRESS_MSB */
+#define BMP280_DATA_OFF(reg)	((reg) - BMP280_REG_PRESS_MSB)
+
+static s32 bmp280_get_adc20(const u8 *buf)
+{
+	return (buf[0] << 12) | (buf[1] << 4) | (buf[2] >> 4);
+}
+
+/*
+ * Reads the latest pressure, temperature and, if @humid is set, humidity
+ * results in one burst, then compensates them all from the same t_fine.
+ * The chip shadows the result registers for the length of a burst, so the
+ * values always belong to the same conversion. As the chip runs in normal
+ * mode this never waits for a conversion to complete.
+ */
+static int bmp280_measure(struct bmp280_data *data, s32 *temp, u32 *press,
+			  u32 *humid)
 {
 	int ret;
-	__be32 tmp = 0;
-	s32 adc_temp, comp_temp;
+	u8 buf[BME280_DATA_LEN];
+	s32 adc_temp, adc_press, adc_humidity;
 
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_TEMP_MSB,
-			       (u8 *) &tmp, 3);
+	ret = regmap_bulk_read(data->regmap, BMP280_REG_PRESS_MSB, buf,
+			       humid ? BME280_DATA_LEN : BMP280_DATA_LEN);
 	if (ret < 0) {
-		dev_err(data->dev, "failed to read temperature\n");
+		dev_err(data->dev, "failed to read measurement\n");
 		return ret;
 	}
 
-	adc_temp = be32_to_cpu(tmp) >> 12;
-	comp_temp = bmp280_compensate_temp(data, adc_temp);
+	adc_temp = bmp280_get_adc20(buf +
+				    BMP280_DATA_OFF(BMP280_REG_TEMP_MSB));
+	if (adc_temp == BMP280_ADC_SKIPPED) {
+		/* no conversion since power up */
+		dev_err(data->dev, "reading temperature skipped\n");
+		return -EIO;
+	}
+	/* Also sets t_fine for the other channels */
+	*temp = bmp280_compensate_temp(data, adc_temp);
 
-	/*
-	 * val might be NULL if we're called by the read_press routine,
-	 * who only cares about the carry over t_fine value.
-	 */
-	if (val) {
-		*val = comp_temp * 10;
-		return IIO_VAL_INT;
+	adc_press = bmp280_get_adc20(buf +
+				     BMP280_DATA_OFF(BMP280_REG_PRESS_MSB));
+	if (adc_press == BMP280_ADC_SKIPPED) {
+		dev_err(data->dev, "reading pressure skipped\n");
+		return -EIO;
+	}
+	*press = bmp280_compensate_press(data, adc_press);
+
+	if (!humid)
+		return 0;
+
+	adc_humidity = (buf[BMP280_DATA_OFF(BMP280_REG_HUMIDITY_MSB)] << 8) |
+		       buf[BMP280_DATA_OFF(BMP280_REG_HUMIDITY_LSB)];
+	if (adc_humidity == BME280_ADC_HUMIDITY_SKIPPED) {
+		dev_err(data->dev, "reading humidity skipped\n");
+		return -EIO;
 	}
+	*humid = bmp280_compensate_humidity(data, adc_humidity);
 
 	return 0;
 }
 
-static int bmp280_read_press(struct bmp280_data *data,
-			     int *val, int *val2)
+static int bmp280_read_temp(struct bmp280_data *data,
+			    int *val)
 {
 	int ret;
-	__be32 tmp = 0;
-	s32 adc_press;
+	s32 comp_temp;
 	u32 comp_press;
 
-	/* Read and compensate temperature so we get a reading of t_fine. */
-	ret = bmp280_read_temp(data, NULL);
+	ret = bmp280_measure(data, &comp_temp, &comp_press, NULL);
 	if (ret < 0)
 		return ret;
 
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_PRESS_MSB,
-			       (u8 *) &tmp, 3);
-	if (ret < 0) {
-		dev_err(data->dev, "failed to read pressure\n");
-		return ret;
-	}
+	*val = comp_temp * 10;
 
-	adc_press = be32_to_cpu(tmp) >> 12;
-	comp_press = bmp280_compensate_press(data, adc_press);
+	return IIO_VAL_INT;
+}
+
+static int bmp280_read_press(struct bmp280_data *data,
+			     int *val, int *val2)
+{
+	int ret;
+	s32 comp_temp;
+	u32 comp_press;
+
+	ret = bmp280_measure(data, &comp_temp, &comp_press, NULL);
+	if (ret < 0)
+		return ret;
 
 	*val = comp_press;
 	*val2 = 256000;
@@ -337,31 +443,50 @@ static int bmp280_read_press(struct bmp280_data *data,
 static int bmp280_read_humid(struct bmp280_data *data, int *val, int *val2)
 {
 	int ret;
-	__be16 tmp = 0;
-	s32 adc_humidity;
-	u32 comp_humidity;
+	s32 comp_temp;
+	u32 comp_press, comp_humidity;
 
-	/* Read and compensate temperature so we get a reading of t_fine. */
-	ret = bmp280_read_temp(data, NULL);
+	ret = bmp280_measure(data, &comp_temp, &comp_press, &comp_humidity);
 	if (ret < 0)
 		return ret;
 
-	ret = regmap_bulk_read(data->regmap, BMP280_REG_HUMIDITY_MSB,
-			       (u8 *) &tmp, 2);
-	if (ret < 0) {
-		dev_err(data->dev, "failed to read humidity\n");
-		return ret;
-	}
-
-	adc_humidity = be16_to_cpu(tmp);
-	comp_humidity = bmp280_compensate_humidity(data, adc_humidity);
-
 	*val = comp_humidity;
 	*val2 = 1024;
 
 	return IIO_VAL_FRACTIONAL;
 }
 
+static irqreturn_t bmp280_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct bmp280_data *data = iio_priv(indio_dev);
+	bool humid = test_bit(BMP280_SCAN_HUMID, indio_dev->active_scan_mask);
+	u32 vals[BMP280_SCAN_TIMESTAMP];
+	s32 comp_temp;
+	int i, j = 0, ret;
+
+	mutex_lock(&data->lock);
+	ret = bmp280_measure(data, &comp_temp, &vals[BMP280_SCAN_PRESS],
+			     humid ? &vals[BMP280_SCAN_HUMID] : NULL);
+	mutex_unlock(&data->lock);
+	if (ret < 0)
+		goto done;
+
+	vals[BMP280_SCAN_TEMP] = comp_temp;
+
+	for_each_set_bit(i, indio_dev->active_scan_mask,
+			 indio_dev->masklength)
+		if (i != BMP280_SCAN_TIMESTAMP)
+			data->scan[j++] = vals[i];
+
+	iio_push_to_buffers_with_timestamp(indio_dev, data->scan,
+					   pf->timestamp);
+done:
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
 static int bmp280_read_raw(struct iio_dev *indio_dev,
 			   struct iio_chan_spec const *chan,
 			   int *val, int *val2, long mask)
@@ -389,6 +514,28 @@ static int bmp280_read_raw(struct iio_dev *indio_dev,
 			break;
 		}
 		break;
+	case IIO_CHAN_INFO_SCALE:
+		/* Turns buffered values into the processed ones */
+		switch (chan->type) {
+		case IIO_HUMIDITYRELATIVE:
+			*val = 1;
+			*val2 = 1024;
+			ret = IIO_VAL_FRACTIONAL;
+			break;
+		case IIO_PRESSURE:
+			*val = 1;
+			*val2 = 256000;
+			ret = IIO_VAL_FRACTIONAL;
+			break;
+		case IIO_TEMP:
+			*val = 10;
+			ret = IIO_VAL_INT;
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		break;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
 	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
 		switch (chan->type) {
@@ -570,6 +717,38 @@ static const struct iio_info bmp280_info = {
 	.attrs = &bmp280_attrs_group,
 };
 
+static int bmp280_buffer_preenable(struct iio_dev *indio_dev)
+{
+	struct bmp280_data *data = iio_priv(indio_dev);
+	int ret;
+
+	/* Keep the chip powered, and so converting, while capturing */
+	ret = pm_runtime_get_sync(data->dev);
+	if (ret < 0) {
+		pm_runtime_put_noidle(data->dev);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int bmp280_buffer_postdisable(struct iio_dev *indio_dev)
+{
+	struct bmp280_data *data = iio_priv(indio_dev);
+
+	pm_runtime_mark_last_busy(data->dev);
+	pm_runtime_put_autosuspend(data->dev);
+
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops bmp280_buffer_setup_ops = {
+	.preenable = bmp280_buffer_preenable,
+	.postenable = iio_triggered_buffer_postenable,
+	.predisable = iio_triggered_buffer_predisable,
+	.postdisable = bmp280_buffer_postdisable,
+};
+
 static int bmp280_chip_config(struct bmp280_data *data)
 {
 	int ret;
@@ -611,6 +790,7 @@ static const struct bmp280_chip_info bmp280_chip_info = {
 	.chip_config = bmp280_chip_config,
 	.read_temp = bmp280_read_temp,
 	.read_press = bmp280_read_press,
+	.trigger_handler = bmp280_trigger_handler,
 };
 
 static int bme280_chip_config(struct bmp280_data *data)
@@ -639,6 +819,7 @@ static const struct bmp280_chip_info bme280_chip_info = {
 	.read_temp = bmp280_read_temp,
 	.read_press = bmp280_read_press,
 	.read_humid = bmp280_read_humid,
+	.trigger_handler = bmp280_trigger_handler,
 };
 
 static int bmp180_measure(struct bmp280_data *data, u8 ctrl_meas)
@@ -750,7 +931,7 @@ static int bmp180_read_calib(struct bmp280_data *data,
 static s32 bmp180_compensate_temp(struct bmp280_data *data, s32 adc_temp)
 {
 	s32 x1, x2;
-	struct bmp180_calib *calib = &data->calib;
+	struct bmp180_calib *calib = &data->calib.bmp180;
 
 	x1 = ((adc_temp - calib->AC6) * calib->AC5) >> 15;
 	x2 = (calib->MC << 11) / (x1 + calib->MD);
@@ -812,7 +993,7 @@ static u32 bmp180_compensate_press(struct bmp280_data *data, s32 adc_press)
 	s32 b3, b6;
 	u32 b4, b7;
 	s32 oss = data->oversampling_press;
-	struct bmp180_calib *calib = &data->calib;
+	struct bmp180_calib *calib = &data->calib.bmp180;
 
 	b6 = data->t_fine - 4000;
 	x1 = (calib->B2 * (b6 * b6 >> 12)) >> 11;
@@ -944,27 +1125,29 @@ int bmp280_common_probe(struct device *dev,
 
 	indio_dev->dev.parent = dev;
 	indio_dev->name = name;
-	indio_dev->channels = bmp280_channels;
 	indio_dev->info = &bmp280_info;
 	indio_dev->modes = INDIO_DIRECT_MODE;
 
 	switch (chip) {
 	case BMP180_CHIP_ID:
-		indio_dev->num_channels = 2;
+		indio_dev->channels = bmp180_channels;
+		indio_dev->num_channels = ARRAY_SIZE(bmp180_channels);
 		data->chip_info = &bmp180_chip_info;
 		data->oversampling_press = ilog2(8);
 		data->oversampling_temp = ilog2(1);
 		data->start_up_time = 10;
 		break;
 	case BMP280_CHIP_ID:
-		indio_dev->num_channels = 2;
+		indio_dev->channels = bmp280_channels;
+		indio_dev->num_channels = ARRAY_SIZE(bmp280_channels);
 		data->chip_info = &bmp280_chip_info;
 		data->oversampling_press = ilog2(16);
 		data->oversampling_temp = ilog2(2);
 		data->start_up_time = 2;
 		break;
 	case BME280_CHIP_ID:
-		indio_dev->num_channels = 3;
+		indio_dev->channels = bme280_channels;
+		indio_dev->num_channels = ARRAY_SIZE(bme280_channels);
 		data->chip_info = &bme280_chip_info;
 		data->oversampling_press = ilog2(16);
 		data->oversampling_humid = ilog2(16);
@@ -1040,7 +1223,14 @@ int bmp280_common_probe(struct device *dev,
 	 * at probe time. It will not change.
 	 */
 	if (chip_id  == BMP180_CHIP_ID) {
-		ret = bmp180_read_calib(data, &data->calib);
+		ret = bmp180_read_calib(data, &data->calib.bmp180);
+		if (ret < 0) {
+			dev_err(data->dev,
+				"failed to read calibration coefficients\n");
+			goto out_disable_vdda;
+		}
+	} else {
+		ret = bmp280_read_calib(data, &data->calib.bmp280, chip_id);
 		if (ret < 0) {
 			dev_err(data->dev,
 				"failed to read calibration coefficients\n");
@@ -1059,6 +1249,17 @@ int bmp280_common_probe(struct device *dev,
 			goto out_disable_vdda;
 	}
 
+	if (data->chip_info->trigger_handler) {
+		ret = iio_triggered_buffer_setup(indio_dev,
+						 iio_pollfunc_store_time,
+						 data->chip_info->trigger_handler,
+						 &bmp280_buffer_setup_ops);
+		if (ret < 0) {
+			dev_err(dev, "iio triggered buffer setup failed\n");
+			goto out_disable_vdda;
+		}
+	}
+
 	/* Enable runtime PM */
 	pm_runtime_get_noresume(dev);
 	pm_runtime_set_active(dev);
@@ -1082,6 +1283,8 @@ out_runtime_pm_disable:
 	pm_runtime_get_sync(data->dev);
 	pm_runtime_put_noidle(data->dev);
 	pm_runtime_disable(data->dev);
+	if (data->chip_info->trigger_handler)
+		iio_triggered_buffer_cleanup(indio_dev);
 out_disable_vdda:
 	regulator_disable(data->vdda);
 out_disable_vddd:
@@ -1096,6 +1299,8 @@ int bmp280_common_remove(struct device *dev)
 	struct bmp280_data *data = iio_priv(indio_dev);
 
 	iio_device_unregister(indio_dev);
+	if (data->chip_info->trigger_handler)
+		iio_triggered_buffer_cleanup(indio_dev);
 	pm_runtime_get_sync(data->dev);
 	pm_runtime_put_noidle(data->dev);
 	pm_runtime_disable(data->dev);
@@ -12,18 +12,28 @@
 #define BMP280_REG_PRESS_LSB		0xF8
 #define BMP280_REG_PRESS_MSB		0xF7
 
+/* Result burst from PRESS_MSB, the BME280 adds humidity */
+#define BMP280_DATA_LEN			6
+#define BME280_DATA_LEN			8
+#define BMP280_ADC_SKIPPED		0x80000
+#define BME280_ADC_HUMIDITY_SKIPPED	0x8000
+
 #define BMP280_REG_CONFIG		0xF5
 #define BMP280_REG_CTRL_MEAS		0xF4
 #define BMP280_REG_STATUS		0xF3
 #define BMP280_REG_CTRL_HUMIDITY	0xF2
 
-/* Due to non linear mapping, and data sizes we can't do a bulk read */
+/*
+ * Due to non linear mapping, and data sizes we can't do a bulk read of
+ * the values; H2 to H6 are read as bytes and unpacked.
+ */
 #define BMP280_REG_COMP_H1		0xA1
 #define BMP280_REG_COMP_H2		0xE1
 #define BMP280_REG_COMP_H3		0xE3
 #define BMP280_REG_COMP_H4		0xE4
 #define BMP280_REG_COMP_H5		0xE5
 #define BMP280_REG_COMP_H6		0xE7
+#define BMP280_COMP_H2_H6_REG_COUNT	7
 
 #define BMP280_REG_COMP_TEMP_START	0x88
 #define BMP280_COMP_TEMP_REG_COUNT	6
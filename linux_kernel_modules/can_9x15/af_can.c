@@ -74,9 +74,9 @@ MODULE_AUTHOR("Urs Thuermann <urs.thuermann@volkswagen.de>, "
 
 MODULE_ALIAS_NETPROTO(PF_CAN);
 
-static int stats_timer __read_mostly = 1;
-module_param(stats_timer, int, S_IRUGO);
-MODULE_PARM_DESC(stats_timer, "enable timer for statistics (default:on)");
+int can_stats_rates __read_mostly = 1;
+module_param_named(stats_timer, can_stats_rates, int, S_IRUGO);
+MODULE_PARM_DESC(stats_timer, "show rate statistics (default:on)");
 
 /* receive filters subscribed for 'all' CAN devices */
 struct dev_rcv_lists can_rx_alldev_list;
@@ -84,12 +84,14 @@ static DEFINE_SPINLOCK(can_rcvlists_lock);
 
 static struct kmem_cache *rcv_cache __read_mostly;
 
+/* listeners for receive filter changes, see can_rx_get_filters() */
+static ATOMIC_NOTIFIER_HEAD(can_rx_filter_chain);
+
 /* table of registered CAN protocols */
 static const struct can_proto *proto_tab[CAN_NPROTO] __read_mostly;
 static DEFINE_MUTEX(proto_tab_lock);
 
-struct timer_list can_stattimer;   /* timer for statistics update */
-struct s_stats    can_stats;       /* packet statistics */
+DEFINE_PER_CPU(struct s_pcpu_stats, can_pcpu_stats); /* packet counters */
 struct s_pstats   can_pstats;      /* receive list statistics */
 
 /*
@@ -314,8 +316,7 @@ int can_send(struct sk_buff *skb, int loop)
 		netif_rx_ni(newskb);
 
 	/* update statistics */
-	can_stats.tx_frames++;
-	can_stats.tx_frames_delta++;
+	this_cpu_inc(can_pcpu_stats.tx_frames);
 
 	return 0;
 
@@ -329,6 +330,24 @@ EXPORT_SYMBOL(can_send);
  * af_can rx path
  */
 
+/*
+ * effhash - fold a 29 bit CAN identifier into CAN_EFF_RCV_HASH_BITS
+ *
+ * Identifiers on J1939 and CANopen buses differ in the low bits (source
+ * address, node id) as much as in the high ones (priority, PGN), so all
+ * of them are folded in.
+ */
+static unsigned int effhash(canid_t can_id)
+{
+	unsigned int hash;
+
+	hash = can_id;
+	hash ^= can_id >> CAN_EFF_RCV_HASH_BITS;
+	hash ^= can_id >> (2 * CAN_EFF_RCV_HASH_BITS);
+
+	return hash & (CAN_EFF_RCV_ARRAY_SZ - 1);
+}
+
 static struct dev_rcv_lists *find_dev_rcv_lists(struct net_device *dev)
 {
 	if (!dev)
@@ -400,10 +419,8 @@ static struct hlist_head *find_rcv_list(canid_t *can_id, canid_t *mask,
 	    !(*can_id & CAN_RTR_FLAG)) {
 
 		if (*can_id & CAN_EFF_FLAG) {
-			if (*mask == (CAN_EFF_MASK | CAN_EFF_RTR_FLAGS)) {
-				/* RFC: a future use-case for hash-tables? */
-				return &d->rx[RX_EFF];
-			}
+			if (*mask == (CAN_EFF_MASK | CAN_EFF_RTR_FLAGS))
+				return &d->rx_eff[effhash(*can_id)];
 		} else {
 			if (*mask == (CAN_SFF_MASK | CAN_EFF_RTR_FLAGS))
 				return &d->rx_sff[*can_id];
@@ -414,6 +431,119 @@ static struct hlist_head *find_rcv_list(canid_t *can_id, canid_t *mask,
 	return &d->rx[RX_FIL];
 }
 
+/*
+ * can_rx_filter_changed - tell filter offloading drivers to look again
+ * @dev: device whose filters changed (NULL => all CAN devices)
+ */
+static void can_rx_filter_changed(struct net_device *dev)
+{
+	atomic_notifier_call_chain(&can_rx_filter_chain, 0, dev);
+}
+
+/**
+ * can_rx_filter_notifier_register - get told about receive filter changes
+ * @nb: notifier block, called with the net_device whose filters changed or
+ *      NULL when the filters for all CAN devices changed
+ *
+ * Description:
+ *  Meant for CAN controllers with hardware acceptance filters. The notifier
+ *  runs in atomic context, the driver is expected to defer the work and
+ *  pick up the filters with can_rx_get_filters().
+ */
+int can_rx_filter_notifier_register(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&can_rx_filter_chain, nb);
+}
+EXPORT_SYMBOL(can_rx_filter_notifier_register);
+
+int can_rx_filter_notifier_unregister(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&can_rx_filter_chain, nb);
+}
+EXPORT_SYMBOL(can_rx_filter_notifier_unregister);
+
+/**
+ * can_rx_get_filters - collect the receive filters applying to a device
+ * @dev: pointer to netdevice
+ * @f: array to fill with can_id/mask pairs
+ * @max: number of entries in @f
+ *
+ * Description:
+ *  Returns the filters registered for @dev and for all CAN devices, as
+ *  reduced by find_rcv_list(). Frames matching none of them are not
+ *  delivered to any receiver, so a controller may drop them in hardware.
+ *  Inverted and unfiltered subscriptions come back as a single filter with
+ *  a zero mask. Error frame subscriptions are left out, error frames are
+ *  generated by the driver.
+ *
+ * Return:
+ *  number of filters in @f
+ *  -E2BIG if there are more than @max filters
+ */
+int can_rx_get_filters(struct net_device *dev, struct can_filter *f, int max)
+{
+	struct dev_rcv_lists *lists[2];
+	struct dev_rcv_lists *d;
+	struct receiver *r;
+	int i, j, n = 0;
+
+	spin_lock(&can_rcvlists_lock);
+
+	lists[0] = &can_rx_alldev_list;
+	lists[1] = find_dev_rcv_lists(dev);
+
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		d = lists[i];
+		if (!d || !d->entries)
+			continue;
+
+		if (!hlist_empty(&d->rx[RX_ALL]) ||
+		    !hlist_empty(&d->rx[RX_INV])) {
+			f[0].can_id = 0;
+			f[0].can_mask = 0;
+			n = 1;
+			goto out;
+		}
+
+		hlist_for_each_entry(r, &d->rx[RX_FIL], list) {
+			if (n == max)
+				goto overflow;
+			f[n].can_id = r->can_id;
+			f[n++].can_mask = r->mask;
+		}
+
+		for (j = 0; j < ARRAY_SIZE(d->rx_eff); j++) {
+			hlist_for_each_entry(r, &d->rx_eff[j], list) {
+				if (n == max)
+					goto overflow;
+				f[n].can_id = r->can_id;
+				f[n++].can_mask = r->mask;
+			}
+		}
+
+		/* all entries of a single-id list carry the same filter */
+		for (j = 0; j < ARRAY_SIZE(d->rx_sff); j++) {
+			if (hlist_empty(&d->rx_sff[j]))
+				continue;
+			if (n == max)
+				goto overflow;
+			r = hlist_entry(d->rx_sff[j].first, struct receiver,
+					list);
+			f[n].can_id = r->can_id;
+			f[n++].can_mask = r->mask;
+		}
+	}
+
+ out:
+	spin_unlock(&can_rcvlists_lock);
+	return n;
+
+ overflow:
+	spin_unlock(&can_rcvlists_lock);
+	return -E2BIG;
+}
+EXPORT_SYMBOL(can_rx_get_filters);
+
 /**
  * can_rx_register - subscribe CAN frames from a specific interface
  * @dev: pointer to netdevice (NULL => subcribe from 'all' CAN devices list)
@@ -461,6 +591,12 @@ int can_rx_register(struct net_device *dev, canid_t can_id, canid_t mask,
 	if (!r)
 		return -ENOMEM;
 
+	r->matches = alloc_percpu(unsigned long);
+	if (!r->matches) {
+		kmem_cache_free(rcv_cache, r);
+		return -ENOMEM;
+	}
+
 	spin_lock(&can_rcvlists_lock);
 
 	d = find_dev_rcv_lists(dev);
@@ -469,7 +605,6 @@ int can_rx_register(struct net_device *dev, canid_t can_id, canid_t mask,
 
 		r->can_id  = can_id;
 		r->mask    = mask;
-		r->matches = 0;
 		r->func    = func;
 		r->data    = data;
 		r->ident   = ident;
@@ -481,12 +616,16 @@ int can_rx_register(struct net_device *dev, canid_t can_id, canid_t mask,
 		if (can_pstats.rcv_entries_max < can_pstats.rcv_entries)
 			can_pstats.rcv_entries_max = can_pstats.rcv_entries;
 	} else {
+		free_percpu(r->matches);
 		kmem_cache_free(rcv_cache, r);
 		err = -ENODEV;
 	}
 
 	spin_unlock(&can_rcvlists_lock);
 
+	if (!err)
+		can_rx_filter_changed(dev);
+
 	return err;
 }
 EXPORT_SYMBOL(can_rx_register);
@@ -498,6 +637,7 @@ static void can_rx_delete_receiver(struct rcu_head *rp)
 {
 	struct receiver *r = container_of(rp, struct receiver, rcu);
 
+	free_percpu(r->matches);
 	kmem_cache_free(rcv_cache, r);
 }
 
@@ -565,23 +705,37 @@ void can_rx_unregister(struct net_device *dev, canid_t can_id, canid_t mask,
 
 	/* remove device structure requested by NETDEV_UNREGISTER */
 	if (d->remove_on_zero_entries && !d->entries) {
-		kfree(d);
 		dev->ml_priv = NULL;
+		kfree_rcu(d, rcu);
 	}
 
  out:
 	spin_unlock(&can_rcvlists_lock);
 
 	/* schedule the receiver item for deletion */
-	if (r)
+	if (r) {
 		call_rcu(&r->rcu, can_rx_delete_receiver);
+		can_rx_filter_changed(dev);
+	}
 }
 EXPORT_SYMBOL(can_rx_unregister);
 
 static inline void deliver(struct sk_buff *skb, struct receiver *r)
 {
 	r->func(skb, r->data);
-	r->matches++;
+	this_cpu_inc(*r->matches);
+}
+
+/* matches of a receiver over all CPUs, for proc.c */
+unsigned long can_rcv_matches(struct receiver *r)
+{
+	unsigned long matches = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		matches += *per_cpu_ptr(r->matches, cpu);
+
+	return matches;
 }
 
 static int can_rcv_filter(struct dev_rcv_lists *d, struct sk_buff *skb)
@@ -632,7 +786,7 @@ static int can_rcv_filter(struct dev_rcv_lists *d, struct sk_buff *skb)
 		return matches;
 
 	if (can_id & CAN_EFF_FLAG) {
-		hlist_for_each_entry_rcu(r, &d->rx[RX_EFF], list) {
+		hlist_for_each_entry_rcu(r, &d->rx_eff[effhash(can_id)], list) {
 			if (r->can_id == can_id) {
 				deliver(skb, r);
 				matches++;
@@ -655,8 +809,7 @@ static void can_receive(struct sk_buff *skb, struct net_device *dev)
 	int matches;
 
 	/* update statistics */
-	can_stats.rx_frames++;
-	can_stats.rx_frames_delta++;
+	this_cpu_inc(can_pcpu_stats.rx_frames);
 
 	rcu_read_lock();
 
@@ -673,10 +826,8 @@ static void can_receive(struct sk_buff *skb, struct net_device *dev)
 	/* consume the skbuff allocated by the netdevice driver */
 	consume_skb(skb);
 
-	if (matches > 0) {
-		can_stats.matches++;
-		can_stats.matches_delta++;
-	}
+	if (matches > 0)
+		this_cpu_inc(can_pcpu_stats.matches);
 }
 
 static int can_rcv(struct sk_buff *skb, struct net_device *dev,
@@ -827,8 +978,8 @@ static int can_notifier(struct notifier_block *nb, unsigned long msg,
 			if (d->entries)
 				d->remove_on_zero_entries = 1;
 			else {
-				kfree(d);
 				dev->ml_priv = NULL;
+				kfree_rcu(d, rcu);
 			}
 		} else
 			pr_err("can: notifier: receive list not found for dev "
@@ -884,13 +1035,6 @@ static __init int can_init(void)
 	if (!rcv_cache)
 		return -ENOMEM;
 
-	if (stats_timer) {
-		/* the statistics are updated every second (timer triggered) */
-		setup_timer(&can_stattimer, can_stat_update, 0);
-		mod_timer(&can_stattimer, round_jiffies(jiffies + HZ));
-	} else
-		can_stattimer.function = NULL;
-
 	can_init_proc();
 
 	/* protocol register */
@@ -906,9 +1050,6 @@ static __exit void can_exit(void)
 {
 	struct net_device *dev;
 
-	if (stats_timer)
-		del_timer_sync(&can_stattimer);
-
 	can_remove_proc();
 
 	/* protocol unregister */
@@ -44,6 +44,7 @@
 #include <linux/netdevice.h>
 #include <linux/list.h>
 #include <linux/rcupdate.h>
+#include <linux/percpu.h>
 #include <linux/can.h>
 
 /* af_can rx dispatcher structures */
@@ -53,27 +54,53 @@ struct receiver {
 	struct rcu_head rcu;
 	canid_t can_id;
 	canid_t mask;
-	unsigned long matches;
+	unsigned long __percpu *matches;
 	void (*func)(struct sk_buff *, void *);
 	void *data;
 	char *ident;
 };
 
-enum { RX_ERR, RX_ALL, RX_FIL, RX_INV, RX_EFF, RX_MAX };
+/* single non-RTR can_id subscriptions: SFF direct-indexed, EFF hashed */
+#define CAN_SFF_RCV_ARRAY_SZ	0x800
+#define CAN_EFF_RCV_HASH_BITS	10
+#define CAN_EFF_RCV_ARRAY_SZ	(1 << CAN_EFF_RCV_HASH_BITS)
+
+enum { RX_ERR, RX_ALL, RX_FIL, RX_INV, RX_MAX };
 
-/* per device receive filters linked at dev->ml_priv */
+/*
+ * per device receive filters linked at dev->ml_priv, freed after a grace
+ * period (rcu first, kfree_rcu() wants it within the first 4k)
+ */
 struct dev_rcv_lists {
+	struct rcu_head rcu;
 	struct hlist_head rx[RX_MAX];
-	struct hlist_head rx_sff[0x800];
+	struct hlist_head rx_sff[CAN_SFF_RCV_ARRAY_SZ];
+	struct hlist_head rx_eff[CAN_EFF_RCV_ARRAY_SZ];
 	int remove_on_zero_entries;
 	int entries;
 };
 
 /* statistic structures */
 
-/* can be reset e.g. by can_init_stats() */
+/* packet counters, per CPU so the rx/tx paths share no cache line */
+struct s_pcpu_stats {
+	unsigned long rx_frames;
+	unsigned long tx_frames;
+	unsigned long matches;
+};
+
+/*
+ * Folded from the per CPU counters when read, see can_stat_update().
+ * Can be reset e.g. by can_init_stats().
+ */
 struct s_stats {
 	unsigned long jiffies_init;
+	unsigned long jiffies_last;	/* previous can_stat_update() */
+
+	/* folded counters at the last reset */
+	unsigned long rx_frames_base;
+	unsigned long tx_frames_base;
+	unsigned long matches_base;
 
 	unsigned long rx_frames;
 	unsigned long tx_frames;
@@ -91,9 +118,10 @@ struct s_stats {
 	unsigned long max_tx_rate;
 	unsigned long max_rx_match_ratio;
 
-	unsigned long rx_frames_delta;
-	unsigned long tx_frames_delta;
-	unsigned long matches_delta;
+	/* counters at jiffies_last, for the 'current' values */
+	unsigned long rx_frames_last;
+	unsigned long tx_frames_last;
+	unsigned long matches_last;
 };
 
 /* persistent statistics */
@@ -107,14 +135,19 @@ struct s_pstats {
 /* receive filters subscribed for 'all' CAN devices */
 extern struct dev_rcv_lists can_rx_alldev_list;
 
+/* receive filters for controllers with hardware acceptance filters */
+int can_rx_filter_notifier_register(struct notifier_block *nb);
+int can_rx_filter_notifier_unregister(struct notifier_block *nb);
+int can_rx_get_filters(struct net_device *dev, struct can_filter *f, int max);
+
 /* function prototypes for the CAN networklayer procfs (proc.c) */
 void can_init_proc(void);
 void can_remove_proc(void);
-void can_stat_update(unsigned long data);
+unsigned long can_rcv_matches(struct receiver *r);
 
 /* structures and variables from af_can.c needed in proc.c for reading */
-extern struct timer_list can_stattimer;    /* timer for statistics update */
-extern struct s_stats    can_stats;        /* packet statistics */
+DECLARE_PER_CPU(struct s_pcpu_stats, can_pcpu_stats); /* packet counters */
+extern int               can_stats_rates;  /* rates shown in proc */
 extern struct s_pstats   can_pstats;       /* receive list statistics */
 extern struct hlist_head can_rx_dev_list;  /* rx dispatcher structures */
 
@@ -77,6 +77,8 @@
 #include <linux/uaccess.h>
 #include <linux/regulator/consumer.h>
 
+#include "af_can.h"
+
 /* SPI interface instruction set */
 #define INSTRUCTION_WRITE	0x02
 #define INSTRUCTION_READ	0x03
@@ -148,6 +150,7 @@
 #  define TXBCTRL_MLOA	0x20
 #  define TXBCTRL_TXERR 0x10
 #  define TXBCTRL_TXREQ 0x08
+#  define TXBCTRL_TXP_MASK 0x03
 #define TXBSIDH(n)  (((n) * 0x10) + 0x30 + TXBSIDH_OFF)
 #  define SIDH_SHIFT    3
 #define TXBSIDL(n)  (((n) * 0x10) + 0x30 + TXBSIDL_OFF)
@@ -190,10 +193,12 @@
 #define RXBEID0_OFF 4
 #define RXBDLC_OFF  5
 #define RXBDAT_OFF  6
-#define RXFSIDH(n) ((n) * 4)
-#define RXFSIDL(n) ((n) * 4 + 1)
-#define RXFEID8(n) ((n) * 4 + 2)
-#define RXFEID0(n) ((n) * 4 + 3)
+/* RXF0-2 sit at 0x00, RXF3-5 at 0x10 */
+#define RXF_BASE(n) ((n) * 4 + ((n) < 3 ? 0 : 4))
+#define RXFSIDH(n) (RXF_BASE(n))
+#define RXFSIDL(n) (RXF_BASE(n) + 1)
+#define RXFEID8(n) (RXF_BASE(n) + 2)
+#define RXFEID0(n) (RXF_BASE(n) + 3)
 #define RXMSIDH(n) ((n) * 4 + 0x20)
 #define RXMSIDL(n) ((n) * 4 + 0x21)
 #define RXMEID8(n) ((n) * 4 + 0x22)
@@ -212,7 +217,27 @@
 #define SPI_TRANSFER_BUF_LEN	(6 + CAN_FRAME_MAX_DATA_LEN)
 #define CAN_FRAME_MAX_BITS	128
 
-#define TX_ECHO_SKB_MAX	1
+/*
+ * Layout of the SPI buffers for one pass of the interrupt loop, see
+ * mcp251x_ist_batch()
+ */
+#define SPI_BATCH_RXB(n)	((n) * SPI_TRANSFER_BUF_LEN)
+#define SPI_BATCH_INTF		(2 * SPI_TRANSFER_BUF_LEN)
+#define SPI_BATCH_EFLG		(SPI_BATCH_INTF + 4)
+#define SPI_BATCH_STAT		(SPI_BATCH_EFLG + 4)
+#define SPI_BATCH_BUF_LEN	(SPI_BATCH_STAT + 4)
+#define SPI_BATCH_XFERS		5
+
+#define MCP251X_TX_BUFS	3
+#define TX_ECHO_SKB_MAX	MCP251X_TX_BUFS
+/* Transmit priority levels (TXP) times buffers, see mcp251x_tx_slot() */
+#define MCP251X_TX_KEYS	(4 * MCP251X_TX_BUFS)
+
+/* Acceptance filters: RXM0 with RXF0-1 for RXB0, RXM1 with RXF2-5 for RXB1 */
+#define MCP251X_RX_FILTERS	6
+#define MCP251X_RX_FILTER_GROUP(n)	((n) < 2 ? 0 : 1)
+/* Most receive filters examined, more and everything is let through */
+#define MCP251X_RX_FILTER_SCAN	256
 
 #define DEVICE_NAME "mcp251x"
 
@@ -220,6 +245,21 @@ static int mcp251x_enable_dma; /* Enable SPI DMA. Default: 0 (Off) */
 module_param(mcp251x_enable_dma, int, S_IRUGO);
 MODULE_PARM_DESC(mcp251x_enable_dma, "Enable SPI DMA. Default: 0 (Off)");
 
+static int mcp251x_tx_bufs = MCP251X_TX_BUFS;
+module_param(mcp251x_tx_bufs, int, S_IRUGO);
+MODULE_PARM_DESC(mcp251x_tx_bufs,
+		 "Transmit buffers used, 1 to 3. Default: 3");
+
+static int mcp251x_tx_ordered = 1;
+module_param(mcp251x_tx_ordered, int, S_IRUGO);
+MODULE_PARM_DESC(mcp251x_tx_ordered,
+		 "Keep frames in queue order across transmit buffers. Default: 1 (On)");
+
+static int mcp251x_rx_filter; /* Offload receive filters. Default: 0 (Off) */
+module_param(mcp251x_rx_filter, int, S_IRUGO);
+MODULE_PARM_DESC(mcp251x_rx_filter,
+		 "Program the acceptance filters from the CAN receive filters. Default: 0 (Off)");
+
 static const struct can_bittiming_const mcp251x_bittiming_const = {
 	.name = DEVICE_NAME,
 	.tseg1_min = 3,
@@ -232,6 +272,17 @@ static const struct can_bittiming_const mcp251x_bittiming_const = {
 	.brp_inc = 1,
 };
 
+/*
+ * Acceptance filter setup, a superset of the registered receive filters.
+ * Each mask group matches either standard or extended frames.
+ */
+struct mcp251x_acc_filter {
+	int on;
+	int eff[2];
+	u32 mask[2];
+	u32 id[MCP251X_RX_FILTERS];
+};
+
 enum mcp251x_model {
 	CAN_MCP251X_MCP2510	= 0x2510,
 	CAN_MCP251X_MCP2515	= 0x2515,
@@ -251,12 +302,21 @@ struct mcp251x_priv {
 	dma_addr_t spi_rx_dma;
 
 	struct sk_buff *tx_skb;
-	int tx_len;
+	int tx_bufs;
+	u8 tx_busy;	/* transmit buffers in flight */
+	u8 tx_key[MCP251X_TX_BUFS];
+	u8 tx_txp[MCP251X_TX_BUFS]; /* TXP last written to TXBCTRL */
+	int tx_len[MCP251X_TX_BUFS];
 
 	struct workqueue_struct *wq;
 	struct work_struct tx_work;
 	struct work_struct restart_work;
 
+	struct mcp251x_acc_filter rx_filter;
+	int rx_filter_pending;
+	struct notifier_block rx_filter_nb;
+	struct work_struct rx_filter_work;
+
 	int force_quit;
 	int after_suspend;
 #define AFTER_SUSPEND_UP 1
@@ -282,15 +342,56 @@ MCP251X_IS(2515);
 static void mcp251x_clean(struct net_device *net)
 {
 	struct mcp251x_priv *priv = netdev_priv(net);
+	int i;
 
-	if (priv->tx_skb || priv->tx_len)
+	if (priv->tx_skb || priv->tx_busy)
 		net->stats.tx_errors++;
 	if (priv->tx_skb)
 		dev_kfree_skb(priv->tx_skb);
-	if (priv->tx_len)
-		can_free_echo_skb(priv->net, 0);
+	for (i = 0; i < MCP251X_TX_BUFS; i++) {
+		if (priv->tx_busy & BIT(i))
+			can_free_echo_skb(priv->net, i);
+		priv->tx_len[i] = 0;
+	}
 	priv->tx_skb = NULL;
-	priv->tx_len = 0;
+	priv->tx_busy = 0;
+}
+
+/*
+ * Pick a free transmit buffer for the next frame and the TXP to send it
+ * with. The controller sends pending buffers by descending TXP, then by
+ * descending buffer number. In ordered mode a frame is given a (TXP,
+ * buffer) key below that of every frame still in flight, so the bus sees
+ * frames in queue order; once the lowest key is taken the pipeline has to
+ * drain first. Returns the buffer index or -1 if the frame has to wait.
+ */
+static int mcp251x_tx_slot(struct mcp251x_priv *priv, u8 *txp)
+{
+	int i, key, min_key = MCP251X_TX_KEYS;
+
+	if (!mcp251x_tx_ordered) {
+		for (i = priv->tx_bufs - 1; i >= 0; i--) {
+			if (!(priv->tx_busy & BIT(i))) {
+				*txp = 0;
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	for (i = 0; i < priv->tx_bufs; i++)
+		if ((priv->tx_busy & BIT(i)) && priv->tx_key[i] < min_key)
+			min_key = priv->tx_key[i];
+
+	for (key = min_key - 1; key >= 0; key--) {
+		i = key % MCP251X_TX_BUFS;
+		if (i < priv->tx_bufs && !(priv->tx_busy & BIT(i))) {
+			*txp = key / MCP251X_TX_BUFS;
+			return i;
+		}
+	}
+
+	return -1;
 }
 
 /*
@@ -334,6 +435,22 @@ static int mcp251x_spi_trans(struct spi_device *spi, int len)
 	return ret;
 }
 
+/* Queue an instruction at @off of the SPI buffers in its own CS cycle */
+static void mcp251x_batch_add(struct mcp251x_priv *priv,
+			      struct spi_message *m, struct spi_transfer *t,
+			      int off, int len)
+{
+	t->tx_buf = priv->spi_tx_buf + off;
+	t->rx_buf = priv->spi_rx_buf + off;
+	t->len = len;
+	t->cs_change = 1;
+	if (mcp251x_enable_dma) {
+		t->tx_dma = priv->spi_tx_dma + off;
+		t->rx_dma = priv->spi_rx_dma + off;
+	}
+	spi_message_add_tail(t, m);
+}
+
 static u8 mcp251x_read_reg(struct spi_device *spi, uint8_t reg)
 {
 	struct mcp251x_priv *priv = spi_get_drvdata(spi);
@@ -386,6 +503,33 @@ static void mcp251x_write_bits(struct spi_device *spi, u8 reg,
 	mcp251x_spi_trans(spi, 4);
 }
 
+/* Write an id or mask to RXFn/RXMn, laid out like the TX buffer header */
+static void mcp251x_write_id(struct spi_device *spi, u8 reg, u32 id,
+			     int eff, int exide)
+{
+	struct mcp251x_priv *priv = spi_get_drvdata(spi);
+	u32 sid = eff ? id >> 18 : id;
+	u8 buf[4];
+	int i;
+
+	buf[0] = sid >> SIDH_SHIFT;
+	buf[1] = ((sid & SIDL_SID_MASK) << SIDL_SID_SHIFT) |
+		(exide << SIDL_EXIDE_SHIFT) |
+		(eff ? (id >> SIDL_EID_SHIFT) & SIDL_EID_MASK : 0);
+	buf[2] = eff ? GET_BYTE(id, 1) : 0;
+	buf[3] = eff ? GET_BYTE(id, 0) : 0;
+
+	if (mcp251x_is_2510(spi)) {
+		for (i = 0; i < 4; i++)
+			mcp251x_write_reg(spi, reg + i, buf[i]);
+	} else {
+		priv->spi_tx_buf[0] = INSTRUCTION_WRITE;
+		priv->spi_tx_buf[1] = reg;
+		memcpy(priv->spi_tx_buf + 2, buf, 4);
+		mcp251x_spi_trans(spi, 6);
+	}
+}
+
 static void mcp251x_hw_tx_frame(struct spi_device *spi, u8 *buf,
 				int len, int tx_buf_idx)
 {
@@ -404,12 +548,19 @@ static void mcp251x_hw_tx_frame(struct spi_device *spi, u8 *buf,
 }
 
 static void mcp251x_hw_tx(struct spi_device *spi, struct can_frame *frame,
-			  int tx_buf_idx)
+			  int tx_buf_idx, u8 txp)
 {
 	struct mcp251x_priv *priv = spi_get_drvdata(spi);
 	u32 sid, eid, exide, rtr;
 	u8 buf[SPI_TRANSFER_BUF_LEN];
 
+	/* LOAD_TXB starts at TXBSIDH, the priority is written on its own */
+	if (priv->tx_txp[tx_buf_idx] != txp) {
+		mcp251x_write_reg(spi, TXBCTRL(tx_buf_idx),
+				  txp & TXBCTRL_TXP_MASK);
+		priv->tx_txp[tx_buf_idx] = txp;
+	}
+
 	exide = (frame->can_id & CAN_EFF_FLAG) ? 1 : 0; /* Extended ID Enable */
 	if (exide)
 		sid = (frame->can_id & CAN_EFF_MASK) >> 18;
@@ -434,6 +585,18 @@ static void mcp251x_hw_tx(struct spi_device *spi, struct can_frame *frame,
 	mcp251x_spi_trans(priv->spi, 1);
 }
 
+/* Abort all pending transmissions */
+static void mcp251x_hw_tx_abort(struct spi_device *spi)
+{
+	struct mcp251x_priv *priv = spi_get_drvdata(spi);
+	int i;
+
+	for (i = 0; i < MCP251X_TX_BUFS; i++) {
+		mcp251x_write_reg(spi, TXBCTRL(i), 0);
+		priv->tx_txp[i] = 0;
+	}
+}
+
 static void mcp251x_hw_rx_frame(struct spi_device *spi, u8 *buf,
 				int buf_idx)
 {
@@ -455,12 +618,11 @@ static void mcp251x_hw_rx_frame(struct spi_device *spi, u8 *buf,
 	}
 }
 
-static void mcp251x_hw_rx(struct spi_device *spi, int buf_idx)
+static void mcp251x_rx_skb(struct spi_device *spi, const u8 *buf)
 {
 	struct mcp251x_priv *priv = spi_get_drvdata(spi);
 	struct sk_buff *skb;
 	struct can_frame *frame;
-	u8 buf[SPI_TRANSFER_BUF_LEN];
 
 	skb = alloc_can_skb(priv->net, &frame);
 	if (!skb) {
@@ -469,7 +631,6 @@ static void mcp251x_hw_rx(struct spi_device *spi, int buf_idx)
 		return;
 	}
 
-	mcp251x_hw_rx_frame(spi, buf, buf_idx);
 	if (buf[RXBSIDL_OFF] & RXBSIDL_IDE) {
 		/* Extended ID format */
 		frame->can_id = CAN_EFF_FLAG;
@@ -504,6 +665,107 @@ static void mcp251x_hw_rx(struct spi_device *spi, int buf_idx)
 	netif_rx_ni(skb);
 }
 
+static void mcp251x_hw_rx(struct spi_device *spi, int buf_idx)
+{
+	u8 buf[SPI_TRANSFER_BUF_LEN];
+
+	mcp251x_hw_rx_frame(spi, buf, buf_idx);
+	mcp251x_rx_skb(spi, buf);
+}
+
+/*
+ * One pass of the interrupt loop: read the flagged RX buffers, clear the
+ * handled CANINTF and EFLG bits and, if anything was pending, read
+ * CANINTF/EFLG again for the next pass. On the MCP2515 this is a single
+ * SPI message, one CS cycle per instruction; READ RX BUFFER releases the
+ * buffer when CS goes up. READ STATUS does not report ERRIF or EFLG, so
+ * both registers are read with a plain READ. The MCP2510 has no READ RX
+ * BUFFER and gets one transfer per register.
+ */
+static void mcp251x_ist_batch(struct spi_device *spi, u8 intf, u8 clear_intf,
+			      u8 eflag, u8 *next_intf, u8 *next_eflag)
+{
+	struct mcp251x_priv *priv = spi_get_drvdata(spi);
+	struct spi_transfer t[SPI_BATCH_XFERS];
+	struct spi_message m;
+	u8 *tx = priv->spi_tx_buf;
+	u8 *rx = priv->spi_rx_buf;
+	int i, n = 0;
+
+	*next_intf = 0;
+	*next_eflag = 0;
+
+	if (mcp251x_is_2510(spi)) {
+		if (intf & CANINTF_RX0IF) {
+			mcp251x_hw_rx(spi, 0);
+			/* Free one buffer ASAP */
+			mcp251x_write_bits(spi, CANINTF, CANINTF_RX0IF, 0x00);
+		}
+		if (intf & CANINTF_RX1IF) {
+			mcp251x_hw_rx(spi, 1);
+			clear_intf |= CANINTF_RX1IF;
+		}
+		if (clear_intf)
+			mcp251x_write_bits(spi, CANINTF, clear_intf, 0x00);
+		if (eflag)
+			mcp251x_write_bits(spi, EFLG, eflag, 0x00);
+		if (intf)
+			mcp251x_read_2regs(spi, CANINTF, next_intf, next_eflag);
+		return;
+	}
+
+	memset(t, 0, sizeof(t));
+	spi_message_init(&m);
+	if (mcp251x_enable_dma)
+		m.is_dma_mapped = 1;
+
+	for (i = 0; i < 2; i++) {
+		if (intf & (CANINTF_RX0IF << i)) {
+			tx[SPI_BATCH_RXB(i)] = INSTRUCTION_READ_RXB(i);
+			mcp251x_batch_add(priv, &m, &t[n++], SPI_BATCH_RXB(i),
+					  SPI_TRANSFER_BUF_LEN);
+		}
+	}
+	if (clear_intf) {
+		tx[SPI_BATCH_INTF] = INSTRUCTION_BIT_MODIFY;
+		tx[SPI_BATCH_INTF + 1] = CANINTF;
+		tx[SPI_BATCH_INTF + 2] = clear_intf;
+		tx[SPI_BATCH_INTF + 3] = 0x00;
+		mcp251x_batch_add(priv, &m, &t[n++], SPI_BATCH_INTF, 4);
+	}
+	if (eflag) {
+		tx[SPI_BATCH_EFLG] = INSTRUCTION_BIT_MODIFY;
+		tx[SPI_BATCH_EFLG + 1] = EFLG;
+		tx[SPI_BATCH_EFLG + 2] = eflag;
+		tx[SPI_BATCH_EFLG + 3] = 0x00;
+		mcp251x_batch_add(priv, &m, &t[n++], SPI_BATCH_EFLG, 4);
+	}
+	if (intf) {
+		tx[SPI_BATCH_STAT] = INSTRUCTION_READ;
+		tx[SPI_BATCH_STAT + 1] = CANINTF;
+		mcp251x_batch_add(priv, &m, &t[n++], SPI_BATCH_STAT, 4);
+	}
+	if (!n)
+		return;
+
+	/* Leave CS released after the last instruction */
+	t[n - 1].cs_change = 0;
+
+	if (spi_sync(spi, &m)) {
+		dev_err(&spi->dev, "spi batch transfer failed\n");
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+		if (intf & (CANINTF_RX0IF << i))
+			mcp251x_rx_skb(spi, rx + SPI_BATCH_RXB(i));
+
+	if (intf) {
+		*next_intf = rx[SPI_BATCH_STAT + 2];
+		*next_eflag = rx[SPI_BATCH_STAT + 3];
+	}
+}
+
 static void mcp251x_hw_sleep(struct spi_device *spi)
 {
 	mcp251x_write_reg(spi, CANCTRL, CANCTRL_REQOP_SLEEP);
@@ -515,7 +777,7 @@ static netdev_tx_t mcp251x_hard_start_xmit(struct sk_buff *skb,
 	struct mcp251x_priv *priv = netdev_priv(net);
 	struct spi_device *spi = priv->spi;
 
-	if (priv->tx_skb || priv->tx_len) {
+	if (priv->tx_skb) {
 		dev_warn(&spi->dev, "hard_xmit called while tx busy\n");
 		return NETDEV_TX_BUSY;
 	}
@@ -586,6 +848,55 @@ static int mcp251x_set_normal_mode(struct spi_device *spi)
 	return 0;
 }
 
+static int mcp251x_set_config_mode(struct spi_device *spi)
+{
+	unsigned long timeout;
+
+	mcp251x_write_reg(spi, CANCTRL, CANCTRL_REQOP_CONF);
+
+	timeout = jiffies + HZ;
+	while ((mcp251x_read_reg(spi, CANSTAT) & CANCTRL_REQOP_MASK)
+	       != CANCTRL_REQOP_CONF) {
+		schedule();
+		if (time_after(jiffies, timeout)) {
+			dev_err(&spi->dev, "MCP251x didn't"
+				" enter in conf mode\n");
+			return -EBUSY;
+		}
+	}
+	return 0;
+}
+
+/* Program the acceptance filters, only possible in configuration mode */
+static void mcp251x_hw_filter(struct spi_device *spi)
+{
+	struct mcp251x_priv *priv = spi_get_drvdata(spi);
+	struct mcp251x_acc_filter *f = &priv->rx_filter;
+	int i, eff;
+
+	priv->rx_filter_pending = 0;
+
+	if (!mcp251x_rx_filter || !f->on) {
+		/* receive any message */
+		mcp251x_write_reg(spi, RXBCTRL(0),
+				  RXBCTRL_BUKT | RXBCTRL_RXM0 | RXBCTRL_RXM1);
+		mcp251x_write_reg(spi, RXBCTRL(1),
+				  RXBCTRL_RXM0 | RXBCTRL_RXM1);
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+		mcp251x_write_id(spi, RXMSIDH(i), f->mask[i], f->eff[i], 0);
+	for (i = 0; i < MCP251X_RX_FILTERS; i++) {
+		eff = f->eff[MCP251X_RX_FILTER_GROUP(i)];
+		mcp251x_write_id(spi, RXFSIDH(i), f->id[i], eff, eff);
+	}
+
+	/* receive valid messages matching the filters */
+	mcp251x_write_reg(spi, RXBCTRL(0), RXBCTRL_BUKT);
+	mcp251x_write_reg(spi, RXBCTRL(1), 0);
+}
+
 static int mcp251x_do_set_bittiming(struct net_device *net)
 {
 	struct mcp251x_priv *priv = netdev_priv(net);
@@ -613,11 +924,10 @@ static int mcp251x_setup(struct net_device *net, struct mcp251x_priv *priv,
 			 struct spi_device *spi)
 {
 	mcp251x_do_set_bittiming(net);
+	mcp251x_hw_filter(spi);
 
-	mcp251x_write_reg(spi, RXBCTRL(0),
-			  RXBCTRL_BUKT | RXBCTRL_RXM0 | RXBCTRL_RXM1);
-	mcp251x_write_reg(spi, RXBCTRL(1),
-			  RXBCTRL_RXM0 | RXBCTRL_RXM1);
+	/* TXBCTRL is zero after reset */
+	memset(priv->tx_txp, 0, sizeof(priv->tx_txp));
 	return 0;
 }
 
@@ -710,7 +1020,7 @@ static int mcp251x_stop(struct net_device *net)
 	mcp251x_write_reg(spi, CANINTE, 0x00);
 	mcp251x_write_reg(spi, CANINTF, 0x00);
 
-	mcp251x_write_reg(spi, TXBCTRL(0), 0);
+	mcp251x_hw_tx_abort(spi);
 	mcp251x_clean(net);
 
 	mcp251x_hw_sleep(spi);
@@ -748,22 +1058,36 @@ static void mcp251x_tx_work_handler(struct work_struct *ws)
 	struct spi_device *spi = priv->spi;
 	struct net_device *net = priv->net;
 	struct can_frame *frame;
+	int idx;
+	u8 txp;
 
 	mutex_lock(&priv->mcp_lock);
 	if (priv->tx_skb) {
 		if (priv->can.state == CAN_STATE_BUS_OFF) {
 			mcp251x_clean(net);
 		} else {
+			/* No buffer fits yet, the ist requeues us */
+			idx = mcp251x_tx_slot(priv, &txp);
+			if (idx < 0)
+				goto out;
+
 			frame = (struct can_frame *)priv->tx_skb->data;
 
 			if (frame->can_dlc > CAN_FRAME_MAX_DATA_LEN)
 				frame->can_dlc = CAN_FRAME_MAX_DATA_LEN;
-			mcp251x_hw_tx(spi, frame, 0);
-			priv->tx_len = 1 + frame->can_dlc;
-			can_put_echo_skb(priv->tx_skb, net, 0);
+			mcp251x_hw_tx(spi, frame, idx, txp);
+			priv->tx_len[idx] = frame->can_dlc;
+			priv->tx_key[idx] = txp * MCP251X_TX_BUFS + idx;
+			priv->tx_busy |= BIT(idx);
+			can_put_echo_skb(priv->tx_skb, net, idx);
 			priv->tx_skb = NULL;
+
+			/* Take the next frame while a buffer is left */
+			if (mcp251x_tx_slot(priv, &txp) >= 0)
+				netif_wake_queue(net);
 		}
 	}
+out:
 	mutex_unlock(&priv->mcp_lock);
 }
 
@@ -795,7 +1119,7 @@ static void mcp251x_restart_work_handler(struct work_struct *ws)
 
 	if (priv->restart_tx) {
 		priv->restart_tx = 0;
-		mcp251x_write_reg(spi, TXBCTRL(0), 0);
+		mcp251x_hw_tx_abort(spi);
 		mcp251x_clean(net);
 		netif_wake_queue(net);
 		mcp251x_error_skb(net, CAN_ERR_RESTARTED, 0);
@@ -803,51 +1127,203 @@ static void mcp251x_restart_work_handler(struct work_struct *ws)
 	mutex_unlock(&priv->mcp_lock);
 }
 
+/* Complete the buffers flagged in @intf, in the order they were sent */
+static void mcp251x_tx_done(struct net_device *net, u8 intf)
+{
+	struct mcp251x_priv *priv = netdev_priv(net);
+	u8 done = (intf & CANINTF_TX) / CANINTF_TX0IF & priv->tx_busy;
+	u8 txp;
+	int i, idx;
+
+	while (done) {
+		idx = -1;
+		for (i = 0; i < MCP251X_TX_BUFS; i++)
+			if ((done & BIT(i)) &&
+			    (idx < 0 || priv->tx_key[i] > priv->tx_key[idx]))
+				idx = i;
+
+		net->stats.tx_packets++;
+		net->stats.tx_bytes += priv->tx_len[idx];
+		can_get_echo_skb(net, idx);
+		priv->tx_len[idx] = 0;
+		priv->tx_busy &= ~BIT(idx);
+		done &= ~BIT(idx);
+	}
+	can_led_event(net, CAN_LED_EVENT_TX);
+
+	if (priv->tx_skb)
+		queue_work(priv->wq, &priv->tx_work);
+	else if (mcp251x_tx_slot(priv, &txp) >= 0)
+		netif_wake_queue(net);
+
+	if (priv->rx_filter_pending && !priv->tx_busy && !priv->force_quit)
+		schedule_work(&priv->rx_filter_work);
+}
+
+/*
+ * Reduce filters of one frame format to at most @k values under a single
+ * mask. Mask bits are given up from the least significant one until the
+ * filters fall into @k distinct values; the result matches every frame
+ * any of the filters matches. Unused slots repeat the first value.
+ */
+static void mcp251x_filter_reduce(const struct can_filter *f, int n, int k,
+				  u32 *mask, u32 *id)
+{
+	u32 m = ~0;
+	int i, j, cnt;
+
+	for (i = 0; i < n; i++)
+		m &= f[i].can_mask;
+
+	for (;;) {
+		cnt = 0;
+		for (i = 0; i < n && cnt <= k; i++) {
+			for (j = 0; j < cnt; j++)
+				if (id[j] == (f[i].can_id & m))
+					break;
+			if (j < cnt)
+				continue;
+			if (cnt == k) {
+				cnt++;
+				break;
+			}
+			id[cnt++] = f[i].can_id & m;
+		}
+		if (cnt <= k)
+			break;
+		m &= m - 1;
+	}
+
+	*mask = m;
+	for (j = cnt; j < k; j++)
+		id[j] = id[0];
+}
+
+/*
+ * Work out the acceptance filters from the @n receive filters in @f.
+ * @buf has room for 2 * @n more filters.
+ */
+static void mcp251x_filter_compute(const struct can_filter *f, int n,
+				   struct can_filter *buf,
+				   struct mcp251x_acc_filter *hw)
+{
+	struct can_filter *sff = buf, *eff = buf + n;
+	int i, nsff = 0, neff = 0, big;
+
+	memset(hw, 0, sizeof(*hw));
+	if (n <= 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		canid_t id = f[i].can_id;
+		canid_t mask = f[i].can_mask;
+
+		/* without CAN_EFF_FLAG in the mask both formats match */
+		if (!(mask & CAN_EFF_FLAG) || !(id & CAN_EFF_FLAG)) {
+			sff[nsff].can_id = id & CAN_SFF_MASK;
+			sff[nsff++].can_mask = mask & CAN_SFF_MASK;
+		}
+		if (!(mask & CAN_EFF_FLAG) || (id & CAN_EFF_FLAG)) {
+			eff[neff].can_id = id & CAN_EFF_MASK;
+			eff[neff++].can_mask = mask & CAN_EFF_MASK;
+		}
+	}
+
+	hw->on = 1;
+	if (!nsff || !neff) {
+		/* one format only, both groups share the mask */
+		hw->eff[0] = hw->eff[1] = !nsff;
+		mcp251x_filter_reduce(nsff ? sff : eff, nsff ? nsff : neff,
+				      MCP251X_RX_FILTERS, &hw->mask[0], hw->id);
+		hw->mask[1] = hw->mask[0];
+		return;
+	}
+
+	/* the format with more filters gets the group with four of them */
+	big = neff >= nsff;
+	hw->eff[0] = !big;
+	hw->eff[1] = big;
+	mcp251x_filter_reduce(big ? sff : eff, big ? nsff : neff, 2,
+			      &hw->mask[0], hw->id);
+	mcp251x_filter_reduce(big ? eff : sff, big ? neff : nsff, 4,
+			      &hw->mask[1], hw->id + 2);
+}
+
+static void mcp251x_rx_filter_work_handler(struct work_struct *ws)
+{
+	struct mcp251x_priv *priv = container_of(ws, struct mcp251x_priv,
+						 rx_filter_work);
+	struct spi_device *spi = priv->spi;
+	struct net_device *net = priv->net;
+	struct mcp251x_acc_filter hw;
+	struct can_filter *f;
+	int n;
+
+	f = kmalloc_array(3 * MCP251X_RX_FILTER_SCAN, sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return;
+
+	n = can_rx_get_filters(net, f, MCP251X_RX_FILTER_SCAN);
+	mcp251x_filter_compute(f, n, f + MCP251X_RX_FILTER_SCAN, &hw);
+	kfree(f);
+
+	mutex_lock(&priv->mcp_lock);
+	if (memcmp(&hw, &priv->rx_filter, sizeof(hw))) {
+		priv->rx_filter = hw;
+		priv->rx_filter_pending = 1;
+	}
+
+	/*
+	 * Reprogramming takes a trip through configuration mode; wait for
+	 * the transmit buffers to drain, mcp251x_tx_done() calls us again.
+	 */
+	if (priv->rx_filter_pending && netif_running(net) &&
+	    !priv->force_quit && !priv->after_suspend && !priv->tx_busy) {
+		if (!mcp251x_set_config_mode(spi)) {
+			mcp251x_hw_filter(spi);
+			mcp251x_set_normal_mode(spi);
+		}
+	}
+	mutex_unlock(&priv->mcp_lock);
+}
+
+static int mcp251x_rx_filter_notifier(struct notifier_block *nb,
+				      unsigned long action, void *data)
+{
+	struct mcp251x_priv *priv = container_of(nb, struct mcp251x_priv,
+						 rx_filter_nb);
+	struct net_device *dev = data;
+
+	if (!dev || dev == priv->net)
+		schedule_work(&priv->rx_filter_work);
+
+	return NOTIFY_DONE;
+}
+
 static irqreturn_t mcp251x_can_ist(int irq, void *dev_id)
 {
 	struct mcp251x_priv *priv = dev_id;
 	struct spi_device *spi = priv->spi;
 	struct net_device *net = priv->net;
 
+	u8 intf, eflag;
+
 	mutex_lock(&priv->mcp_lock);
+	mcp251x_read_2regs(spi, CANINTF, &intf, &eflag);
 	while (!priv->force_quit) {
 		enum can_state new_state;
-		u8 intf, eflag;
-		u8 clear_intf = 0;
+		u8 next_intf, next_eflag;
 		int can_id = 0, data1 = 0;
 
-		mcp251x_read_2regs(spi, CANINTF, &intf, &eflag);
-
 		/* mask out flags we don't care about */
 		intf &= CANINTF_RX | CANINTF_TX | CANINTF_ERR;
 
-		/* receive buffer 0 */
-		if (intf & CANINTF_RX0IF) {
-			mcp251x_hw_rx(spi, 0);
-			/*
-			 * Free one buffer ASAP
-			 * (The MCP2515 does this automatically.)
-			 */
-			if (mcp251x_is_2510(spi))
-				mcp251x_write_bits(spi, CANINTF, CANINTF_RX0IF, 0x00);
-		}
-
-		/* receive buffer 1 */
-		if (intf & CANINTF_RX1IF) {
-			mcp251x_hw_rx(spi, 1);
-			/* the MCP2515 does this automatically */
-			if (mcp251x_is_2510(spi))
-				clear_intf |= CANINTF_RX1IF;
-		}
-
-		/* any error or tx interrupt we need to clear? */
-		if (intf & (CANINTF_ERR | CANINTF_TX))
-			clear_intf |= intf & (CANINTF_ERR | CANINTF_TX);
-		if (clear_intf)
-			mcp251x_write_bits(spi, CANINTF, clear_intf, 0x00);
-
-		if (eflag)
-			mcp251x_write_bits(spi, EFLG, eflag, 0x00);
+		/*
+		 * Receive, clear any error or tx interrupt and fetch the
+		 * flags for the next pass in one go
+		 */
+		mcp251x_ist_batch(spi, intf, intf & (CANINTF_ERR | CANINTF_TX),
+				  eflag, &next_intf, &next_eflag);
 
 		/* Update can state */
 		if (eflag & EFLG_TXBO) {
@@ -918,17 +1394,11 @@ static irqreturn_t mcp251x_can_ist(int irq, void *dev_id)
 		if (intf == 0)
 			break;
 
-		if (intf & CANINTF_TX) {
-			net->stats.tx_packets++;
-			net->stats.tx_bytes += priv->tx_len - 1;
-			can_led_event(net, CAN_LED_EVENT_TX);
-			if (priv->tx_len) {
-				can_get_echo_skb(net, 0);
-				priv->tx_len = 0;
-			}
-			netif_wake_queue(net);
-		}
+		if (intf & CANINTF_TX)
+			mcp251x_tx_done(net, intf);
 
+		intf = next_intf;
+		eflag = next_eflag;
 	}
 	mutex_unlock(&priv->mcp_lock);
 	return IRQ_HANDLED;
@@ -952,7 +1422,8 @@ static int mcp251x_open(struct net_device *net)
 
 	priv->force_quit = 0;
 	priv->tx_skb = NULL;
-	priv->tx_len = 0;
+	priv->tx_busy = 0;
+	memset(priv->tx_len, 0, sizeof(priv->tx_len));
 
 	ret = request_threaded_irq(spi->irq, NULL, mcp251x_can_ist,
 				   flags, DEVICE_NAME, priv);
@@ -985,6 +1456,10 @@ static int mcp251x_open(struct net_device *net)
 
 	can_led_event(net, CAN_LED_EVENT_OPEN);
 
+	/* pick up filters registered while the interface was down */
+	if (mcp251x_rx_filter)
+		schedule_work(&priv->rx_filter_work);
+
 	netif_wake_queue(net);
 
 open_unlock:
@@ -1080,6 +1555,7 @@ static int mcp251x_can_probe(struct spi_device *spi)
 	else
 		priv->model = spi_get_device_id(spi)->driver_data;
 	priv->net = net;
+	priv->tx_bufs = clamp(mcp251x_tx_bufs, 1, MCP251X_TX_BUFS);
 	priv->clk = clk;
 
 	priv->power = devm_regulator_get(&spi->dev, "vdd");
@@ -1098,6 +1574,8 @@ static int mcp251x_can_probe(struct spi_device *spi)
 
 	priv->spi = spi;
 	mutex_init(&priv->mcp_lock);
+	INIT_WORK(&priv->rx_filter_work, mcp251x_rx_filter_work_handler);
+	priv->rx_filter_nb.notifier_call = mcp251x_rx_filter_notifier;
 
 	/* If requested, allocate DMA buffers */
 	if (mcp251x_enable_dma) {
@@ -1124,13 +1602,13 @@ static int mcp251x_can_probe(struct spi_device *spi)
 
 	/* Allocate non-DMA buffers */
 	if (!mcp251x_enable_dma) {
-		priv->spi_tx_buf = devm_kzalloc(&spi->dev, SPI_TRANSFER_BUF_LEN,
+		priv->spi_tx_buf = devm_kzalloc(&spi->dev, SPI_BATCH_BUF_LEN,
 						GFP_KERNEL);
 		if (!priv->spi_tx_buf) {
 			ret = -ENOMEM;
 			goto error_probe;
 		}
-		priv->spi_rx_buf = devm_kzalloc(&spi->dev, SPI_TRANSFER_BUF_LEN,
+		priv->spi_rx_buf = devm_kzalloc(&spi->dev, SPI_BATCH_BUF_LEN,
 						GFP_KERNEL);
 		if (!priv->spi_rx_buf) {
 			ret = -ENOMEM;
@@ -1162,6 +1640,9 @@ static int mcp251x_can_probe(struct spi_device *spi)
 
 	devm_can_led_init(net);
 
+	if (mcp251x_rx_filter)
+		can_rx_filter_notifier_register(&priv->rx_filter_nb);
+
 	dev_info(&spi->dev, "probed\n");
 
 	return ret;
@@ -1187,8 +1668,15 @@ static int mcp251x_can_remove(struct spi_device *spi)
 	struct mcp251x_priv *priv = spi_get_drvdata(spi);
 	struct net_device *net = priv->net;
 
+	if (mcp251x_rx_filter)
+		can_rx_filter_notifier_unregister(&priv->rx_filter_nb);
+
 	unregister_candev(net);
 
+	/* mcp251x_tx_done() may have queued it until the interface stopped */
+	if (mcp251x_rx_filter)
+		cancel_work_sync(&priv->rx_filter_work);
+
 	if (mcp251x_enable_dma) {
 		dma_free_coherent(&spi->dev, PAGE_SIZE,
 				  priv->spi_tx_buf, priv->spi_tx_dma);
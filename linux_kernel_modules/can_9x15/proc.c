@@ -42,6 +42,7 @@
 #include <linux/module.h>
 #include <linux/proc_fs.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/rcupdate.h>
 #include <linux/if_arp.h>
 #include <linux/can/core.h>
@@ -80,22 +81,44 @@ static const char rx_list_name[][8] = {
 	[RX_ALL] = "rx_all",
 	[RX_FIL] = "rx_fil",
 	[RX_INV] = "rx_inv",
-	[RX_EFF] = "rx_eff",
 };
 
 /*
  * af_can statistics stuff
  */
 
+/* derived values in can_stats, computed when the stats are read */
+static struct s_stats can_stats;
+static DEFINE_MUTEX(can_stats_lock);
+
+/* sum up the per CPU packet counters */
+static void can_fold_stats(unsigned long *rx_frames, unsigned long *tx_frames,
+			   unsigned long *matches)
+{
+	struct s_pcpu_stats *p;
+	int cpu;
+
+	*rx_frames = *tx_frames = *matches = 0;
+
+	for_each_possible_cpu(cpu) {
+		p = per_cpu_ptr(&can_pcpu_stats, cpu);
+		*rx_frames += p->rx_frames;
+		*tx_frames += p->tx_frames;
+		*matches   += p->matches;
+	}
+}
+
 static void can_init_stats(void)
 {
 	/*
-	 * This memset function is called from a timer context (when
-	 * can_stattimer is active which is the default) OR in a process
-	 * context (reading the proc_fs when can_stattimer is disabled).
+	 * The per CPU counters keep running, a reset only moves the base
+	 * they are counted from. Called with can_stats_lock held.
 	 */
 	memset(&can_stats, 0, sizeof(can_stats));
+	can_fold_stats(&can_stats.rx_frames_base, &can_stats.tx_frames_base,
+		       &can_stats.matches_base);
 	can_stats.jiffies_init = jiffies;
+	can_stats.jiffies_last = can_stats.jiffies_init;
 
 	can_pstats.stats_reset++;
 
@@ -125,29 +148,34 @@ static unsigned long calc_rate(unsigned long oldjif, unsigned long newjif,
 	return rate;
 }
 
-void can_stat_update(unsigned long data)
+/*
+ * Fold the per CPU counters and work out the rates. The 'current' values
+ * cover the time since the previous update, i.e. since the stats were
+ * last read. Called with can_stats_lock held.
+ */
+static void can_stat_update(void)
 {
 	unsigned long j = jiffies; /* snapshot */
-
-	/* restart counting in timer context on user request */
-	if (user_reset)
-		can_init_stats();
+	unsigned long rx_frames, tx_frames, matches;
+	unsigned long rx_delta, tx_delta, matches_delta;
 
 	/* restart counting on jiffies overflow */
 	if (j < can_stats.jiffies_init)
 		can_init_stats();
 
-	/* prevent overflow in calc_rate() */
-	if (can_stats.rx_frames > (ULONG_MAX / HZ))
-		can_init_stats();
+	can_fold_stats(&rx_frames, &tx_frames, &matches);
+	can_stats.rx_frames = rx_frames - can_stats.rx_frames_base;
+	can_stats.tx_frames = tx_frames - can_stats.tx_frames_base;
+	can_stats.matches   = matches - can_stats.matches_base;
 
 	/* prevent overflow in calc_rate() */
-	if (can_stats.tx_frames > (ULONG_MAX / HZ))
-		can_init_stats();
-
-	/* matches overflow - very improbable */
-	if (can_stats.matches > (ULONG_MAX / 100))
+	if (can_stats.rx_frames > (ULONG_MAX / HZ) ||
+	    can_stats.tx_frames > (ULONG_MAX / HZ) ||
+	    /* matches overflow - very improbable */
+	    can_stats.matches > (ULONG_MAX / 100)) {
 		can_init_stats();
+		return;
+	}
 
 	/* calc total values */
 	if (can_stats.rx_frames)
@@ -159,14 +187,22 @@ void can_stat_update(unsigned long data)
 	can_stats.total_rx_rate = calc_rate(can_stats.jiffies_init, j,
 					    can_stats.rx_frames);
 
+	/* keep the current values when read twice within a jiffy */
+	if (j == can_stats.jiffies_last)
+		return;
+
 	/* calc current values */
-	if (can_stats.rx_frames_delta)
-		can_stats.current_rx_match_ratio =
-			(can_stats.matches_delta * 100) /
-			can_stats.rx_frames_delta;
+	rx_delta = can_stats.rx_frames - can_stats.rx_frames_last;
+	tx_delta = can_stats.tx_frames - can_stats.tx_frames_last;
+	matches_delta = can_stats.matches - can_stats.matches_last;
 
-	can_stats.current_tx_rate = calc_rate(0, HZ, can_stats.tx_frames_delta);
-	can_stats.current_rx_rate = calc_rate(0, HZ, can_stats.rx_frames_delta);
+	can_stats.current_rx_match_ratio = rx_delta ?
+		(matches_delta * 100) / rx_delta : 0;
+
+	can_stats.current_tx_rate = calc_rate(can_stats.jiffies_last, j,
+					      tx_delta);
+	can_stats.current_rx_rate = calc_rate(can_stats.jiffies_last, j,
+					      rx_delta);
 
 	/* check / update maximum values */
 	if (can_stats.max_tx_rate < can_stats.current_tx_rate)
@@ -178,13 +214,11 @@ void can_stat_update(unsigned long data)
 	if (can_stats.max_rx_match_ratio < can_stats.current_rx_match_ratio)
 		can_stats.max_rx_match_ratio = can_stats.current_rx_match_ratio;
 
-	/* clear values for 'current rate' calculation */
-	can_stats.tx_frames_delta = 0;
-	can_stats.rx_frames_delta = 0;
-	can_stats.matches_delta   = 0;
-
-	/* restart timer (one second) */
-	mod_timer(&can_stattimer, round_jiffies(jiffies + HZ));
+	/* remember values for the next 'current rate' calculation */
+	can_stats.jiffies_last   = j;
+	can_stats.rx_frames_last = can_stats.rx_frames;
+	can_stats.tx_frames_last = can_stats.tx_frames;
+	can_stats.matches_last   = can_stats.matches;
 }
 
 /*
@@ -202,7 +236,7 @@ static void can_print_rcvlist(struct seq_file *m, struct hlist_head *rx_list,
 			"   %-5s     %03x    %08x  %pK  %pK  %8ld  %s\n";
 
 		seq_printf(m, fmt, DNAME(dev), r->can_id, r->mask,
-				r->func, r->data, r->matches, r->ident);
+				r->func, r->data, can_rcv_matches(r), r->ident);
 	}
 }
 
@@ -218,6 +252,9 @@ static void can_print_recv_banner(struct seq_file *m)
 
 static int can_stats_proc_show(struct seq_file *m, void *v)
 {
+	mutex_lock(&can_stats_lock);
+	can_stat_update();
+
 	seq_putc(m, '\n');
 	seq_printf(m, " %8ld transmitted frames (TXF)\n", can_stats.tx_frames);
 	seq_printf(m, " %8ld received frames (RXF)\n", can_stats.rx_frames);
@@ -225,7 +262,7 @@ static int can_stats_proc_show(struct seq_file *m, void *v)
 
 	seq_putc(m, '\n');
 
-	if (can_stattimer.function == can_stat_update) {
+	if (can_stats_rates) {
 		seq_printf(m, " %8ld %% total match ratio (RXMR)\n",
 				can_stats.total_rx_match_ratio);
 
@@ -270,6 +307,8 @@ static int can_stats_proc_show(struct seq_file *m, void *v)
 		seq_printf(m, " %8ld user statistic resets (USTR)\n",
 				can_pstats.user_reset);
 
+	mutex_unlock(&can_stats_lock);
+
 	seq_putc(m, '\n');
 	return 0;
 }
@@ -289,19 +328,15 @@ static const struct file_operations can_stats_proc_fops = {
 
 static int can_reset_stats_proc_show(struct seq_file *m, void *v)
 {
-	user_reset = 1;
+	mutex_lock(&can_stats_lock);
 
-	if (can_stattimer.function == can_stat_update) {
-		seq_printf(m, "Scheduled statistic reset #%ld.\n",
-				can_pstats.stats_reset + 1);
+	user_reset = 1;
+	can_init_stats();
 
-	} else {
-		if (can_stats.jiffies_init != jiffies)
-			can_init_stats();
+	seq_printf(m, "Performed statistic reset #%ld.\n",
+			can_pstats.stats_reset);
 
-		seq_printf(m, "Performed statistic reset #%ld.\n",
-				can_pstats.stats_reset);
-	}
+	mutex_unlock(&can_stats_lock);
 	return 0;
 }
 
@@ -389,25 +424,26 @@ static const struct file_operations can_rcvlist_proc_fops = {
 	.release	= single_release,
 };
 
-static inline void can_rcvlist_sff_proc_show_one(struct seq_file *m,
-						 struct net_device *dev,
-						 struct dev_rcv_lists *d)
+static inline void can_rcvlist_proc_show_array(struct seq_file *m,
+					       struct net_device *dev,
+					       struct hlist_head *rcv_array,
+					       unsigned int rcv_array_sz)
 {
-	int i;
+	unsigned int i;
 	int all_empty = 1;
 
 	/* check whether at least one list is non-empty */
-	for (i = 0; i < 0x800; i++)
-		if (!hlist_empty(&d->rx_sff[i])) {
+	for (i = 0; i < rcv_array_sz; i++)
+		if (!hlist_empty(&rcv_array[i])) {
 			all_empty = 0;
 			break;
 		}
 
 	if (!all_empty) {
 		can_print_recv_banner(m);
-		for (i = 0; i < 0x800; i++) {
-			if (!hlist_empty(&d->rx_sff[i]))
-				can_print_rcvlist(m, &d->rx_sff[i], dev);
+		for (i = 0; i < rcv_array_sz; i++) {
+			if (!hlist_empty(&rcv_array[i]))
+				can_print_rcvlist(m, &rcv_array[i], dev);
 		}
 	} else
 		seq_printf(m, "  (%s: no entry)\n", DNAME(dev));
@@ -425,12 +461,15 @@ static int can_rcvlist_sff_proc_show(struct seq_file *m, void *v)
 
 	/* sff receive list for 'all' CAN devices (dev == NULL) */
 	d = &can_rx_alldev_list;
-	can_rcvlist_sff_proc_show_one(m, NULL, d);
+	can_rcvlist_proc_show_array(m, NULL, d->rx_sff, ARRAY_SIZE(d->rx_sff));
 
 	/* sff receive list for registered CAN devices */
 	for_each_netdev_rcu(&init_net, dev) {
-		if (dev->type == ARPHRD_CAN && dev->ml_priv)
-			can_rcvlist_sff_proc_show_one(m, dev, dev->ml_priv);
+		if (dev->type == ARPHRD_CAN && dev->ml_priv) {
+			d = dev->ml_priv;
+			can_rcvlist_proc_show_array(m, dev, d->rx_sff,
+						    ARRAY_SIZE(d->rx_sff));
+		}
 	}
 
 	rcu_read_unlock();
@@ -452,6 +491,48 @@ static const struct file_operations can_rcvlist_sff_proc_fops = {
 	.release	= single_release,
 };
 
+static int can_rcvlist_eff_proc_show(struct seq_file *m, void *v)
+{
+	struct net_device *dev;
+	struct dev_rcv_lists *d;
+
+	/* RX_EFF */
+	seq_puts(m, "\nreceive list 'rx_eff':\n");
+
+	rcu_read_lock();
+
+	/* eff receive list for 'all' CAN devices (dev == NULL) */
+	d = &can_rx_alldev_list;
+	can_rcvlist_proc_show_array(m, NULL, d->rx_eff, ARRAY_SIZE(d->rx_eff));
+
+	/* eff receive list for registered CAN devices */
+	for_each_netdev_rcu(&init_net, dev) {
+		if (dev->type == ARPHRD_CAN && dev->ml_priv) {
+			d = dev->ml_priv;
+			can_rcvlist_proc_show_array(m, dev, d->rx_eff,
+						    ARRAY_SIZE(d->rx_eff));
+		}
+	}
+
+	rcu_read_unlock();
+
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static int can_rcvlist_eff_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, can_rcvlist_eff_proc_show, NULL);
+}
+
+static const struct file_operations can_rcvlist_eff_proc_fops = {
+	.owner		= THIS_MODULE,
+	.open		= can_rcvlist_eff_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /*
  * proc utility functions
  */
@@ -476,6 +557,9 @@ void can_init_proc(void)
 		return;
 	}
 
+	can_stats.jiffies_init = jiffies;
+	can_stats.jiffies_last = can_stats.jiffies_init;
+
 	/* own procfs entries from the AF_CAN core */
 	pde_version     = proc_create(CAN_PROC_VERSION, 0644, can_dir,
 				      &can_version_proc_fops);
@@ -491,8 +575,8 @@ void can_init_proc(void)
 					   &can_rcvlist_proc_fops, (void *)RX_FIL);
 	pde_rcvlist_inv = proc_create_data(CAN_PROC_RCVLIST_INV, 0644, can_dir,
 					   &can_rcvlist_proc_fops, (void *)RX_INV);
-	pde_rcvlist_eff = proc_create_data(CAN_PROC_RCVLIST_EFF, 0644, can_dir,
-					   &can_rcvlist_proc_fops, (void *)RX_EFF);
+	pde_rcvlist_eff = proc_create(CAN_PROC_RCVLIST_EFF, 0644, can_dir,
+				      &can_rcvlist_eff_proc_fops);
 	pde_rcvlist_sff = proc_create(CAN_PROC_RCVLIST_SFF, 0644, can_dir,
 				      &can_rcvlist_sff_proc_fops);
 }
@@ -0,0 +1,518 @@
+/* The industrial I/O block buffer
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * A ring of fixed-size blocks shared with userspace through mmap(). Blocks
+ * move between userspace and the device with the ioctls described in
+ * block_buf.h; scans are written straight into the block being filled.
+ *
+ * Only the device pushes scans, so the block being filled is private to the
+ * push path. The queue lock protects the incoming and outgoing queues, which
+ * are shared with the ioctls.
+ */
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include "iio_core.h"
+#include "block_buf.h"
+
+#define IIO_BLOCK_BUF_MAX_BLOCKS	64
+#define IIO_BLOCK_BUF_MAX_SIZE		(4 * 1024 * 1024)
+
+enum iio_block_state {
+	IIO_BLOCK_STATE_DEQUEUED,	/* owned by userspace */
+	IIO_BLOCK_STATE_QUEUED,		/* waiting to be filled */
+	IIO_BLOCK_STATE_ACTIVE,		/* being filled */
+	IIO_BLOCK_STATE_DONE,		/* full, waiting to be dequeued */
+};
+
+struct iio_block {
+	struct list_head head;
+	void *vaddr;
+	u32 bytes_used;
+	enum iio_block_state state;
+};
+
+struct iio_block_buf {
+	struct iio_buffer buffer;
+	struct mutex lock;
+	spinlock_t queue_lock;
+	atomic_t mapped;
+	void *vaddr;
+	struct iio_block *blocks;
+	unsigned int num_blocks;
+	size_t block_size;
+	struct list_head incoming;
+	struct list_head outgoing;
+	struct iio_block *active;
+};
+
+static const struct iio_buffer_access_funcs block_access_funcs;
+
+#define iio_to_block_buf(r) container_of(r, struct iio_block_buf, buffer)
+
+bool iio_buffer_is_block(struct iio_buffer *r)
+{
+	return r->access == &block_access_funcs;
+}
+
+static void iio_block_buf_free_blocks(struct iio_block_buf *bb)
+{
+	INIT_LIST_HEAD(&bb->incoming);
+	INIT_LIST_HEAD(&bb->outgoing);
+	bb->active = NULL;
+	bb->num_blocks = 0;
+	bb->block_size = 0;
+	kfree(bb->blocks);
+	bb->blocks = NULL;
+	vfree(bb->vaddr);
+	bb->vaddr = NULL;
+}
+
+static int iio_block_buf_alloc_blocks(struct iio_block_buf *bb,
+				      struct iio_buffer_block_alloc_req *req)
+{
+	size_t size = PAGE_ALIGN(req->size);
+	unsigned int i;
+
+	if (req->type || !req->count || !size ||
+	    size > IIO_BLOCK_BUF_MAX_SIZE)
+		return -EINVAL;
+
+	if (bb->num_blocks || atomic_read(&bb->mapped))
+		return -EBUSY;
+
+	if (req->count > IIO_BLOCK_BUF_MAX_BLOCKS)
+		req->count = IIO_BLOCK_BUF_MAX_BLOCKS;
+
+	bb->blocks = kcalloc(req->count, sizeof(*bb->blocks), GFP_KERNEL);
+	if (!bb->blocks)
+		return -ENOMEM;
+
+	bb->vaddr = vmalloc_user(req->count * size);
+	if (!bb->vaddr) {
+		kfree(bb->blocks);
+		bb->blocks = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < req->count; i++) {
+		bb->blocks[i].vaddr = bb->vaddr + i * size;
+		bb->blocks[i].state = IIO_BLOCK_STATE_DEQUEUED;
+	}
+	bb->num_blocks = req->count;
+	bb->block_size = size;
+
+	req->size = size;
+	req->id = 0;
+
+	return 0;
+}
+
+static void iio_block_buf_to_user(struct iio_block_buf *bb,
+				  struct iio_block *block,
+				  struct iio_buffer_block *ublock)
+{
+	memset(ublock, 0, sizeof(*ublock));
+	ublock->id = block - bb->blocks;
+	ublock->size = bb->block_size;
+	ublock->bytes_used = block->bytes_used;
+	ublock->offset = ublock->id * bb->block_size;
+}
+
+static int iio_block_buf_enqueue(struct iio_block_buf *bb,
+				 struct iio_buffer_block *ublock)
+{
+	struct iio_block *block;
+
+	if (ublock->id >= bb->num_blocks)
+		return -EINVAL;
+
+	block = &bb->blocks[ublock->id];
+	if (block->state != IIO_BLOCK_STATE_DEQUEUED)
+		return -EINVAL;
+
+	spin_lock_irq(&bb->queue_lock);
+	block->bytes_used = 0;
+	block->state = IIO_BLOCK_STATE_QUEUED;
+	list_add_tail(&block->head, &bb->incoming);
+	spin_unlock_irq(&bb->queue_lock);
+
+	return 0;
+}
+
+static struct iio_block *iio_block_buf_pop_done(struct iio_block_buf *bb)
+{
+	struct iio_block *block = NULL;
+
+	spin_lock_irq(&bb->queue_lock);
+	if (!list_empty(&bb->outgoing)) {
+		block = list_first_entry(&bb->outgoing, struct iio_block, head);
+		list_del(&block->head);
+		block->state = IIO_BLOCK_STATE_DEQUEUED;
+	}
+	spin_unlock_irq(&bb->queue_lock);
+
+	return block;
+}
+
+static bool iio_block_buf_data_available(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+	unsigned long flags;
+	bool empty;
+
+	spin_lock_irqsave(&bb->queue_lock, flags);
+	empty = list_empty(&bb->outgoing);
+	spin_unlock_irqrestore(&bb->queue_lock, flags);
+
+	return !empty;
+}
+
+static int iio_block_buf_dequeue(struct iio_dev *indio_dev,
+				 struct file *filp,
+				 struct iio_buffer_block *ublock)
+{
+	struct iio_buffer *r = indio_dev->buffer;
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+	struct iio_block *block;
+	int ret;
+
+	for (;;) {
+		mutex_lock(&bb->lock);
+		block = iio_block_buf_pop_done(bb);
+		if (block)
+			iio_block_buf_to_user(bb, block, ublock);
+		mutex_unlock(&bb->lock);
+		if (block)
+			return 0;
+
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(r->pollq,
+				iio_block_buf_data_available(r) ||
+				indio_dev->info == NULL);
+		if (ret)
+			return ret;
+		if (indio_dev->info == NULL)
+			return -ENODEV;
+	}
+}
+
+/* Returns where the next scan goes, or NULL when no block is queued */
+void *iio_block_buffer_claim(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+	unsigned long flags;
+
+	if (!bb->active) {
+		spin_lock_irqsave(&bb->queue_lock, flags);
+		if (!list_empty(&bb->incoming)) {
+			bb->active = list_first_entry(&bb->incoming,
+						      struct iio_block, head);
+			list_del(&bb->active->head);
+			bb->active->state = IIO_BLOCK_STATE_ACTIVE;
+		}
+		spin_unlock_irqrestore(&bb->queue_lock, flags);
+		if (!bb->active)
+			return NULL;
+	}
+
+	return bb->active->vaddr + bb->active->bytes_used;
+}
+
+static void iio_block_buf_done(struct iio_block_buf *bb)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bb->queue_lock, flags);
+	bb->active->state = IIO_BLOCK_STATE_DONE;
+	list_add_tail(&bb->active->head, &bb->outgoing);
+	spin_unlock_irqrestore(&bb->queue_lock, flags);
+	bb->active = NULL;
+
+	wake_up_interruptible_poll(&bb->buffer.pollq, POLLIN | POLLRDNORM);
+}
+
+/* Accounts for the scan written at the place returned by claim */
+void iio_block_buffer_commit(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+
+	bb->active->bytes_used += r->bytes_per_datum;
+	if (bb->active->bytes_used + r->bytes_per_datum > bb->block_size)
+		iio_block_buf_done(bb);
+}
+
+/*
+ * Hands the partially filled block back to userspace. Called once the buffer
+ * is disabled, when nothing pushes anymore.
+ */
+void iio_block_buffer_flush(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+	unsigned long flags;
+
+	if (!bb->active)
+		return;
+
+	if (bb->active->bytes_used) {
+		iio_block_buf_done(bb);
+		return;
+	}
+
+	spin_lock_irqsave(&bb->queue_lock, flags);
+	bb->active->state = IIO_BLOCK_STATE_QUEUED;
+	list_add(&bb->active->head, &bb->incoming);
+	spin_unlock_irqrestore(&bb->queue_lock, flags);
+	bb->active = NULL;
+}
+
+static int iio_store_to_block_buf(struct iio_buffer *r, const void *data)
+{
+	void *slot;
+
+	slot = iio_block_buffer_claim(r);
+	if (!slot)
+		return -EBUSY;
+
+	memcpy(slot, data, r->bytes_per_datum);
+	iio_block_buffer_commit(r);
+
+	return 0;
+}
+
+static int iio_request_update_block_buf(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+	int ret = 0;
+
+	mutex_lock(&bb->lock);
+	if (!bb->num_blocks || !r->bytes_per_datum ||
+	    r->bytes_per_datum > bb->block_size)
+		ret = -EINVAL;
+	mutex_unlock(&bb->lock);
+
+	return ret;
+}
+
+static int iio_get_bytes_per_datum_block_buf(struct iio_buffer *r)
+{
+	return r->bytes_per_datum;
+}
+
+static int iio_set_bytes_per_datum_block_buf(struct iio_buffer *r, size_t bpd)
+{
+	r->bytes_per_datum = bpd;
+	return 0;
+}
+
+static int iio_get_length_block_buf(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+
+	if (!r->bytes_per_datum)
+		return 0;
+
+	return bb->num_blocks * (bb->block_size / r->bytes_per_datum);
+}
+
+static void iio_block_buffer_release(struct iio_buffer *r)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+
+	iio_block_buf_free_blocks(bb);
+	mutex_destroy(&bb->lock);
+	kfree(bb);
+}
+
+static void iio_block_buf_vm_open(struct vm_area_struct *vma)
+{
+	struct iio_block_buf *bb = vma->vm_private_data;
+
+	atomic_inc(&bb->mapped);
+	iio_buffer_get(&bb->buffer);
+}
+
+static void iio_block_buf_vm_close(struct vm_area_struct *vma)
+{
+	struct iio_block_buf *bb = vma->vm_private_data;
+
+	atomic_dec(&bb->mapped);
+	iio_buffer_put(&bb->buffer);
+}
+
+static const struct vm_operations_struct iio_block_buf_vm_ops = {
+	.open = iio_block_buf_vm_open,
+	.close = iio_block_buf_vm_close,
+};
+
+int iio_block_buffer_mmap(struct iio_buffer *r, struct vm_area_struct *vma)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(r);
+	int ret;
+
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	mutex_lock(&bb->lock);
+	if (!bb->num_blocks) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/* Checks that the mapping lies within the blocks */
+	ret = remap_vmalloc_range(vma, bb->vaddr, vma->vm_pgoff);
+	if (ret)
+		goto out_unlock;
+
+	vma->vm_ops = &iio_block_buf_vm_ops;
+	vma->vm_private_data = bb;
+	iio_block_buf_vm_open(vma);
+
+out_unlock:
+	mutex_unlock(&bb->lock);
+	return ret;
+}
+
+long iio_block_buffer_ioctl(struct iio_dev *indio_dev, struct file *filp,
+			    unsigned int cmd, unsigned long arg)
+{
+	struct iio_block_buf *bb = iio_to_block_buf(indio_dev->buffer);
+	struct iio_buffer_block_alloc_req req;
+	struct iio_buffer_block ublock;
+	void __user *argp = (void __user *)arg;
+	int ret;
+
+	switch (cmd) {
+	case IIO_BLOCK_ALLOC_IOCTL:
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+
+		mutex_lock(&indio_dev->mlock);
+		mutex_lock(&bb->lock);
+		if (!list_empty(&bb->buffer.buffer_list))
+			ret = -EBUSY;
+		else
+			ret = iio_block_buf_alloc_blocks(bb, &req);
+		mutex_unlock(&bb->lock);
+		mutex_unlock(&indio_dev->mlock);
+		if (ret)
+			return ret;
+
+		if (copy_to_user(argp, &req, sizeof(req)))
+			return -EFAULT;
+		return 0;
+
+	case IIO_BLOCK_FREE_IOCTL:
+		mutex_lock(&indio_dev->mlock);
+		mutex_lock(&bb->lock);
+		if (!list_empty(&bb->buffer.buffer_list) ||
+		    atomic_read(&bb->mapped)) {
+			ret = -EBUSY;
+		} else {
+			iio_block_buf_free_blocks(bb);
+			ret = 0;
+		}
+		mutex_unlock(&bb->lock);
+		mutex_unlock(&indio_dev->mlock);
+		return ret;
+
+	case IIO_BLOCK_QUERY_IOCTL:
+	case IIO_BLOCK_ENQUEUE_IOCTL:
+		if (copy_from_user(&ublock, argp, sizeof(ublock)))
+			return -EFAULT;
+
+		mutex_lock(&bb->lock);
+		if (ublock.id >= bb->num_blocks)
+			ret = -EINVAL;
+		else if (cmd == IIO_BLOCK_ENQUEUE_IOCTL)
+			ret = iio_block_buf_enqueue(bb, &ublock);
+		else
+			ret = 0;
+		if (!ret)
+			iio_block_buf_to_user(bb, &bb->blocks[ublock.id],
+					      &ublock);
+		mutex_unlock(&bb->lock);
+		if (ret)
+			return ret;
+
+		if (copy_to_user(argp, &ublock, sizeof(ublock)))
+			return -EFAULT;
+		return 0;
+
+	case IIO_BLOCK_DEQUEUE_IOCTL:
+		ret = iio_block_buf_dequeue(indio_dev, filp, &ublock);
+		if (ret)
+			return ret;
+
+		if (copy_to_user(argp, &ublock, sizeof(ublock)))
+			return -EFAULT;
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static IIO_BUFFER_ENABLE_ATTR;
+static IIO_BUFFER_LENGTH_ATTR;
+
+static struct attribute *iio_block_buf_attributes[] = {
+	&dev_attr_length.attr,
+	&dev_attr_enable.attr,
+	NULL,
+};
+
+static struct attribute_group iio_block_buf_attribute_group = {
+	.attrs = iio_block_buf_attributes,
+	.name = "buffer",
+};
+
+static const struct iio_buffer_access_funcs block_access_funcs = {
+	.store_to = &iio_store_to_block_buf,
+	.data_available = iio_block_buf_data_available,
+	.request_update = &iio_request_update_block_buf,
+	.get_bytes_per_datum = &iio_get_bytes_per_datum_block_buf,
+	.set_bytes_per_datum = &iio_set_bytes_per_datum_block_buf,
+	.get_length = &iio_get_length_block_buf,
+	.release = &iio_block_buffer_release,
+};
+
+struct iio_buffer *iio_block_buffer_allocate(struct iio_dev *indio_dev)
+{
+	struct iio_block_buf *bb;
+
+	bb = kzalloc(sizeof(*bb), GFP_KERNEL);
+	if (!bb)
+		return NULL;
+	iio_buffer_init(&bb->buffer);
+	bb->buffer.attrs = &iio_block_buf_attribute_group;
+	bb->buffer.access = &block_access_funcs;
+	mutex_init(&bb->lock);
+	spin_lock_init(&bb->queue_lock);
+	INIT_LIST_HEAD(&bb->incoming);
+	INIT_LIST_HEAD(&bb->outgoing);
+	return &bb->buffer;
+}
+EXPORT_SYMBOL(iio_block_buffer_allocate);
+
+void iio_block_buffer_free(struct iio_buffer *r)
+{
+	iio_buffer_put(r);
+}
+EXPORT_SYMBOL(iio_block_buffer_free);
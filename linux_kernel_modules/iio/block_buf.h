@@ -0,0 +1,85 @@
+/* The industrial I/O block buffer
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * A block buffer is a ring of fixed-size, memory-mapped blocks. Userspace
+ * allocates the blocks, maps them and queues them to the device; the device
+ * fills queued blocks with scans and hands them back once full. Scans are
+ * consumed in place, nothing is copied to userspace.
+ *
+ *	IIO_BLOCK_ALLOC_IOCTL		allocate the blocks (buffer disabled)
+ *	IIO_BLOCK_QUERY_IOCTL		get the mmap offset of a block
+ *	IIO_BLOCK_ENQUEUE_IOCTL		give a block to the device to fill
+ *	IIO_BLOCK_DEQUEUE_IOCTL		take the oldest full block back
+ *	IIO_BLOCK_FREE_IOCTL		free all blocks (buffer disabled)
+ *
+ * poll() reports POLLIN while a full block is waiting to be dequeued.
+ */
+
+#ifndef _IIO_BLOCK_BUF_H_
+#define _IIO_BLOCK_BUF_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct iio_buffer_block_alloc_req - block allocation request
+ * @type:	reserved, must be 0
+ * @size:	size of each block in bytes, rounded up to a page multiple
+ * @count:	number of blocks, updated with the number allocated
+ * @id:		set to the id of the first block
+ */
+struct iio_buffer_block_alloc_req {
+	__u32 type;
+	__u32 size;
+	__u32 count;
+	__u32 id;
+};
+
+/**
+ * struct iio_buffer_block - description of a block
+ * @id:		block id, in the range of the allocation request
+ * @size:	size of the block in bytes
+ * @bytes_used:	number of bytes filled with scans
+ * @type:	reserved, must be 0
+ * @flags:	reserved, must be 0
+ * @offset:	offset to pass to mmap() to map this block
+ * @reserved:	reserved, must be 0
+ */
+struct iio_buffer_block {
+	__u32 id;
+	__u32 size;
+	__u32 bytes_used;
+	__u32 type;
+	__u32 flags;
+	__u32 offset;
+	__u64 reserved;
+};
+
+#define IIO_BLOCK_ALLOC_IOCTL	_IOWR('i', 0xa0, struct iio_buffer_block_alloc_req)
+#define IIO_BLOCK_FREE_IOCTL	_IO('i', 0xa1)
+#define IIO_BLOCK_QUERY_IOCTL	_IOWR('i', 0xa2, struct iio_buffer_block)
+#define IIO_BLOCK_ENQUEUE_IOCTL	_IOWR('i', 0xa3, struct iio_buffer_block)
+#define IIO_BLOCK_DEQUEUE_IOCTL	_IOWR('i', 0xa4, struct iio_buffer_block)
+
+#ifdef __KERNEL__
+
+#include <linux/irqreturn.h>
+
+struct iio_dev;
+struct iio_buffer;
+struct iio_buffer_setup_ops;
+
+struct iio_buffer *iio_block_buffer_allocate(struct iio_dev *indio_dev);
+void iio_block_buffer_free(struct iio_buffer *r);
+
+int iio_triggered_block_buffer_setup(struct iio_dev *indio_dev,
+	irqreturn_t (*pollfunc_bh)(int irq, void *p),
+	irqreturn_t (*pollfunc_th)(int irq, void *p),
+	const struct iio_buffer_setup_ops *setup_ops);
+
+#endif /* __KERNEL__ */
+
+#endif /* _IIO_BLOCK_BUF_H_ */
@@ -0,0 +1,85 @@
+/* The industrial I/O multi-scan push
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * Pushing a batch of scans, typically drained from a hardware FIFO, in one
+ * call. CONFIG_IIO_BUFFER_PUSH_N is defined when building against the IIO
+ * core in this directory; other IIO cores get an equivalent loop over
+ * iio_push_to_buffers().
+ */
+
+#ifndef _IIO_BUFFER_N_H_
+#define _IIO_BUFFER_N_H_
+
+#include <linux/list.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+
+#ifdef CONFIG_IIO_BUFFER_PUSH_N
+
+/**
+ * struct iio_buffer_bulk_funcs - bulk store of a buffer type
+ * @access:	access functions identifying the buffer type
+ * @store_n:	store @n datums of bytes_per_datum bytes, found @stride
+ *		bytes apart from @data
+ * @l:		entry in the list of registered bulk functions
+ */
+struct iio_buffer_bulk_funcs {
+	const struct iio_buffer_access_funcs *access;
+	int (*store_n)(struct iio_buffer *buffer, const void *data,
+		       unsigned int n, size_t stride);
+	struct list_head l;
+};
+
+void iio_buffer_register_bulk_funcs(struct iio_buffer_bulk_funcs *funcs);
+void iio_buffer_unregister_bulk_funcs(struct iio_buffer_bulk_funcs *funcs);
+
+int iio_push_to_buffers_n(struct iio_dev *indio_dev, const void *data,
+			  unsigned int n);
+
+#else
+
+static inline int iio_push_to_buffers_n(struct iio_dev *indio_dev,
+					const void *data, unsigned int n)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n; i++) {
+		ret = iio_push_to_buffers(indio_dev,
+					  data + i * indio_dev->scan_bytes);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+#endif /* CONFIG_IIO_BUFFER_PUSH_N */
+
+/**
+ * iio_push_to_buffers_with_timestamps_n() - push scans with their timestamps
+ * @indio_dev: IIO device
+ * @data: @n scans laid out back to back, indio_dev->scan_bytes apart, each
+ *	with room for its timestamp as for iio_push_to_buffers_with_timestamp()
+ * @timestamps: one timestamp per scan
+ * @n: number of scans
+ */
+static inline int iio_push_to_buffers_with_timestamps_n(
+	struct iio_dev *indio_dev, void *data, const s64 *timestamps,
+	unsigned int n)
+{
+	unsigned int i;
+
+	if (indio_dev->scan_timestamp) {
+		for (i = 0; i < n; i++)
+			((s64 *)(data + (i + 1) * indio_dev->scan_bytes))[-1] =
+				timestamps[i];
+	}
+
+	return iio_push_to_buffers_n(indio_dev, data, n);
+}
+
+#endif /* _IIO_BUFFER_N_H_ */
@@ -42,27 +42,50 @@ ssize_t iio_format_value(char *buf, unsigned int type, int val, int val2);
 
 #ifdef CONFIG_IIO_BUFFER
 struct poll_table_struct;
+struct vm_area_struct;
+struct iio_buffer;
 
 unsigned int iio_buffer_poll(struct file *filp,
 			     struct poll_table_struct *wait);
 ssize_t iio_buffer_read_first_n_outer(struct file *filp, char __user *buf,
 				      size_t n, loff_t *f_ps);
+int iio_buffer_mmap(struct file *filp, struct vm_area_struct *vma);
+long iio_buffer_ioctl(struct iio_dev *indio_dev, struct file *filp,
+		      unsigned int cmd, unsigned long arg);
 
 
 #define iio_buffer_poll_addr (&iio_buffer_poll)
 #define iio_buffer_read_first_n_outer_addr (&iio_buffer_read_first_n_outer)
+#define iio_buffer_mmap_addr (&iio_buffer_mmap)
 
 void iio_disable_all_buffers(struct iio_dev *indio_dev);
 void iio_buffer_wakeup_poll(struct iio_dev *indio_dev);
 
+/* Block buffer, block_buf.c */
+bool iio_buffer_is_block(struct iio_buffer *r);
+void *iio_block_buffer_claim(struct iio_buffer *r);
+void iio_block_buffer_commit(struct iio_buffer *r);
+void iio_block_buffer_flush(struct iio_buffer *r);
+int iio_block_buffer_mmap(struct iio_buffer *r, struct vm_area_struct *vma);
+long iio_block_buffer_ioctl(struct iio_dev *indio_dev, struct file *filp,
+			    unsigned int cmd, unsigned long arg);
+
 #else
 
 #define iio_buffer_poll_addr NULL
 #define iio_buffer_read_first_n_outer_addr NULL
+#define iio_buffer_mmap_addr NULL
 
 static inline void iio_disable_all_buffers(struct iio_dev *indio_dev) {}
 static inline void iio_buffer_wakeup_poll(struct iio_dev *indio_dev) {}
 
+static inline long iio_buffer_ioctl(struct iio_dev *indio_dev,
+				    struct file *filp, unsigned int cmd,
+				    unsigned long arg)
+{
+	return -EINVAL;
+}
+
 #endif
 
 int iio_device_register_eventset(struct iio_dev *indio_dev);
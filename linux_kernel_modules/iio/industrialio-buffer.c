@@ -21,11 +21,20 @@
 #include <linux/slab.h>
 #include <linux/poll.h>
 #include <linux/sched.h>
+#include <linux/rculist.h>
+#include <linux/mutex.h>
 
 #include <linux/iio/iio.h>
 #include "iio_core.h"
 #include <linux/iio/sysfs.h>
 #include <linux/iio/buffer.h>
+#include "buffer_n.h"
+
+/* Scans demuxed at once by iio_push_to_buffers_n(), sizes the bounce buffer */
+#define IIO_DEMUX_BATCH		16
+
+static LIST_HEAD(iio_buffer_bulk_list);
+static DEFINE_MUTEX(iio_buffer_bulk_lock);
 
 static const char * const iio_endian_prefix[] = {
 	[IIO_BE] = "be",
@@ -65,10 +74,12 @@ ssize_t iio_buffer_read_first_n_outer(struct file *filp, char __user *buf,
 		return -EINVAL;
 
 	do {
-		if (!iio_buffer_data_available(rb)) {
-			if (filp->f_flags & O_NONBLOCK)
-				return -EAGAIN;
-
+		/*
+		 * Non-blocking readers take whatever is queued, blocking ones
+		 * wait for the buffer to report data, i.e. for its watermark.
+		 */
+		if (!(filp->f_flags & O_NONBLOCK) &&
+		    !iio_buffer_data_available(rb)) {
 			ret = wait_event_interruptible(rb->pollq,
 					iio_buffer_data_available(rb) ||
 					indio_dev->info == NULL);
@@ -105,6 +116,37 @@ unsigned int iio_buffer_poll(struct file *filp,
 	return 0;
 }
 
+/**
+ * iio_buffer_mmap() - map the blocks of a block buffer
+ */
+int iio_buffer_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct iio_dev *indio_dev = filp->private_data;
+	struct iio_buffer *rb = indio_dev->buffer;
+
+	if (!indio_dev->info)
+		return -ENODEV;
+
+	if (!rb || !iio_buffer_is_block(rb))
+		return -EINVAL;
+
+	return iio_block_buffer_mmap(rb, vma);
+}
+
+/**
+ * iio_buffer_ioctl() - buffer ioctls, only block buffers have any
+ */
+long iio_buffer_ioctl(struct iio_dev *indio_dev, struct file *filp,
+		      unsigned int cmd, unsigned long arg)
+{
+	struct iio_buffer *rb = indio_dev->buffer;
+
+	if (!rb || !iio_buffer_is_block(rb))
+		return -EINVAL;
+
+	return iio_block_buffer_ioctl(indio_dev, filp, cmd, arg);
+}
+
 /**
  * iio_buffer_wakeup_poll - Wakes up the buffer waitqueue
  * @indio_dev: The IIO device
@@ -500,6 +542,10 @@ static void iio_buffer_activate(struct iio_dev *indio_dev,
 static void iio_buffer_deactivate(struct iio_buffer *buffer)
 {
 	list_del_init(&buffer->buffer_list);
+	if (iio_buffer_is_block(buffer))
+		iio_block_buffer_flush(buffer);
+	/* Let readers flush data left below the watermark */
+	wake_up_interruptible_poll(&buffer->pollq, POLLIN | POLLRDNORM);
 	iio_buffer_put(buffer);
 }
 
@@ -886,23 +932,41 @@ struct iio_demux_table {
 	struct list_head l;
 };
 
-static const void *iio_demux(struct iio_buffer *buffer,
-				 const void *datain)
+static void iio_demux_to(struct iio_buffer *buffer, void *dataout,
+			 const void *datain)
 {
 	struct iio_demux_table *t;
 
+	list_for_each_entry(t, &buffer->demux_list, l)
+		memcpy(dataout + t->to, datain + t->from, t->length);
+}
+
+static const void *iio_demux(struct iio_buffer *buffer,
+				 const void *datain)
+{
 	if (list_empty(&buffer->demux_list))
 		return datain;
-	list_for_each_entry(t, &buffer->demux_list, l)
-		memcpy(buffer->demux_bounce + t->to,
-		       datain + t->from, t->length);
+	iio_demux_to(buffer, buffer->demux_bounce, datain);
 
 	return buffer->demux_bounce;
 }
 
 static int iio_push_to_buffer(struct iio_buffer *buffer, const void *data)
 {
-	const void *dataout = iio_demux(buffer, data);
+	const void *dataout;
+	void *slot;
+
+	/* Block buffers take the demuxed scan in place, no bounce needed */
+	if (iio_buffer_is_block(buffer) && !list_empty(&buffer->demux_list)) {
+		slot = iio_block_buffer_claim(buffer);
+		if (!slot)
+			return -EBUSY;
+		iio_demux_to(buffer, slot, data);
+		iio_block_buffer_commit(buffer);
+		return 0;
+	}
+
+	dataout = iio_demux(buffer, data);
 
 	return buffer->access->store_to(buffer, dataout);
 }
@@ -932,13 +996,159 @@ int iio_push_to_buffers(struct iio_dev *indio_dev, const void *data)
 }
 EXPORT_SYMBOL_GPL(iio_push_to_buffers);
 
+/**
+ * iio_buffer_register_bulk_funcs() - announce a bulk store for a buffer type
+ * @funcs: bulk functions, keyed by the access functions of the buffer type
+ *
+ * Buffer types without bulk functions get one store_to() per datum from
+ * iio_push_to_buffers_n().
+ */
+void iio_buffer_register_bulk_funcs(struct iio_buffer_bulk_funcs *funcs)
+{
+	mutex_lock(&iio_buffer_bulk_lock);
+	list_add_rcu(&funcs->l, &iio_buffer_bulk_list);
+	mutex_unlock(&iio_buffer_bulk_lock);
+}
+EXPORT_SYMBOL_GPL(iio_buffer_register_bulk_funcs);
+
+void iio_buffer_unregister_bulk_funcs(struct iio_buffer_bulk_funcs *funcs)
+{
+	mutex_lock(&iio_buffer_bulk_lock);
+	list_del_rcu(&funcs->l);
+	mutex_unlock(&iio_buffer_bulk_lock);
+	synchronize_rcu();
+}
+EXPORT_SYMBOL_GPL(iio_buffer_unregister_bulk_funcs);
+
+static int iio_store_n_to_buffer(struct iio_buffer *buffer, const void *data,
+				 unsigned int n, size_t stride)
+{
+	struct iio_buffer_bulk_funcs *funcs;
+	unsigned int i;
+	int ret = -ENOENT;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(funcs, &iio_buffer_bulk_list, l) {
+		if (funcs->access == buffer->access) {
+			ret = funcs->store_n(buffer, data, n, stride);
+			break;
+		}
+	}
+	rcu_read_unlock();
+	if (ret != -ENOENT)
+		return ret;
+
+	for (i = 0; i < n; i++) {
+		ret = buffer->access->store_to(buffer, data + i * stride);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int iio_push_n_to_buffer(struct iio_buffer *buffer, const void *data,
+				unsigned int n, size_t scan_bytes)
+{
+	unsigned int i, j, batch;
+	int ret;
+
+	if (list_empty(&buffer->demux_list))
+		return iio_store_n_to_buffer(buffer, data, n, scan_bytes);
+
+	/* Block buffers demux in place, see iio_push_to_buffer() */
+	if (iio_buffer_is_block(buffer)) {
+		for (i = 0; i < n; i++) {
+			ret = iio_push_to_buffer(buffer,
+						 data + i * scan_bytes);
+			if (ret < 0)
+				return ret;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < n; i += batch) {
+		batch = min_t(unsigned int, n - i, IIO_DEMUX_BATCH);
+		for (j = 0; j < batch; j++)
+			iio_demux_to(buffer, buffer->demux_bounce +
+				     j * buffer->bytes_per_datum,
+				     data + (i + j) * scan_bytes);
+		ret = iio_store_n_to_buffer(buffer, buffer->demux_bounce,
+					    batch, buffer->bytes_per_datum);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * iio_push_to_buffers_n() - push several scans to all enabled buffers
+ * @indio_dev: IIO device
+ * @data: @n scans laid out back to back, indio_dev->scan_bytes apart
+ * @n: number of scans
+ *
+ * Same as calling iio_push_to_buffers() for every scan, but each buffer is
+ * visited once: scans are demuxed in batches and stored in bulk when the
+ * buffer type supports it.
+ */
+int iio_push_to_buffers_n(struct iio_dev *indio_dev, const void *data,
+			  unsigned int n)
+{
+	struct iio_buffer *buf;
+	int ret;
+
+	/* The common case: one buffer wanting the scans as they are */
+	if (list_is_singular(&indio_dev->buffer_list)) {
+		buf = list_first_entry(&indio_dev->buffer_list,
+				       struct iio_buffer, buffer_list);
+		if (list_empty(&buf->demux_list))
+			return iio_store_n_to_buffer(buf, data, n,
+						     indio_dev->scan_bytes);
+	}
+
+	list_for_each_entry(buf, &indio_dev->buffer_list, buffer_list) {
+		ret = iio_push_n_to_buffer(buf, data, n, indio_dev->scan_bytes);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(iio_push_to_buffers_n);
+
+/*
+ * Appends a copy to the demux table, or extends the last copy when the new one
+ * picks up where it left off in both the input and the output.
+ */
+static int iio_buffer_add_demux(struct iio_buffer *buffer,
+				struct iio_demux_table **p, unsigned in_loc,
+				unsigned out_loc, unsigned length)
+{
+	if (*p && (*p)->from + (*p)->length == in_loc &&
+	    (*p)->to + (*p)->length == out_loc) {
+		(*p)->length += length;
+		return 0;
+	}
+
+	*p = kmalloc(sizeof(**p), GFP_KERNEL);
+	if (*p == NULL)
+		return -ENOMEM;
+	(*p)->from = in_loc;
+	(*p)->to = out_loc;
+	(*p)->length = length;
+	list_add_tail(&(*p)->l, &buffer->demux_list);
+
+	return 0;
+}
+
 static int iio_buffer_update_demux(struct iio_dev *indio_dev,
 				   struct iio_buffer *buffer)
 {
 	const struct iio_chan_spec *ch;
 	int ret, in_ind = -1, out_ind, length;
 	unsigned in_loc = 0, out_loc = 0;
-	struct iio_demux_table *p;
+	struct iio_demux_table *p = NULL;
 
 	/* Clear out any old demux */
 	iio_buffer_demux_free(buffer);
@@ -969,31 +1179,20 @@ static int iio_buffer_update_demux(struct iio_dev *indio_dev,
 			if (in_loc % length)
 				in_loc += length - in_loc % length;
 		}
-		p = kmalloc(sizeof(*p), GFP_KERNEL);
-		if (p == NULL) {
-			ret = -ENOMEM;
-			goto error_clear_mux_table;
-		}
 		ch = iio_find_channel_from_si(indio_dev, in_ind);
 		length = ch->scan_type.storagebits/8;
 		if (out_loc % length)
 			out_loc += length - out_loc % length;
 		if (in_loc % length)
 			in_loc += length - in_loc % length;
-		p->from = in_loc;
-		p->to = out_loc;
-		p->length = length;
-		list_add_tail(&p->l, &buffer->demux_list);
+		ret = iio_buffer_add_demux(buffer, &p, in_loc, out_loc, length);
+		if (ret)
+			goto error_clear_mux_table;
 		out_loc += length;
 		in_loc += length;
 	}
 	/* Relies on scan_timestamp being last */
 	if (buffer->scan_timestamp) {
-		p = kmalloc(sizeof(*p), GFP_KERNEL);
-		if (p == NULL) {
-			ret = -ENOMEM;
-			goto error_clear_mux_table;
-		}
 		ch = iio_find_channel_from_si(indio_dev,
 			indio_dev->scan_index_timestamp);
 		length = ch->scan_type.storagebits/8;
@@ -1001,14 +1200,25 @@ static int iio_buffer_update_demux(struct iio_dev *indio_dev,
 			out_loc += length - out_loc % length;
 		if (in_loc % length)
 			in_loc += length - in_loc % length;
-		p->from = in_loc;
-		p->to = out_loc;
-		p->length = length;
-		list_add_tail(&p->l, &buffer->demux_list);
+		ret = iio_buffer_add_demux(buffer, &p, in_loc, out_loc, length);
+		if (ret)
+			goto error_clear_mux_table;
 		out_loc += length;
 		in_loc += length;
 	}
-	buffer->demux_bounce = kzalloc(out_loc, GFP_KERNEL);
+
+	/*
+	 * A single copy from the start means the buffer wants a prefix of the
+	 * device scan: push the scan as is, the buffer only stores its datum
+	 * size of it.
+	 */
+	if (p && p->from == 0 && p->to == 0 &&
+	    list_is_singular(&buffer->demux_list)) {
+		iio_buffer_demux_free(buffer);
+		return 0;
+	}
+
+	buffer->demux_bounce = kcalloc(IIO_DEMUX_BATCH, out_loc, GFP_KERNEL);
 	if (buffer->demux_bounce == NULL) {
 		ret = -ENOMEM;
 		goto error_clear_mux_table;
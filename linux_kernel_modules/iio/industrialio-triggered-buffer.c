@@ -15,41 +15,21 @@
 #include <linux/iio/kfifo_buf.h>
 #include <linux/iio/triggered_buffer.h>
 #include <linux/iio/trigger_consumer.h>
+#include "block_buf.h"
 
 static const struct iio_buffer_setup_ops iio_triggered_buffer_setup_ops = {
 	.postenable = &iio_triggered_buffer_postenable,
 	.predisable = &iio_triggered_buffer_predisable,
 };
 
-/**
- * iio_triggered_buffer_setup() - Setup triggered buffer and pollfunc
- * @indio_dev:		IIO device structure
- * @pollfunc_bh:	Function which will be used as pollfunc bottom half
- * @pollfunc_th:	Function which will be used as pollfunc top half
- * @setup_ops:		Buffer setup functions to use for this device.
- *			If NULL the default setup functions for triggered
- *			buffers will be used.
- *
- * This function combines some common tasks which will normally be performed
- * when setting up a triggered buffer. It will allocate the buffer and the
- * pollfunc, as well as register the buffer with the IIO core.
- *
- * Before calling this function the indio_dev structure should already be
- * completely initialized, but not yet registered. In practice this means that
- * this function should be called right before iio_device_register().
- *
- * To free the resources allocated by this function call
- * iio_triggered_buffer_cleanup().
- */
-int iio_triggered_buffer_setup(struct iio_dev *indio_dev,
+static int __iio_triggered_buffer_setup(struct iio_dev *indio_dev,
+	struct iio_buffer *buffer,
 	irqreturn_t (*pollfunc_bh)(int irq, void *p),
 	irqreturn_t (*pollfunc_th)(int irq, void *p),
 	const struct iio_buffer_setup_ops *setup_ops)
 {
-	struct iio_buffer *buffer;
 	int ret;
 
-	buffer = iio_kfifo_allocate(indio_dev);
 	if (!buffer) {
 		ret = -ENOMEM;
 		goto error_ret;
@@ -66,7 +46,7 @@ int iio_triggered_buffer_setup(struct iio_dev *indio_dev,
 						 indio_dev->id);
 	if (indio_dev->pollfunc == NULL) {
 		ret = -ENOMEM;
-		goto error_kfifo_free;
+		goto error_buffer_free;
 	}
 
 	/* Ring buffer functions - here trigger setup related */
@@ -88,13 +68,68 @@ int iio_triggered_buffer_setup(struct iio_dev *indio_dev,
 
 error_dealloc_pollfunc:
 	iio_dealloc_pollfunc(indio_dev->pollfunc);
-error_kfifo_free:
-	iio_kfifo_free(indio_dev->buffer);
+error_buffer_free:
+	iio_buffer_put(indio_dev->buffer);
 error_ret:
 	return ret;
 }
+
+/**
+ * iio_triggered_buffer_setup() - Setup triggered buffer and pollfunc
+ * @indio_dev:		IIO device structure
+ * @pollfunc_bh:	Function which will be used as pollfunc bottom half
+ * @pollfunc_th:	Function which will be used as pollfunc top half
+ * @setup_ops:		Buffer setup functions to use for this device.
+ *			If NULL the default setup functions for triggered
+ *			buffers will be used.
+ *
+ * This function combines some common tasks which will normally be performed
+ * when setting up a triggered buffer. It will allocate the buffer and the
+ * pollfunc, as well as register the buffer with the IIO core.
+ *
+ * Before calling this function the indio_dev structure should already be
+ * completely initialized, but not yet registered. In practice this means that
+ * this function should be called right before iio_device_register().
+ *
+ * To free the resources allocated by this function call
+ * iio_triggered_buffer_cleanup().
+ */
+int iio_triggered_buffer_setup(struct iio_dev *indio_dev,
+	irqreturn_t (*pollfunc_bh)(int irq, void *p),
+	irqreturn_t (*pollfunc_th)(int irq, void *p),
+	const struct iio_buffer_setup_ops *setup_ops)
+{
+	return __iio_triggered_buffer_setup(indio_dev,
+					    iio_kfifo_allocate(indio_dev),
+					    pollfunc_bh, pollfunc_th,
+					    setup_ops);
+}
 EXPORT_SYMBOL(iio_triggered_buffer_setup);
 
+/**
+ * iio_triggered_block_buffer_setup() - Setup triggered block buffer and pollfunc
+ * @indio_dev:		IIO device structure
+ * @pollfunc_bh:	Function which will be used as pollfunc bottom half
+ * @pollfunc_th:	Function which will be used as pollfunc top half
+ * @setup_ops:		Buffer setup functions to use for this device.
+ *			If NULL the default setup functions for triggered
+ *			buffers will be used.
+ *
+ * Same as iio_triggered_buffer_setup(), but the device gets a memory-mapped
+ * block buffer instead of a kfifo. Free with iio_triggered_buffer_cleanup().
+ */
+int iio_triggered_block_buffer_setup(struct iio_dev *indio_dev,
+	irqreturn_t (*pollfunc_bh)(int irq, void *p),
+	irqreturn_t (*pollfunc_th)(int irq, void *p),
+	const struct iio_buffer_setup_ops *setup_ops)
+{
+	return __iio_triggered_buffer_setup(indio_dev,
+					    iio_block_buffer_allocate(indio_dev),
+					    pollfunc_bh, pollfunc_th,
+					    setup_ops);
+}
+EXPORT_SYMBOL(iio_triggered_block_buffer_setup);
+
 /**
  * iio_triggered_buffer_cleanup() - Free resources allocated by iio_triggered_buffer_setup()
  * @indio_dev: IIO device structure
@@ -103,7 +138,8 @@ void iio_triggered_buffer_cleanup(struct iio_dev *indio_dev)
 {
 	iio_buffer_unregister(indio_dev);
 	iio_dealloc_pollfunc(indio_dev->pollfunc);
-	iio_kfifo_free(indio_dev->buffer);
+	/* Drops the kfifo or block buffer alike */
+	iio_buffer_put(indio_dev->buffer);
 }
 EXPORT_SYMBOL(iio_triggered_buffer_cleanup);
 
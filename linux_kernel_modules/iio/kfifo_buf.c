@@ -8,12 +8,15 @@
 #include <linux/iio/kfifo_buf.h>
 #include <linux/sched.h>
 #include <linux/poll.h>
+#include "buffer_n.h"
 
 struct iio_kfifo {
 	struct iio_buffer buffer;
 	struct kfifo kf;
 	struct mutex user_lock;
 	int update_needed;
+	/* Readers are woken once this many datums are queued */
+	unsigned int watermark;
 };
 
 #define iio_to_kfifo(r) container_of(r, struct iio_kfifo, buffer)
@@ -39,6 +42,8 @@ static int iio_request_update_kfifo(struct iio_buffer *r)
 		ret = __iio_allocate_kfifo(buf, buf->buffer.bytes_per_datum,
 				   buf->buffer.length);
 		buf->update_needed = false;
+		if (buf->watermark > buf->buffer.length)
+			buf->watermark = buf->buffer.length;
 	} else {
 		kfifo_reset_out(&buf->kf);
 	}
@@ -52,12 +57,54 @@ static int iio_get_length_kfifo(struct iio_buffer *r)
 	return r->length;
 }
 
+static ssize_t iio_kfifo_show_watermark(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct iio_kfifo *kf = iio_to_kfifo(indio_dev->buffer);
+
+	return sprintf(buf, "%u\n", kf->watermark);
+}
+
+static ssize_t iio_kfifo_store_watermark(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf,
+					 size_t len)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct iio_buffer *buffer = indio_dev->buffer;
+	struct iio_kfifo *kf = iio_to_kfifo(buffer);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+	if (!val)
+		return -EINVAL;
+
+	mutex_lock(&indio_dev->mlock);
+	if (!list_empty(&buffer->buffer_list))
+		ret = -EBUSY;
+	else if (val > buffer->length)
+		ret = -EINVAL;
+	else
+		kf->watermark = val;
+	mutex_unlock(&indio_dev->mlock);
+
+	return ret ? ret : len;
+}
+
 static IIO_BUFFER_ENABLE_ATTR;
 static IIO_BUFFER_LENGTH_ATTR;
+static DEVICE_ATTR(watermark, S_IRUGO | S_IWUSR, iio_kfifo_show_watermark,
+		   iio_kfifo_store_watermark);
 
 static struct attribute *iio_kfifo_attributes[] = {
 	&dev_attr_length.attr,
 	&dev_attr_enable.attr,
+	&dev_attr_watermark.attr,
 	NULL,
 };
 
@@ -108,11 +155,34 @@ static int iio_store_to_kfifo(struct iio_buffer *r,
 	if (ret != 1)
 		return -EBUSY;
 
-	wake_up_interruptible_poll(&r->pollq, POLLIN | POLLRDNORM);
+	/* Readers are not woken up before the watermark is reached */
+	if (kfifo_len(&kf->kf) >= kf->watermark)
+		wake_up_interruptible_poll(&r->pollq, POLLIN | POLLRDNORM);
 
 	return 0;
 }
 
+static int iio_store_n_to_kfifo(struct iio_buffer *r, const void *data,
+				unsigned int n, size_t stride)
+{
+	struct iio_kfifo *kf = iio_to_kfifo(r);
+	unsigned int ret;
+
+	if (stride == r->bytes_per_datum) {
+		ret = kfifo_in(&kf->kf, data, n);
+	} else {
+		for (ret = 0; ret < n; ret++)
+			if (kfifo_in(&kf->kf, data + ret * stride, 1) != 1)
+				break;
+	}
+
+	/* One wakeup for the whole batch */
+	if (ret && kfifo_len(&kf->kf) >= kf->watermark)
+		wake_up_interruptible_poll(&r->pollq, POLLIN | POLLRDNORM);
+
+	return ret == n ? 0 : -EBUSY;
+}
+
 static int iio_read_first_n_kfifo(struct iio_buffer *r,
 			   size_t n, char __user *buf)
 {
@@ -136,13 +206,17 @@ static int iio_read_first_n_kfifo(struct iio_buffer *r,
 static bool iio_kfifo_buf_data_available(struct iio_buffer *r)
 {
 	struct iio_kfifo *kf = iio_to_kfifo(r);
-	bool empty;
+	unsigned int len;
 
 	mutex_lock(&kf->user_lock);
-	empty = kfifo_is_empty(&kf->kf);
+	len = kfifo_len(&kf->kf);
 	mutex_unlock(&kf->user_lock);
 
-	return !empty;
+	/* Once the buffer is disabled whatever is left gets flushed out */
+	if (list_empty(&r->buffer_list))
+		return len != 0;
+
+	return len >= kf->watermark;
 }
 
 static void iio_kfifo_buffer_release(struct iio_buffer *buffer)
@@ -166,6 +240,11 @@ static const struct iio_buffer_access_funcs kfifo_access_funcs = {
 	.release = &iio_kfifo_buffer_release,
 };
 
+static struct iio_buffer_bulk_funcs kfifo_bulk_funcs = {
+	.access = &kfifo_access_funcs,
+	.store_n = &iio_store_n_to_kfifo,
+};
+
 struct iio_buffer *iio_kfifo_allocate(struct iio_dev *indio_dev)
 {
 	struct iio_kfifo *kf;
@@ -178,6 +257,7 @@ struct iio_buffer *iio_kfifo_allocate(struct iio_dev *indio_dev)
 	kf->buffer.attrs = &iio_kfifo_attribute_group;
 	kf->buffer.access = &kfifo_access_funcs;
 	kf->buffer.length = 2;
+	kf->watermark = 1;
 	mutex_init(&kf->user_lock);
 	return &kf->buffer;
 }
@@ -189,4 +269,17 @@ void iio_kfifo_free(struct iio_buffer *r)
 }
 EXPORT_SYMBOL(iio_kfifo_free);
 
+static int __init iio_kfifo_init(void)
+{
+	iio_buffer_register_bulk_funcs(&kfifo_bulk_funcs);
+	return 0;
+}
+module_init(iio_kfifo_init);
+
+static void __exit iio_kfifo_exit(void)
+{
+	iio_buffer_unregister_bulk_funcs(&kfifo_bulk_funcs);
+}
+module_exit(iio_kfifo_exit);
+
 MODULE_LICENSE("GPL");
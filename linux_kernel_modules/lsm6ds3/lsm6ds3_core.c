@@ -155,8 +155,6 @@
 
 /* CUSTOM VALUES FOR STEP COUNTER SENSOR */
 #define LSM6DS3_STEP_COUNTER_DRDY_IRQ_MASK	0x80
-#define LSM6DS3_STEP_COUNTER_OUT_L_ADDR		0x4b
-#define LSM6DS3_STEP_COUNTER_OUT_SIZE		2
 #define LSM6DS3_STEP_COUNTER_RES_ADDR		0x19
 #define LSM6DS3_STEP_COUNTER_RES_MASK		0x06
 #define LSM6DS3_STEP_COUNTER_RES_ALL_EN		0x03
@@ -176,6 +174,11 @@
 #define LSM6DS3_FIFO_BYTE_FOR_CHANNEL		2
 #define LSM6DS3_FIFO_DATA_OVR_2REGS		0x4000
 #define LSM6DS3_FIFO_DATA_OVR			0x40
+#define LSM6DS3_FIFO_STATUS_LEN			4
+#define LSM6DS3_FIFO_PATTERN_MASK		0x03ff
+#define LSM6DS3_FIFO_ELEMENT_WORDS		3
+#define LSM6DS3_FIFO_READ_MAX_ELEMENTS		(LSM6DS3_RX_MAX_LENGTH / \
+						 LSM6DS3_FIFO_ELEMENT_LEN_BYTE)
 
 #define LSM6DS3_STATUS_REG			0x1e
 #define LSM6DS3_SRC_FUNC_ADDR			0x53
@@ -290,6 +293,11 @@ static struct lsm6ds3_fs_table {
 
 static struct workqueue_struct *lsm6ds3_workqueue;
 
+static unsigned int fifo_watermark = 32;
+module_param(fifo_watermark, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fifo_watermark,
+		 "Samples of the fastest sensor queued per FIFO interrupt");
+
 static inline void lsm6ds3_flush_works(void)
 {
 	flush_workqueue(lsm6ds3_workqueue);
@@ -521,6 +529,284 @@ static int lsm6ds3_set_fs(struct lsm6ds3_sensor_data *sdata, u32 gain)
 	return 0;
 }
 
+/*
+ * Accel and gyro are streamed through the hardware FIFO whenever an interrupt
+ * line is available; the hrtimer poll is only used without one.
+ */
+static inline bool lsm6ds3_use_fifo(struct lsm6ds3_data *cdata)
+{
+	return cdata->irq > 0;
+}
+
+static u8 lsm6ds3_fifo_decimator(u32 factor)
+{
+	switch (factor) {
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+		return factor;
+	case 8:
+		return 5;
+	case 16:
+		return 6;
+	case 32:
+		return 7;
+	default:
+		return 0;
+	}
+}
+
+static int lsm6ds3_fifo_reset(struct lsm6ds3_data *cdata)
+{
+	int err;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_MODE_ADDR,
+					   LSM6DS3_FIFO_MODE_MASK,
+					   LSM6DS3_FIFO_MODE_BYPASS, true);
+	if (err < 0)
+		return err;
+
+	return lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_MODE_ADDR,
+					    LSM6DS3_FIFO_MODE_MASK,
+					    LSM6DS3_FIFO_MODE_CONTINUOS, true);
+}
+
+/*
+ * Reprogram the FIFO for the accel/gyro currently enabled. The FIFO runs at
+ * the fastest of the two ODRs and the slower sensor is decimated, which
+ * gives a repeating pattern of data sets: in each FIFO tick the gyro set
+ * comes first, then the accel set. Passing through bypass mode drops any
+ * data queued under the previous pattern.
+ */
+static int lsm6ds3_fifo_update(struct lsm6ds3_data *cdata)
+{
+	struct lsm6ds3_sensor_data *accel = &cdata->sensors[LSM6DS3_ACCEL];
+	struct lsm6ds3_sensor_data *gyro = &cdata->sensors[LSM6DS3_GYRO];
+	u32 acc_dec = 0, gyr_dec = 0, odr = 0;
+	unsigned int t, n = 0, thr;
+	int err, i;
+	u8 thr_l;
+
+	if (!lsm6ds3_use_fifo(cdata))
+		return 0;
+
+	mutex_lock(&cdata->lock);
+	cdata->fifo_enabled = false;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_MODE_ADDR,
+					   LSM6DS3_FIFO_MODE_MASK,
+					   LSM6DS3_FIFO_MODE_BYPASS, true);
+	if (err < 0)
+		goto unlock;
+
+	if (accel->enabled)
+		odr = accel->c_odr;
+	if (gyro->enabled)
+		odr = max(odr, gyro->c_odr);
+
+	if (!odr) {
+		err = lsm6ds3_write_data_with_mask(cdata,
+						   LSM6DS3_INT1_CTRL_ADDR,
+						   LSM6DS3_INT1_FTH,
+						   LSM6DS3_DIS_BIT, true);
+		goto unlock;
+	}
+
+	for (i = 0; i < LSM6DS3_ODR_LIST_NUM; i++)
+		if (lsm6ds3_odr_table.odr_avl[i].hz == odr)
+			break;
+	if (i == LSM6DS3_ODR_LIST_NUM) {
+		err = -EINVAL;
+		goto unlock;
+	}
+
+	cdata->fifo_ticks = 1;
+	if (gyro->enabled) {
+		gyr_dec = odr / gyro->c_odr;
+		cdata->fifo_ticks = max_t(u32, cdata->fifo_ticks, gyr_dec);
+	}
+	if (accel->enabled) {
+		acc_dec = odr / accel->c_odr;
+		cdata->fifo_ticks = max_t(u32, cdata->fifo_ticks, acc_dec);
+	}
+
+	for (t = 0; t < cdata->fifo_ticks; t++) {
+		if (gyr_dec && !(t % gyr_dec)) {
+			cdata->fifo_pattern[n].sindex = LSM6DS3_GYRO;
+			cdata->fifo_pattern[n++].tick = t;
+		}
+		if (acc_dec && !(t % acc_dec)) {
+			cdata->fifo_pattern[n].sindex = LSM6DS3_ACCEL;
+			cdata->fifo_pattern[n++].tick = t;
+		}
+	}
+	cdata->fifo_pattern_len = n;
+	cdata->fifo_odr = odr;
+
+	thr = fifo_watermark * n / cdata->fifo_ticks;
+	thr = clamp_t(unsigned int, thr, 1,
+		      LSM6DS3_FIFO_DIFF_MASK / LSM6DS3_FIFO_ELEMENT_WORDS);
+	cdata->fifo_thr_elems = thr;
+	thr *= LSM6DS3_FIFO_ELEMENT_WORDS;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_CTRL3_ADDR,
+					   LSM6DS3_FIFO_GYRO_DECIMATOR_MASK,
+					   lsm6ds3_fifo_decimator(gyr_dec),
+					   true);
+	if (err < 0)
+		goto unlock;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_CTRL3_ADDR,
+					   LSM6DS3_FIFO_ACCEL_DECIMATOR_MASK,
+					   lsm6ds3_fifo_decimator(acc_dec),
+					   true);
+	if (err < 0)
+		goto unlock;
+
+	thr_l = thr & 0xff;
+	err = cdata->tf->write(cdata, LSM6DS3_FIFO_THR_L_ADDR, 1, &thr_l, true);
+	if (err < 0)
+		goto unlock;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_THR_H_ADDR,
+					   LSM6DS3_FIFO_THR_H_MASK,
+					   thr >> 8, true);
+	if (err < 0)
+		goto unlock;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_ODR_ADDR,
+					   LSM6DS3_FIFO_ODR_MASK,
+					   lsm6ds3_odr_table.odr_avl[i].value,
+					   true);
+	if (err < 0)
+		goto unlock;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_FIFO_MODE_ADDR,
+					   LSM6DS3_FIFO_MODE_MASK,
+					   LSM6DS3_FIFO_MODE_CONTINUOS, true);
+	if (err < 0)
+		goto unlock;
+
+	err = lsm6ds3_write_data_with_mask(cdata, LSM6DS3_INT1_CTRL_ADDR,
+					   LSM6DS3_INT1_FTH,
+					   LSM6DS3_EN_BIT, true);
+	if (err < 0)
+		goto unlock;
+
+	cdata->fifo_enabled = true;
+
+unlock:
+	mutex_unlock(&cdata->lock);
+	return err < 0 ? err : 0;
+}
+
+/* FIFO ODR tick at which the data set at pattern position pos was sampled */
+static int64_t lsm6ds3_fifo_tick(struct lsm6ds3_data *cdata, unsigned int pos)
+{
+	return (int64_t)(pos / cdata->fifo_pattern_len) * cdata->fifo_ticks +
+	       cdata->fifo_pattern[pos % cdata->fifo_pattern_len].tick;
+}
+
+static void lsm6ds3_fifo_report(struct lsm6ds3_data *cdata, unsigned int pos,
+				u8 *data, int64_t timestamp)
+{
+	struct lsm6ds3_fifo_slot *slot;
+	struct lsm6ds3_sensor_data *sdata;
+	unsigned int next;
+	bool tick_done;
+	s32 xyz[3];
+
+	slot = &cdata->fifo_pattern[pos % cdata->fifo_pattern_len];
+	sdata = &cdata->sensors[slot->sindex];
+	next = (pos + 1) % cdata->fifo_pattern_len;
+
+	/* Settling samples only skip the input report, IIO keeps its ticks */
+	if (sdata->sample_to_discard) {
+		sdata->sample_to_discard--;
+	} else {
+		xyz[0] = (s16)get_unaligned_le16(&data[0]) * sdata->c_gain;
+		xyz[1] = (s16)get_unaligned_le16(&data[2]) * sdata->c_gain;
+		xyz[2] = (s16)get_unaligned_le16(&data[4]) * sdata->c_gain;
+
+		sdata->timestamp = timestamp;
+		lsm6ds3_report_3axes_event(sdata, xyz, timestamp);
+	}
+
+	/* An IIO scan is complete once every set of this FIFO tick is in */
+	tick_done = !next || (cdata->fifo_pattern[next].tick != slot->tick);
+	lsm6ds3_iio_fifo_store(cdata, slot->sindex, data, tick_done, timestamp);
+}
+
+/*
+ * Drain every complete data set queued in the FIFO with as few bus reads as
+ * the transfer buffer allows and report them in order. Data sets are tagged
+ * with the FIFO tick they were sampled at; the set that crossed the
+ * threshold is stamped with the interrupt time and the others are spaced by
+ * the FIFO ODR period around it.
+ */
+void lsm6ds3_fifo_read(struct lsm6ds3_data *cdata)
+{
+	u8 status[LSM6DS3_FIFO_STATUS_LEN];
+	unsigned int elems, chunk, first, k, i, pos, anchor;
+	int64_t tick_ns, anchor_tick;
+	u16 diff, pattern;
+	u8 *data;
+	int err;
+
+	mutex_lock(&cdata->lock);
+	if (!cdata->fifo_enabled)
+		goto unlock;
+
+	err = cdata->tf->read(cdata, LSM6DS3_FIFO_DIFF_L,
+			      LSM6DS3_FIFO_STATUS_LEN, status, true);
+	if (err < 0)
+		goto unlock;
+
+	diff = get_unaligned_le16(&status[0]);
+	pattern = get_unaligned_le16(&status[2]) & LSM6DS3_FIFO_PATTERN_MASK;
+
+	/* Overrun or a half-read data set: realign on a fresh FIFO */
+	if ((diff & LSM6DS3_FIFO_DATA_OVR_2REGS) ||
+	    (pattern % LSM6DS3_FIFO_ELEMENT_WORDS)) {
+		dev_dbg(cdata->dev, "fifo overrun, resetting\n");
+		lsm6ds3_fifo_reset(cdata);
+		goto unlock;
+	}
+
+	elems = (diff & LSM6DS3_FIFO_DIFF_MASK) / LSM6DS3_FIFO_ELEMENT_WORDS;
+	if (!elems)
+		goto unlock;
+
+	first = pattern / LSM6DS3_FIFO_ELEMENT_WORDS;
+	tick_ns = HZ_TO_PERIOD_NSEC(cdata->fifo_odr);
+	anchor = first + min_t(unsigned int, elems, cdata->fifo_thr_elems) - 1;
+	anchor_tick = lsm6ds3_fifo_tick(cdata, anchor);
+
+	for (k = 0; k < elems; k += chunk) {
+		chunk = min_t(unsigned int, elems - k,
+			      LSM6DS3_FIFO_READ_MAX_ELEMENTS);
+
+		err = cdata->tf->read(cdata, LSM6DS3_FIFO_DATA_OUT_L,
+				      chunk * LSM6DS3_FIFO_ELEMENT_LEN_BYTE,
+				      cdata->fifo_data, true);
+		if (err < 0)
+			goto unlock;
+
+		data = cdata->fifo_data;
+		for (i = 0; i < chunk; i++) {
+			pos = first + k + i;
+			lsm6ds3_fifo_report(cdata, pos, data, cdata->timestamp +
+					    (lsm6ds3_fifo_tick(cdata, pos) -
+					     anchor_tick) * tick_ns);
+			data += LSM6DS3_FIFO_ELEMENT_LEN_BYTE;
+		}
+	}
+
+unlock:
+	mutex_unlock(&cdata->lock);
+}
+
 static irqreturn_t lsm6ds3_save_timestamp(int irq, void *private)
 {
 	struct lsm6ds3_data *cdata = (struct lsm6ds3_data *)private;
@@ -530,8 +816,6 @@ static irqreturn_t lsm6ds3_save_timestamp(int irq, void *private)
 	return IRQ_WAKE_THREAD;
 }
 
-static int lsm6ds3_disable_sensors(struct lsm6ds3_sensor_data *sdata);
-
 static irqreturn_t lsm6ds3_irq_management(int irq, void *private)
 {
 	int err;
@@ -543,6 +827,11 @@ static irqreturn_t lsm6ds3_irq_management(int irq, void *private)
 	cdata->tf->read(cdata, LSM6DS3_SRC_FUNC_ADDR, 1, &src_value, true);
 	cdata->tf->read(cdata, LSM6DS3_FIFO_DATA_AVL_ADDR, 1, &src_fifo, true);
 
+	if (cdata->fifo_enabled &&
+	    (src_fifo & (LSM6DS3_FIFO_DATA_AVL | LSM6DS3_FIFO_DATA_OVR)) &&
+	    !lsm6ds3_iio_fifo_poll(cdata))
+		lsm6ds3_fifo_read(cdata);
+
 	if (src_value & LSM6DS3_SRC_STEP_COUNTER_DATA_AVL) {
 		sdata = &cdata->sensors[LSM6DS3_STEP_COUNTER];
 		sdata->timestamp = cdata->timestamp;
@@ -730,7 +1019,9 @@ static int _lsm6ds3_enable_sensors(struct lsm6ds3_sensor_data *sdata)
 			return err;
 
 		sdata->c_odr = lsm6ds3_odr_table.odr_avl[i].hz;
-		hrtimer_start(&sdata->hr_timer, sdata->delta_ts, HRTIMER_MODE_REL);
+		if (!lsm6ds3_use_fifo(sdata->cdata))
+			hrtimer_start(&sdata->hr_timer, sdata->delta_ts,
+				      HRTIMER_MODE_REL);
 		break;
 	case LSM6DS3_SIGN_MOTION:
 		err = lsm6ds3_write_data_with_mask(sdata->cdata,
@@ -796,7 +1087,7 @@ static int _lsm6ds3_enable_sensors(struct lsm6ds3_sensor_data *sdata)
 	return 0;
 }
 
-static int lsm6ds3_enable_sensors(struct lsm6ds3_sensor_data *sdata)
+int lsm6ds3_enable_sensors(struct lsm6ds3_sensor_data *sdata)
 {
 	int err;
 
@@ -809,6 +1100,9 @@ static int lsm6ds3_enable_sensors(struct lsm6ds3_sensor_data *sdata)
 
 	sdata->enabled = true;
 
+	if ((sdata->sindex == LSM6DS3_ACCEL) || (sdata->sindex == LSM6DS3_GYRO))
+		return lsm6ds3_fifo_update(sdata->cdata);
+
 	return 0;
 }
 
@@ -894,7 +1188,7 @@ static int _lsm6ds3_disable_sensors(struct lsm6ds3_sensor_data *sdata)
 	return 0;
 }
 
-static int lsm6ds3_disable_sensors(struct lsm6ds3_sensor_data *sdata)
+int lsm6ds3_disable_sensors(struct lsm6ds3_sensor_data *sdata)
 {
 	int err;
 
@@ -907,9 +1201,42 @@ static int lsm6ds3_disable_sensors(struct lsm6ds3_sensor_data *sdata)
 
 	sdata->enabled = false;
 
+	if ((sdata->sindex == LSM6DS3_ACCEL) || (sdata->sindex == LSM6DS3_GYRO))
+		return lsm6ds3_fifo_update(sdata->cdata);
+
 	return 0;
 }
 
+/*
+ * The input device and the IIO front end share the sensors. Each user holds
+ * its own reference, and a sensor is only powered down once no user is left.
+ */
+int lsm6ds3_sensor_get(struct lsm6ds3_sensor_data *sdata, u8 user)
+{
+	int err;
+
+	mutex_lock(&sdata->cdata->enable_lock);
+	err = lsm6ds3_enable_sensors(sdata);
+	if (!err)
+		sdata->users |= user;
+	mutex_unlock(&sdata->cdata->enable_lock);
+
+	return err;
+}
+
+int lsm6ds3_sensor_put(struct lsm6ds3_sensor_data *sdata, u8 user)
+{
+	int err = 0;
+
+	mutex_lock(&sdata->cdata->enable_lock);
+	sdata->users &= ~user;
+	if (!sdata->users)
+		err = lsm6ds3_disable_sensors(sdata);
+	mutex_unlock(&sdata->cdata->enable_lock);
+
+	return err;
+}
+
 static int lsm6ds3_reset_steps(struct lsm6ds3_data *cdata)
 {
 	int err;
@@ -1042,7 +1369,7 @@ lsm6ds3_init_sensor_mutex_unlock:
 	return err;
 }
 
-static int lsm6ds3_set_odr(struct lsm6ds3_sensor_data *sdata, u32 odr)
+int lsm6ds3_set_odr(struct lsm6ds3_sensor_data *sdata, u32 odr)
 {
 	int err = 0, i;
 
@@ -1079,6 +1406,7 @@ static int lsm6ds3_set_odr(struct lsm6ds3_sensor_data *sdata, u32 odr)
 		}
 
 		sdata->c_odr = lsm6ds3_odr_table.odr_avl[i].hz;
+		err = lsm6ds3_fifo_update(sdata->cdata);
 		enable_irq(sdata->cdata->irq);
 	} else
 		sdata->c_odr = lsm6ds3_odr_table.odr_avl[i].hz;
@@ -1107,9 +1435,9 @@ static ssize_t set_enable(struct device *dev, struct device_attribute *attr,
 		return -EINVAL;
 
 	if (enable)
-		err = lsm6ds3_enable_sensors(sdata);
+		err = lsm6ds3_sensor_get(sdata, LSM6DS3_USER_INPUT);
 	else
-		err = lsm6ds3_disable_sensors(sdata);
+		err = lsm6ds3_sensor_put(sdata, LSM6DS3_USER_INPUT);
 
 	return count;
 }
@@ -1443,6 +1771,7 @@ int lsm6ds3_common_probe(struct lsm6ds3_data *cdata, int irq, u16 bustype)
 	mutex_init(&cdata->bank_registers_lock);
 	mutex_init(&cdata->tb.buf_lock);
 	mutex_init(&cdata->lock);
+	mutex_init(&cdata->enable_lock);
 
 	/* Read Chip ID register */
 	err = cdata->tf->read(cdata, LSM6DS3_WHO_AM_I, 1, &wai, true);
@@ -1545,6 +1874,11 @@ int lsm6ds3_common_probe(struct lsm6ds3_data *cdata, int irq, u16 bustype)
 			return err;
 	}
 
+	/* The input devices stay usable if the IIO front end is missing */
+	err = lsm6ds3_iio_init(cdata);
+	if (err < 0)
+		dev_warn(cdata->dev, "IIO device not registered (%d)\n", err);
+
 	dev_info(cdata->dev, "%s: probed\n", LSM6DS3_ACC_GYR_DEV_NAME);
 	return 0;
 }
@@ -1554,6 +1888,8 @@ void lsm6ds3_common_remove(struct lsm6ds3_data *cdata, int irq)
 {
 	u8 i;
 
+	lsm6ds3_iio_remove(cdata);
+
 	for (i = 0; i < LSM6DS3_SENSORS_NUMB; i++) {
 		lsm6ds3_disable_sensors(&cdata->sensors[i]);
 		lsm6ds3_input_cleanup(&cdata->sensors[i]);
@@ -1596,6 +1932,7 @@ int lsm6ds3_common_resume(struct lsm6ds3_data *cdata)
 {
 	lsm6ds3_resume_sensors(&cdata->sensors[LSM6DS3_ACCEL]);
 	lsm6ds3_resume_sensors(&cdata->sensors[LSM6DS3_GYRO]);
+	lsm6ds3_fifo_update(cdata);
 
 	return 0;
 }
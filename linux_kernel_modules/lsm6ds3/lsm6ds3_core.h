@@ -34,11 +34,19 @@ enum {
 	LSM6DS3_SENSORS_NUMB,
 };
 
+/* Users holding a sensor enabled, see lsm6ds3_sensor_get() */
+#define LSM6DS3_USER_INPUT		BIT(0)
+#define LSM6DS3_USER_IIO		BIT(1)
+
 #define DEF_ZERO			0x00
 
 /* First Out register for Acc and Gyro */
 #define LSM6DS3_ACC_OUT_X_L_ADDR	0x28
 #define LSM6DS3_GYR_OUT_X_L_ADDR	0x22
+#define LSM6DS3_TEMP_OUT_L_ADDR		0x20
+
+#define LSM6DS3_STEP_COUNTER_OUT_L_ADDR	0x4b
+#define LSM6DS3_STEP_COUNTER_OUT_SIZE	2
 
 /* Output data rate registers */
 #define LSM6DS3_ACC_ODR_ADDR		CTRL1_ADDR
@@ -92,6 +100,10 @@ enum {
 
 #define to_dev(obj) 			container_of(obj, struct device, kobj)
 
+/* Largest FIFO decimation factor, so at most 32 gyro sets + 1 accel set */
+#define LSM6DS3_FIFO_DEC_MAX		32
+#define LSM6DS3_FIFO_PATTERN_MAX	(LSM6DS3_FIFO_DEC_MAX + 1)
+
 struct reg_rw {
 	u8 const address;
 	u8 const init_val;
@@ -109,7 +121,13 @@ struct lsm6ds3_transfer_buffer {
 	u8 tx_buf[LSM6DS3_TX_MAX_LENGTH] ____cacheline_aligned;
 };
 
+struct lsm6ds3_fifo_slot {
+	u8 sindex;
+	u8 tick;
+};
+
 struct lsm6ds3_data;
+struct iio_dev;
 
 struct lsm6ds3_transfer_function {
 	int (*write) (struct lsm6ds3_data *cdata, u8 reg_addr, int len, u8 *data,
@@ -122,6 +140,7 @@ struct lsm6ds3_sensor_data {
 	struct lsm6ds3_data *cdata;
 	const char* name;
 	u8 enabled;
+	u8 users;
 	u32 c_odr;
 	u32 c_gain;
 	u8 sindex;
@@ -146,16 +165,42 @@ struct lsm6ds3_data {
 	int64_t timestamp;
 
 	struct mutex lock;
+	/* Serializes enable and disable requests from the sensor users */
+	struct mutex enable_lock;
 	struct device *dev;
 	struct lsm6ds3_sensor_data sensors[LSM6DS3_SENSORS_NUMB];
 	struct mutex bank_registers_lock;
 	const struct lsm6ds3_transfer_function *tf;
 	struct lsm6ds3_transfer_buffer tb;
+
+	struct iio_dev *indio_dev;
+
+	bool fifo_enabled;
+	u32 fifo_odr;
+	u8 fifo_ticks;
+	u8 fifo_pattern_len;
+	u16 fifo_thr_elems;
+	struct lsm6ds3_fifo_slot fifo_pattern[LSM6DS3_FIFO_PATTERN_MAX];
+	u8 fifo_data[LSM6DS3_RX_MAX_LENGTH];
 };
 
 int lsm6ds3_common_probe(struct lsm6ds3_data *cdata, int irq, u16 bustype);
 void lsm6ds3_common_remove(struct lsm6ds3_data *cdata, int irq);
 
+int lsm6ds3_enable_sensors(struct lsm6ds3_sensor_data *sdata);
+int lsm6ds3_disable_sensors(struct lsm6ds3_sensor_data *sdata);
+int lsm6ds3_sensor_get(struct lsm6ds3_sensor_data *sdata, u8 user);
+int lsm6ds3_sensor_put(struct lsm6ds3_sensor_data *sdata, u8 user);
+int lsm6ds3_set_odr(struct lsm6ds3_sensor_data *sdata, u32 odr);
+void lsm6ds3_fifo_read(struct lsm6ds3_data *cdata);
+
+/* IIO front end, lsm6ds3_iio.c */
+int lsm6ds3_iio_init(struct lsm6ds3_data *cdata);
+void lsm6ds3_iio_remove(struct lsm6ds3_data *cdata);
+bool lsm6ds3_iio_fifo_poll(struct lsm6ds3_data *cdata);
+void lsm6ds3_iio_fifo_store(struct lsm6ds3_data *cdata, u8 sindex,
+			    const u8 *data, bool tick_done, int64_t timestamp);
+
 #ifdef CONFIG_PM
 int lsm6ds3_common_suspend(struct lsm6ds3_data *cdata);
 int lsm6ds3_common_resume(struct lsm6ds3_data *cdata);
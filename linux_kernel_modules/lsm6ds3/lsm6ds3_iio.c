@@ -0,0 +1,588 @@
+/*
+ * STMicroelectronics lsm6ds3 driver, IIO front end
+ *
+ * Exposes accelerometer, gyroscope, temperature and step counter as IIO
+ * channels alongside the input devices registered by lsm6ds3_core.c.
+ * Buffered capture works with any IIO trigger, or with the device's own FIFO
+ * trigger which is fired from the FIFO threshold interrupt and drains the
+ * hardware FIFO straight into the buffer.
+ *
+ * Licensed under the GPL-2.
+ */
+
+#include <linux/module.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
+#include <linux/interrupt.h>
+#include <linux/mutex.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+
+#include "lsm6ds3_core.h"
+
+/* Scan indexes follow output register order, starting at OUT_TEMP_L */
+enum lsm6ds3_iio_scan {
+	LSM6DS3_IIO_SCAN_TEMP = 0,
+	LSM6DS3_IIO_SCAN_GYRO_X,
+	LSM6DS3_IIO_SCAN_GYRO_Y,
+	LSM6DS3_IIO_SCAN_GYRO_Z,
+	LSM6DS3_IIO_SCAN_ACCEL_X,
+	LSM6DS3_IIO_SCAN_ACCEL_Y,
+	LSM6DS3_IIO_SCAN_ACCEL_Z,
+	LSM6DS3_IIO_SCAN_STEPS,
+	LSM6DS3_IIO_SCAN_TIMESTAMP,
+};
+
+/* OUT_TEMP_L up to OUTZ_H_XL */
+#define LSM6DS3_IIO_OUT_SIZE		((LSM6DS3_IIO_SCAN_ACCEL_Z + 1) * 2)
+
+/* Temperature: 16 LSB/degC, 0 LSB at 25 degC */
+#define LSM6DS3_IIO_TEMP_LSB_PER_C	16
+#define LSM6DS3_IIO_TEMP_OFFSET_C	25
+
+struct lsm6ds3_iio {
+	struct lsm6ds3_data *cdata;
+	/* Serializes sensor power changes made on behalf of IIO */
+	struct mutex lock;
+	struct iio_trigger *fifo_trig;
+	bool fifo_on;
+	/* Sensors IIO holds a reference on, see lsm6ds3_sensor_get() */
+	unsigned long owned;
+	/* Latest raw value of every channel, indexed by scan index */
+	__le16 raw[LSM6DS3_IIO_SCAN_TIMESTAMP];
+	/* 8 x __le16 + s64 timestamp */
+	__le16 scan[12] __aligned(8);
+};
+
+#define LSM6DS3_IIO_CHANNEL(_type, _axis, _index) {			\
+	.type = _type,							\
+	.modified = 1,							\
+	.channel2 = IIO_MOD_##_axis,					\
+	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),			\
+	.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE) |		\
+		BIT(IIO_CHAN_INFO_SAMP_FREQ),				\
+	.scan_index = _index,						\
+	.scan_type = {							\
+		.sign = 's',						\
+		.realbits = 16,						\
+		.storagebits = 16,					\
+		.endianness = IIO_LE,					\
+	},								\
+}
+
+static const struct iio_chan_spec lsm6ds3_iio_channels[] = {
+	{
+		.type = IIO_TEMP,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
+				      BIT(IIO_CHAN_INFO_SCALE) |
+				      BIT(IIO_CHAN_INFO_OFFSET),
+		.scan_index = LSM6DS3_IIO_SCAN_TEMP,
+		.scan_type = {
+			.sign = 's',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_LE,
+		},
+	},
+	LSM6DS3_IIO_CHANNEL(IIO_ANGL_VEL, X, LSM6DS3_IIO_SCAN_GYRO_X),
+	LSM6DS3_IIO_CHANNEL(IIO_ANGL_VEL, Y, LSM6DS3_IIO_SCAN_GYRO_Y),
+	LSM6DS3_IIO_CHANNEL(IIO_ANGL_VEL, Z, LSM6DS3_IIO_SCAN_GYRO_Z),
+	LSM6DS3_IIO_CHANNEL(IIO_ACCEL, X, LSM6DS3_IIO_SCAN_ACCEL_X),
+	LSM6DS3_IIO_CHANNEL(IIO_ACCEL, Y, LSM6DS3_IIO_SCAN_ACCEL_Y),
+	LSM6DS3_IIO_CHANNEL(IIO_ACCEL, Z, LSM6DS3_IIO_SCAN_ACCEL_Z),
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 0, 0)
+	{
+		.type = IIO_STEPS,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED),
+		.scan_index = LSM6DS3_IIO_SCAN_STEPS,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_LE,
+		},
+	},
+#endif
+	IIO_CHAN_SOFT_TIMESTAMP(LSM6DS3_IIO_SCAN_TIMESTAMP),
+};
+
+static bool lsm6ds3_iio_scan_has(const unsigned long *mask, int first)
+{
+	return test_bit(first, mask) || test_bit(first + 1, mask) ||
+	       test_bit(first + 2, mask);
+}
+
+static int lsm6ds3_iio_power_on(struct lsm6ds3_iio *iio, int sindex)
+{
+	struct lsm6ds3_sensor_data *sdata = &iio->cdata->sensors[sindex];
+	int err;
+
+	if (test_bit(sindex, &iio->owned))
+		return 0;
+
+	err = lsm6ds3_sensor_get(sdata, LSM6DS3_USER_IIO);
+	if (err < 0)
+		return err;
+
+	set_bit(sindex, &iio->owned);
+
+	return 0;
+}
+
+static void lsm6ds3_iio_power_off(struct lsm6ds3_iio *iio)
+{
+	int i;
+
+	for_each_set_bit(i, &iio->owned, LSM6DS3_SENSORS_NUMB)
+		lsm6ds3_sensor_put(&iio->cdata->sensors[i], LSM6DS3_USER_IIO);
+
+	iio->owned = 0;
+}
+
+static int lsm6ds3_iio_read_oneshot(struct lsm6ds3_iio *iio,
+				    struct iio_chan_spec const *chan, int *val)
+{
+	struct lsm6ds3_data *cdata = iio->cdata;
+	struct lsm6ds3_sensor_data *sdata;
+	__le16 sample;
+	bool running;
+	u8 reg;
+	int err;
+
+	switch (chan->type) {
+	case IIO_ACCEL:
+		sdata = &cdata->sensors[LSM6DS3_ACCEL];
+		reg = LSM6DS3_ACC_OUT_X_L_ADDR +
+		      (chan->channel2 - IIO_MOD_X) * sizeof(sample);
+		break;
+	case IIO_ANGL_VEL:
+		sdata = &cdata->sensors[LSM6DS3_GYRO];
+		reg = LSM6DS3_GYR_OUT_X_L_ADDR +
+		      (chan->channel2 - IIO_MOD_X) * sizeof(sample);
+		break;
+	case IIO_TEMP:
+		/* The temperature is only converted while a sensor runs */
+		sdata = &cdata->sensors[LSM6DS3_ACCEL];
+		reg = LSM6DS3_TEMP_OUT_L_ADDR;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&iio->lock);
+	/* Hold the sensor even if input has it on, input may let go meanwhile */
+	running = sdata->enabled;
+	err = lsm6ds3_iio_power_on(iio, sdata->sindex);
+	if (err < 0)
+		goto unlock;
+
+	/* Wait out the samples discarded after power-up */
+	if (!running)
+		msleep(DIV_ROUND_UP((sdata->sample_to_discard + 1) * 1000,
+				    sdata->c_odr));
+
+	err = cdata->tf->read(cdata, reg, sizeof(sample), (u8 *)&sample, true);
+	lsm6ds3_iio_power_off(iio);
+	if (err < 0)
+		goto unlock;
+
+	*val = (s16)le16_to_cpu(sample);
+	err = IIO_VAL_INT;
+
+unlock:
+	mutex_unlock(&iio->lock);
+	return err;
+}
+
+static int lsm6ds3_iio_claim_direct(struct iio_dev *indio_dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+	return iio_device_claim_direct_mode(indio_dev);
+#else
+	mutex_lock(&indio_dev->mlock);
+	if (iio_buffer_enabled(indio_dev)) {
+		mutex_unlock(&indio_dev->mlock);
+		return -EBUSY;
+	}
+
+	return 0;
+#endif
+}
+
+static void lsm6ds3_iio_release_direct(struct iio_dev *indio_dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+	iio_device_release_direct_mode(indio_dev);
+#else
+	mutex_unlock(&indio_dev->mlock);
+#endif
+}
+
+static int lsm6ds3_iio_read_raw(struct iio_dev *indio_dev,
+				struct iio_chan_spec const *chan,
+				int *val, int *val2, long mask)
+{
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+	struct lsm6ds3_data *cdata = iio->cdata;
+	__le16 steps;
+	int err;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		/* Keeps the buffer from coming up during the one-shot read */
+		err = lsm6ds3_iio_claim_direct(indio_dev);
+		if (err < 0)
+			return err;
+
+		err = lsm6ds3_iio_read_oneshot(iio, chan, val);
+		lsm6ds3_iio_release_direct(indio_dev);
+		return err;
+
+	case IIO_CHAN_INFO_PROCESSED:
+		err = cdata->tf->read(cdata, LSM6DS3_STEP_COUNTER_OUT_L_ADDR,
+				      LSM6DS3_STEP_COUNTER_OUT_SIZE,
+				      (u8 *)&steps, true);
+		if (err < 0)
+			return err;
+
+		*val = le16_to_cpu(steps);
+		return IIO_VAL_INT;
+
+	case IIO_CHAN_INFO_SCALE:
+		switch (chan->type) {
+		case IIO_ACCEL:
+			/* c_gain is in ug/LSB */
+			*val = 0;
+			*val2 = cdata->sensors[LSM6DS3_ACCEL].c_gain *
+				980665 / 100;
+			return IIO_VAL_INT_PLUS_NANO;
+		case IIO_ANGL_VEL:
+			/* c_gain is in udps/LSB */
+			*val = 0;
+			*val2 = cdata->sensors[LSM6DS3_GYRO].c_gain *
+				17453 / 1000;
+			return IIO_VAL_INT_PLUS_NANO;
+		case IIO_TEMP:
+			/* milli degrees Celsius */
+			*val = 1000;
+			*val2 = LSM6DS3_IIO_TEMP_LSB_PER_C;
+			return IIO_VAL_FRACTIONAL;
+		default:
+			return -EINVAL;
+		}
+
+	case IIO_CHAN_INFO_OFFSET:
+		*val = LSM6DS3_IIO_TEMP_OFFSET_C * LSM6DS3_IIO_TEMP_LSB_PER_C;
+		return IIO_VAL_INT;
+
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		if (chan->type == IIO_ACCEL)
+			*val = cdata->sensors[LSM6DS3_ACCEL].c_odr;
+		else
+			*val = cdata->sensors[LSM6DS3_GYRO].c_odr;
+		return IIO_VAL_INT;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static int lsm6ds3_iio_write_raw(struct iio_dev *indio_dev,
+				 struct iio_chan_spec const *chan,
+				 int val, int val2, long mask)
+{
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+	struct lsm6ds3_sensor_data *sdata;
+
+	if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+		return -EINVAL;
+
+	switch (chan->type) {
+	case IIO_ACCEL:
+		sdata = &iio->cdata->sensors[LSM6DS3_ACCEL];
+		break;
+	case IIO_ANGL_VEL:
+		sdata = &iio->cdata->sensors[LSM6DS3_GYRO];
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return lsm6ds3_set_odr(sdata, val);
+}
+
+static IIO_CONST_ATTR_SAMP_FREQ_AVAIL("13 26 52 104 208 416");
+
+static struct attribute *lsm6ds3_iio_attributes[] = {
+	&iio_const_attr_sampling_frequency_available.dev_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group lsm6ds3_iio_attribute_group = {
+	.attrs = lsm6ds3_iio_attributes,
+};
+
+static const struct iio_info lsm6ds3_iio_info = {
+	.read_raw = lsm6ds3_iio_read_raw,
+	.write_raw = lsm6ds3_iio_write_raw,
+	.attrs = &lsm6ds3_iio_attribute_group,
+};
+
+static void lsm6ds3_iio_push(struct iio_dev *indio_dev, int64_t timestamp)
+{
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+	int i, j = 0;
+
+	for_each_set_bit(i, indio_dev->active_scan_mask,
+			 indio_dev->masklength)
+		if (i != LSM6DS3_IIO_SCAN_TIMESTAMP)
+			iio->scan[j++] = iio->raw[i];
+
+	iio_push_to_buffers_with_timestamp(indio_dev, iio->scan, timestamp);
+}
+
+static irqreturn_t lsm6ds3_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+	struct lsm6ds3_data *cdata = iio->cdata;
+	const unsigned long *mask = indio_dev->active_scan_mask;
+	int err;
+
+	if (test_bit(LSM6DS3_IIO_SCAN_STEPS, mask)) {
+		err = cdata->tf->read(cdata, LSM6DS3_STEP_COUNTER_OUT_L_ADDR,
+				      LSM6DS3_STEP_COUNTER_OUT_SIZE,
+				      (u8 *)&iio->raw[LSM6DS3_IIO_SCAN_STEPS],
+				      true);
+		if (err < 0)
+			goto done;
+	}
+
+	if (iio->fifo_trig && indio_dev->trig == iio->fifo_trig) {
+		/* The temperature is not queued, sample it once per drain */
+		if (test_bit(LSM6DS3_IIO_SCAN_TEMP, mask)) {
+			err = cdata->tf->read(cdata, LSM6DS3_TEMP_OUT_L_ADDR,
+				sizeof(__le16),
+				(u8 *)&iio->raw[LSM6DS3_IIO_SCAN_TEMP], true);
+			if (err < 0)
+				goto done;
+		}
+
+		/* Scans are pushed by lsm6ds3_iio_fifo_store() */
+		lsm6ds3_fifo_read(cdata);
+		goto done;
+	}
+
+	/* Temperature, gyro and accel outputs are contiguous */
+	if (find_first_bit(mask, indio_dev->masklength) <=
+	    LSM6DS3_IIO_SCAN_ACCEL_Z) {
+		err = cdata->tf->read(cdata, LSM6DS3_TEMP_OUT_L_ADDR,
+				      LSM6DS3_IIO_OUT_SIZE, (u8 *)iio->raw,
+				      true);
+		if (err < 0)
+			goto done;
+	}
+
+	lsm6ds3_iio_push(indio_dev, pf->timestamp);
+
+done:
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+/*
+ * Called by the FIFO drain for every data set read. The set is kept as the
+ * latest value of its sensor, and once all sets of a FIFO tick are in a scan
+ * is pushed with the interpolated timestamp of that tick. With a decimated
+ * sensor the slower channels hold their last value between ticks.
+ */
+void lsm6ds3_iio_fifo_store(struct lsm6ds3_data *cdata, u8 sindex,
+			    const u8 *data, bool tick_done, int64_t timestamp)
+{
+	struct lsm6ds3_iio *iio;
+
+	if (!cdata->indio_dev)
+		return;
+
+	iio = iio_priv(cdata->indio_dev);
+	if (!iio->fifo_on)
+		return;
+
+	if (sindex == LSM6DS3_GYRO)
+		memcpy(&iio->raw[LSM6DS3_IIO_SCAN_GYRO_X], data,
+		       3 * sizeof(__le16));
+	else
+		memcpy(&iio->raw[LSM6DS3_IIO_SCAN_ACCEL_X], data,
+		       3 * sizeof(__le16));
+
+	if (tick_done)
+		lsm6ds3_iio_push(cdata->indio_dev, timestamp);
+}
+
+/*
+ * Called from the FIFO threshold interrupt thread. When the buffer runs on
+ * the FIFO trigger the drain happens in its poll function, so tell the core
+ * not to drain on its own.
+ */
+bool lsm6ds3_iio_fifo_poll(struct lsm6ds3_data *cdata)
+{
+	struct lsm6ds3_iio *iio;
+
+	if (!cdata->indio_dev)
+		return false;
+
+	iio = iio_priv(cdata->indio_dev);
+	if (!iio->fifo_on)
+		return false;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+	iio_trigger_poll_chained(iio->fifo_trig);
+#else
+	iio_trigger_poll_chained(iio->fifo_trig, cdata->timestamp);
+#endif
+
+	return true;
+}
+
+static int lsm6ds3_iio_fifo_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+
+	iio->fifo_on = state;
+
+	return 0;
+}
+
+static const struct iio_trigger_ops lsm6ds3_iio_fifo_trigger_ops = {
+	.set_trigger_state = lsm6ds3_iio_fifo_set_state,
+	.validate_device = iio_trigger_validate_own_device,
+};
+
+static int lsm6ds3_iio_buffer_preenable(struct iio_dev *indio_dev)
+{
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+	const unsigned long *mask = indio_dev->active_scan_mask;
+	bool gyro = lsm6ds3_iio_scan_has(mask, LSM6DS3_IIO_SCAN_GYRO_X);
+	int err = 0;
+
+	mutex_lock(&iio->lock);
+	/*
+	 * Temperature and steps need a running sensor too, and the FIFO
+	 * trigger only fires while accel or gyro feed the FIFO.
+	 */
+	if (!gyro || lsm6ds3_iio_scan_has(mask, LSM6DS3_IIO_SCAN_ACCEL_X))
+		err = lsm6ds3_iio_power_on(iio, LSM6DS3_ACCEL);
+	if (!err && gyro)
+		err = lsm6ds3_iio_power_on(iio, LSM6DS3_GYRO);
+	if (!err && test_bit(LSM6DS3_IIO_SCAN_STEPS, mask))
+		err = lsm6ds3_iio_power_on(iio, LSM6DS3_STEP_COUNTER);
+	if (err < 0)
+		lsm6ds3_iio_power_off(iio);
+	mutex_unlock(&iio->lock);
+
+	return err;
+}
+
+static int lsm6ds3_iio_buffer_postdisable(struct iio_dev *indio_dev)
+{
+	struct lsm6ds3_iio *iio = iio_priv(indio_dev);
+
+	mutex_lock(&iio->lock);
+	lsm6ds3_iio_power_off(iio);
+	mutex_unlock(&iio->lock);
+
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops lsm6ds3_iio_buffer_setup_ops = {
+	.preenable = lsm6ds3_iio_buffer_preenable,
+	.postenable = iio_triggered_buffer_postenable,
+	.predisable = iio_triggered_buffer_predisable,
+	.postdisable = lsm6ds3_iio_buffer_postdisable,
+};
+
+int lsm6ds3_iio_init(struct lsm6ds3_data *cdata)
+{
+	struct iio_dev *indio_dev;
+	struct lsm6ds3_iio *iio;
+	int err;
+
+	indio_dev = devm_iio_device_alloc(cdata->dev, sizeof(*iio));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	iio = iio_priv(indio_dev);
+	iio->cdata = cdata;
+	mutex_init(&iio->lock);
+
+	indio_dev->dev.parent = cdata->dev;
+	indio_dev->name = LSM6DS3_ACC_GYR_DEV_NAME;
+	indio_dev->channels = lsm6ds3_iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(lsm6ds3_iio_channels);
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->info = &lsm6ds3_iio_info;
+
+	if (cdata->irq > 0) {
+		iio->fifo_trig = devm_iio_trigger_alloc(cdata->dev,
+							"%s-fifo-dev%d",
+							indio_dev->name,
+							indio_dev->id);
+		if (!iio->fifo_trig)
+			return -ENOMEM;
+
+		iio->fifo_trig->dev.parent = cdata->dev;
+		iio->fifo_trig->ops = &lsm6ds3_iio_fifo_trigger_ops;
+		iio_trigger_set_drvdata(iio->fifo_trig, indio_dev);
+		err = iio_trigger_register(iio->fifo_trig);
+		if (err < 0)
+			return err;
+	}
+
+	err = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time,
+					 lsm6ds3_iio_trigger_handler,
+					 &lsm6ds3_iio_buffer_setup_ops);
+	if (err < 0)
+		goto trigger_unregister;
+
+	err = iio_device_register(indio_dev);
+	if (err < 0)
+		goto buffer_cleanup;
+
+	cdata->indio_dev = indio_dev;
+
+	return 0;
+
+buffer_cleanup:
+	iio_triggered_buffer_cleanup(indio_dev);
+trigger_unregister:
+	if (iio->fifo_trig)
+		iio_trigger_unregister(iio->fifo_trig);
+	return err;
+}
+
+void lsm6ds3_iio_remove(struct lsm6ds3_data *cdata)
+{
+	struct iio_dev *indio_dev = cdata->indio_dev;
+	struct lsm6ds3_iio *iio;
+
+	if (!indio_dev)
+		return;
+
+	iio = iio_priv(indio_dev);
+
+	iio_device_unregister(indio_dev);
+	iio_triggered_buffer_cleanup(indio_dev);
+	if (iio->fifo_trig)
+		iio_trigger_unregister(iio->fifo_trig);
+
+	cdata->indio_dev = NULL;
+}
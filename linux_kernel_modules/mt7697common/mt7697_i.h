@@ -38,8 +38,14 @@ struct mt7697_rsp_hdr {
 	__be32			result;
 } __attribute__((__packed__, aligned(4)));
 
+struct mt7697_iov {
+	const u32		*buf;
+	size_t			num;
+};
+
 typedef int (*rx_hndlr)(const struct mt7697_rsp_hdr*, void*);
 typedef int (*notify_tx_hndlr)(void*, u32);
+typedef void (*rx_done_hndlr)(void*);
 
 struct mt7697_if_ops {
 	int (*init)(u8, u8, void*, notify_tx_hndlr, rx_hndlr, void**, void**);
@@ -49,6 +55,10 @@ struct mt7697_if_ops {
 	int (*close)(void*);
 	size_t (*read)(void*, u32*, size_t);
 	size_t (*write)(void*, const u32*, size_t);
+	/* Optional: several messages, returns the number written */
+	int (*writev)(void*, const struct mt7697_iov*, size_t);
+	/* Optional: called once rx_hndlr has seen a whole batch */
+	void (*set_rx_done)(void*, rx_done_hndlr);
 };
 
 #endif
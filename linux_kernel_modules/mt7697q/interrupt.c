@@ -14,39 +14,54 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
 #include "interrupt.h"
 #include "queue.h"
 #include "io.h"
 #include "spi.h"
 
-static int mt7697q_irq_run(struct mt7697q_info *qinfo)
+/*
+ * While the slave keeps raising its mailbox the worker polls it up to
+ * poll_budget times before handing the CPU back, then rearms itself with
+ * an hrtimer after poll_interval_us.  Once the mailbox reads empty the GPIO
+ * interrupt is re-enabled.
+ */
+static unsigned int poll_budget = 8;
+module_param(poll_budget, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_budget, "Mailbox polls per worker run while busy");
+
+static unsigned int poll_interval_us = 50;
+module_param(poll_interval_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_interval_us, "Poll rearm interval while busy (usecs)");
+
+static void mt7697q_irq_latency(struct mt7697q_info *qinfo)
 {
-	int ret;
-	u8 ch;
-	u8 s2m_mbox;
+	ktime_t ts = qinfo->irq_ts;
+	s64 usecs;
+	int bucket;
 
-	ret = mt7697q_get_s2m_mbx(qinfo, &s2m_mbox);
-	if (ret < 0) {
-		dev_err(qinfo->dev,
-			"%s(): mt7697q_get_s2m_mbx() failed(%d)\n",
-			__func__, ret);
-		goto cleanup;
-	}
+	if (!ktime_to_ns(ts))
+		return;
 
-	if (s2m_mbox) {
-		if (!queue_delayed_work(qinfo->irq_workq,
-			&qinfo->irq_delayed_work, usecs_to_jiffies(10))) {
-			dev_err(qinfo->dev,
-				"%s(): queue_delayed_work() failed\n",
-				__func__);
-			ret = -EINVAL;
-		}
-	} else {
-		enable_irq(qinfo->irq);
-	}
+	qinfo->irq_ts = ktime_set(0, 0);
+	usecs = ktime_us_delta(ktime_get(), ts);
+	bucket = (usecs > 0) ? ilog2(usecs) + 1 : 0;
+	if (bucket >= MT7697Q_IRQ_LATENCY_BUCKETS)
+		bucket = MT7697Q_IRQ_LATENCY_BUCKETS - 1;
+
+	qinfo->irq_latency[bucket]++;
+}
+
+static int mt7697q_irq_proc(struct mt7697q_info *qinfo, u8 s2m_mbox)
+{
+	int ret = 0;
+	u8 ch;
 
 	for (ch = 0; ch < MT7697_NUM_QUEUES; ch++) {
 		struct mt7697q_spec *qs = &qinfo->queues[ch];
@@ -80,22 +95,71 @@ cleanup:
 	return ret;
 }
 
-void mt7697q_irq_delayed_work(struct work_struct *irq_delayed_work)
+static int mt7697q_irq_run(struct mt7697q_info *qinfo)
 {
-	struct mt7697q_info *qinfo = container_of(irq_delayed_work,
-		struct mt7697q_info, irq_delayed_work.work);
+	unsigned int polls = 0;
 	int ret;
+	u8 s2m_mbox = 0;
 
-	dev_dbg(qinfo->dev, "%s(): process work\n", __func__);
-	ret = mt7697q_irq_run(qinfo);
-	if (ret < 0) {
-		dev_err(qinfo->dev, "%s(): mt7697q_irq_run() failed(%d)\n",
-			__func__, ret);
-		goto cleanup;
-	}
+	mt7697q_irq_latency(qinfo);
+
+	do {
+		ret = mt7697q_get_s2m_mbx(qinfo, &s2m_mbox);
+		if (ret < 0) {
+			dev_err(qinfo->dev,
+				"%s(): mt7697q_get_s2m_mbx() failed(%d)\n",
+				__func__, ret);
+			goto cleanup;
+		}
+
+		if (!s2m_mbox)
+			break;
+
+		/* Only count passes made instead of waiting for an edge */
+		if (polls || qinfo->polling)
+			atomic_inc(&qinfo->stats.busy_polls);
+
+		ret = mt7697q_irq_proc(qinfo, s2m_mbox);
+		if (ret < 0) {
+			dev_err(qinfo->dev,
+				"%s(): mt7697q_irq_proc() failed(%d)\n",
+				__func__, ret);
+			goto cleanup;
+		}
+	} while (++polls < poll_budget);
 
 cleanup:
-	return;
+	/* Module exit, leave the timer and the IRQ alone */
+	if (atomic_read(&qinfo->stopping))
+		return ret;
+
+	qinfo->polling = !!s2m_mbox;
+	if (s2m_mbox) {
+		/* Still busy, come back without waiting for the GPIO edge */
+		hrtimer_start(&qinfo->poll_timer,
+			      ns_to_ktime((u64)poll_interval_us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	} else {
+		enable_irq(qinfo->irq);
+	}
+
+	return ret;
+}
+
+enum hrtimer_restart mt7697q_poll_timer(struct hrtimer *poll_timer)
+{
+	struct mt7697q_info *qinfo = container_of(poll_timer,
+		struct mt7697q_info, poll_timer);
+
+	if (atomic_read(&qinfo->stopping))
+		return HRTIMER_NORESTART;
+
+	qinfo->irq_ts = ktime_get();
+	if (!queue_work(qinfo->irq_workq, &qinfo->irq_work)) {
+		dev_err(qinfo->dev, "%s(): queue_work() failed\n", __func__);
+	}
+
+	return HRTIMER_NORESTART;
 }
 
 void mt7697q_irq_work(struct work_struct *irq_work)
@@ -117,11 +181,49 @@ cleanup:
 	return;
 }
 
+static int mt7697q_irq_latency_show(struct seq_file *s, void *data)
+{
+	struct mt7697q_info *qinfo = s->private;
+	int i;
+
+	seq_printf(s, "%10s %10u\n", "<1us", qinfo->irq_latency[0]);
+	for (i = 1; i < MT7697Q_IRQ_LATENCY_BUCKETS; i++)
+		seq_printf(s, "%8luus %10u\n", 1UL << (i - 1),
+			   qinfo->irq_latency[i]);
+
+	return 0;
+}
+
+static int mt7697q_irq_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mt7697q_irq_latency_show, inode->i_private);
+}
+
+static const struct file_operations mt7697q_irq_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mt7697q_irq_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void mt7697q_irq_debugfs_init(struct mt7697q_info *qinfo)
+{
+	debugfs_create_file("irq_latency", S_IRUGO, qinfo->debugfs, qinfo,
+			    &mt7697q_irq_latency_fops);
+	debugfs_create_atomic_t("busy_polls", S_IRUGO, qinfo->debugfs,
+				&qinfo->stats.busy_polls);
+}
+
 irqreturn_t mt7697q_isr(int irq, void *arg)
 {
 	struct mt7697q_info *qinfo = (struct mt7697q_info*)arg;
 
 	disable_irq_nosync(qinfo->irq);
+	if (atomic_read(&qinfo->stopping))
+		return IRQ_HANDLED;
+
+	qinfo->irq_ts = ktime_get();
 	if (!queue_work(qinfo->irq_workq, &qinfo->irq_work)) {
 		dev_err(qinfo->dev, "%s(): queue_work() failed\n", __func__);
 	}
@@ -17,10 +17,14 @@
 #ifndef _MT7697_SPI_QUEUE_INTERRUPT_H_
 #define _MT7697_SPI_QUEUE_INTERRUPT_H_
 
+#include <linux/hrtimer.h>
 #include <linux/interrupt.h>
 
+struct mt7697q_info;
+
 irqreturn_t mt7697q_isr(int, void*);
 void mt7697q_irq_work(struct work_struct*);
-void mt7697q_irq_delayed_work(struct work_struct*);
+enum hrtimer_restart mt7697q_poll_timer(struct hrtimer*);
+void mt7697q_irq_debugfs_init(struct mt7697q_info*);
 
 #endif
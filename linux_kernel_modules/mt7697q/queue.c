@@ -14,13 +14,28 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <linux/debugfs.h>
 #include <linux/device.h>
+#include <linux/module.h>
 #include <linux/spi/spi.h>
 #include "bits.h"
+#include "interrupt.h"
 #include "io.h"
 #include "queue.h"
 #include "spi.h"
 
+/*
+ * The S2M read pointer is published to the MT7697 once this many messages or
+ * bytes have been consumed, when the queue drains or when a writer is blocked.
+ */
+static unsigned int rd_ptr_msgs = 4;
+module_param(rd_ptr_msgs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rd_ptr_msgs, "Messages read before the rd ptr is published");
+
+static unsigned int rd_ptr_bytes = 1024;
+module_param(rd_ptr_bytes, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rd_ptr_bytes, "Bytes read before the rd ptr is published");
+
 static ssize_t mt7697q_buf_diff(u32 size, u32 from, u32 to)
 {
 	if (from >= size) {
@@ -91,8 +106,10 @@ static int mt7697q_pull_rd_ptr(struct mt7697q_spec *qs)
 
 	dev_dbg(qs->qinfo->dev, "%s(): queue(%u) addr(0x%08x)\n",
 	        __func__, qs->ch, read_addr);
+	mutex_lock(&qs->qinfo->mutex);
 	ret = mt7697io_rd(qs->qinfo, read_addr, &rd_offset,
 	                  LEN_TO_WORD(sizeof(rd_offset)));
+	mutex_unlock(&qs->qinfo->mutex);
 	if (ret < 0) {
 		dev_err(qs->qinfo->dev, "%s(): mt7697io_rd() failed(%d)\n",
 		        __func__, ret);
@@ -115,6 +132,7 @@ static int mt7697q_push_rd_ptr(struct mt7697q_spec *qs)
 	u32 rd_offset;
 	int ret;
 
+	mutex_lock(&qs->mutex);
 	mutex_lock(&qs->qinfo->mutex);
 	dev_dbg(qs->qinfo->dev, "%s(): rd ptr/offset(0x%08x/%u)\n",
 	        __func__, write_addr, qs->data.rd_offset);
@@ -144,8 +162,37 @@ static int mt7697q_push_rd_ptr(struct mt7697q_spec *qs)
 		goto cleanup;
 	}
 
+	qs->rd_pend_msgs = 0;
+	qs->rd_pend_words = 0;
+	atomic_inc(&qs->qinfo->stats.rd_ptr_push);
+	atomic_inc(&qs->qinfo->stats.intr);
+
 cleanup:
 	mutex_unlock(&qs->qinfo->mutex);
+	mutex_unlock(&qs->mutex);
+	return ret;
+}
+
+static bool mt7697q_rd_ptr_due(const struct mt7697q_spec *qs)
+{
+	return (qs->rd_pend_msgs >= rd_ptr_msgs) ||
+	       (qs->rd_pend_words * sizeof(u32) >= rd_ptr_bytes) ||
+	       mt7697q_blocked_writer(qs);
+}
+
+static int mt7697q_flush_rd_ptr(struct mt7697q_spec *qs)
+{
+	int ret = 0;
+
+	if (qs->rd_pend_msgs || qs->rd_pend_words) {
+		ret = mt7697q_push_rd_ptr(qs);
+		if (ret < 0) {
+			dev_err(qs->qinfo->dev,
+			        "%s(): mt7697q_push_rd_ptr() failed(%d)\n",
+			        __func__, ret);
+		}
+	}
+
 	return ret;
 }
 
@@ -157,6 +204,7 @@ static int mt7697q_pull_wr_ptr(struct mt7697q_spec *qs)
 	u32 wr_offset;
 	int ret;
 
+	mutex_lock(&qs->mutex);
 	mutex_lock(&qs->qinfo->mutex);
 
 	dev_dbg(qs->qinfo->dev, "%s(): queue(%u) addr(0x%08x)\n",
@@ -175,6 +223,7 @@ static int mt7697q_pull_wr_ptr(struct mt7697q_spec *qs)
 
 cleanup:
 	mutex_unlock(&qs->qinfo->mutex);
+	mutex_unlock(&qs->mutex);
 	return ret;
 }
 
@@ -190,6 +239,7 @@ static int mt7697q_push_wr_ptr(struct mt7697q_spec *qs)
 	        __func__, write_addr, qs->data.wr_offset);
 
 	wr_offset = qs->data.wr_offset;
+	mutex_lock(&qs->qinfo->mutex);
 	ret = mt7697io_wr(qs->qinfo, write_addr, &wr_offset,
 	                  LEN_TO_WORD(sizeof(wr_offset)));
 	if (ret < 0) {
@@ -214,7 +264,11 @@ static int mt7697q_push_wr_ptr(struct mt7697q_spec *qs)
 		goto cleanup;
 	}
 
+	atomic_inc(&qs->qinfo->stats.wr_ptr_push);
+	atomic_inc(&qs->qinfo->stats.intr);
+
 cleanup:
+	mutex_unlock(&qs->qinfo->mutex);
 	return ret;
 }
 
@@ -222,6 +276,7 @@ static int mt7697q_read_state(u8 ch, struct mt7697q_spec *qs)
 {
 	int ret;
 
+	mutex_lock(&qs->mutex);
 	mutex_lock(&qs->qinfo->mutex);
 
 	ret = mt7697io_rd(
@@ -260,6 +315,7 @@ static int mt7697q_read_state(u8 ch, struct mt7697q_spec *qs)
 
 cleanup:
 	mutex_unlock(&qs->qinfo->mutex);
+	mutex_unlock(&qs->mutex);
 	return ret;
 }
 
@@ -267,7 +323,7 @@ static int mt7697q_proc_queue_rsp(struct mt7697q_spec *qs)
 {
 	int ret = 0;
 
-	switch(qs->qinfo->rsp.cmd.type) {
+	switch(qs->rsp.cmd.type) {
 	case MT7697_CMD_QUEUE_INIT_RSP:
 		dev_dbg(qs->qinfo->dev, "%s(): --> QUEUE INIT RSP\n",
 		        __func__);
@@ -280,7 +336,7 @@ static int mt7697q_proc_queue_rsp(struct mt7697q_spec *qs)
 
 	default:
 		dev_err(qs->qinfo->dev, "%s(): unsupported cmd(%d)\n",
-		        __func__, qs->qinfo->rsp.cmd.type);
+		        __func__, qs->rsp.cmd.type);
 		ret = -EINVAL;
 		goto cleanup;
 	}
@@ -377,16 +433,16 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 	}
 
 	avail = mt7697q_get_num_words(qsS2M);
-	req = (qsS2M->qinfo->rsp.cmd.len > 0) ?
-		LEN_TO_WORD(qsS2M->qinfo->rsp.cmd.len -
+	req = (qsS2M->rsp.cmd.len > 0) ?
+		LEN_TO_WORD(qsS2M->rsp.cmd.len -
 		            sizeof(struct mt7697_rsp_hdr)) :
 		LEN_TO_WORD(sizeof(struct mt7697_rsp_hdr));
 	dev_dbg(qsS2M->qinfo->dev, "%s(): avail(%u) len(%u) req(%u)\n",
-	        __func__, avail, qsS2M->qinfo->rsp.cmd.len, req);
+	        __func__, avail, qsS2M->rsp.cmd.len, req);
 
 	while (avail >= req) {
-		if (!qsS2M->qinfo->rsp.cmd.len) {
-			ret = mt7697q_read(qsS2M, (u32*)&qsS2M->qinfo->rsp,
+		if (!qsS2M->rsp.cmd.len) {
+			ret = mt7697q_read(qsS2M, (u32*)&qsS2M->rsp,
 			                   req);
 			if (ret != req) {
 				dev_err(qsS2M->qinfo->dev,
@@ -396,18 +452,18 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 			}
 
 			avail -= LEN_TO_WORD(sizeof(struct mt7697_rsp_hdr));
-			req = LEN_TO_WORD(qsS2M->qinfo->rsp.cmd.len -
+			req = LEN_TO_WORD(qsS2M->rsp.cmd.len -
 			                  sizeof(struct mt7697_rsp_hdr));
 			dev_dbg(qsS2M->qinfo->dev,
 			        "%s(): avail(%u) len(%u) req(%u)\n", __func__,
-			        avail, qsS2M->qinfo->rsp.cmd.len, req);
+			        avail, qsS2M->rsp.cmd.len, req);
 		}
 
-		if (qsS2M->qinfo->rsp.result < 0) {
+		if (qsS2M->rsp.result < 0) {
 			dev_warn(qsS2M->qinfo->dev,
 			         "%s(): cmd(%u) result(%d)\n",
-			         __func__, qsS2M->qinfo->rsp.cmd.type,
-			         qsS2M->qinfo->rsp.result);
+			         __func__, qsS2M->rsp.cmd.type,
+			         qsS2M->rsp.result);
 		}
 
 		if (avail < req) {
@@ -423,14 +479,14 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 		}
 
 		dev_dbg(qsS2M->qinfo->dev, "%s(): avail(%u) len(%u) req(%u)\n",
-		        __func__, avail, qsS2M->qinfo->rsp.cmd.len, req);
+		        __func__, avail, qsS2M->rsp.cmd.len, req);
 		if (avail < req) {
 			dev_dbg(qsS2M->qinfo->dev,
 			        "%s(): queue need more data\n", __func__);
-			goto cleanup;
+			break;
 		}
 
-		if (qsS2M->qinfo->rsp.cmd.grp == MT7697_CMD_GRP_QUEUE) {
+		if (qsS2M->rsp.cmd.grp == MT7697_CMD_GRP_QUEUE) {
 			ret = mt7697q_proc_queue_rsp(qsS2M);
 			if (ret < 0) {
 				dev_err(qsS2M->qinfo->dev,
@@ -441,7 +497,7 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 		} else {
 			WARN_ON(!qsS2M->rx_fcn);
 			ret = qsS2M->rx_fcn((const struct mt7697_rsp_hdr*)
-			                    &qsS2M->qinfo->rsp, qsS2M->priv);
+			                    &qsS2M->rsp, qsS2M->priv);
 			if (ret < 0) {
 				dev_err(qsS2M->qinfo->dev,
 				        "%s(): rx_fcn() failed(%d)\n",
@@ -450,10 +506,10 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 		}
 
 		avail -= req;
-		qsS2M->qinfo->rsp.cmd.len = 0;
+		qsS2M->rsp.cmd.len = 0;
 		req = LEN_TO_WORD(sizeof(struct mt7697_rsp_hdr));
 		dev_dbg(qsS2M->qinfo->dev, "%s(): avail(%u) len(%u) req(%u)\n",
-		        __func__, avail, qsS2M->qinfo->rsp.cmd.len, req);
+		        __func__, avail, qsS2M->rsp.cmd.len, req);
 
 		if (avail < req) {
 			ret = mt7697q_pull_wr_ptr(qsS2M);
@@ -466,7 +522,13 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 
 			avail = mt7697q_get_num_words(qsS2M);
 			dev_dbg(qsS2M->qinfo->dev, "%s(): avail(%u) len(%u) req(%u)\n",
-			        __func__, avail, qsS2M->qinfo->rsp.cmd.len, req);
+			        __func__, avail, qsS2M->rsp.cmd.len, req);
+		}
+
+		qsS2M->rd_pend_msgs++;
+		if (!mt7697q_rd_ptr_due(qsS2M)) {
+			atomic_inc(&qsS2M->qinfo->stats.rd_ptr_defer);
+			continue;
 		}
 
 		ret =  mt7697q_push_rd_ptr(qsS2M);
@@ -478,7 +540,20 @@ int mt7697q_proc_data(struct mt7697q_spec *qsS2M)
 		}
 	}
 
+	/* Queue drained, publish whatever has been consumed so far */
+	ret = mt7697q_flush_rd_ptr(qsS2M);
+	if (ret < 0) {
+		dev_err(qsS2M->qinfo->dev,
+		        "%s(): mt7697q_flush_rd_ptr() failed(%d)\n",
+		        __func__, ret);
+		goto cleanup;
+	}
+
 cleanup:
+	/* Let the consumer hand off everything rx_fcn() queued in this pass */
+	if (qsS2M->rx_done_fcn)
+		qsS2M->rx_done_fcn(qsS2M->priv);
+
 	return ret;
 }
 
@@ -531,7 +606,7 @@ int mt7697q_init(u8 tx_ch, u8 rx_ch, void *priv, notify_tx_hndlr notify_tx_fcn,
 	struct device *dev;
 	struct spi_device *spi;
 	struct mt7697q_info *qinfo;
-	struct mt7697q_spec *qsTx, *qsRx;
+	struct mt7697q_spec *qsTx = NULL, *qsRx = NULL;
 	int bus_num = MT7697_SPI_BUS_NUM;
 	int ret;
 
@@ -637,8 +712,16 @@ int mt7697q_init(u8 tx_ch, u8 rx_ch, void *priv, notify_tx_hndlr notify_tx_fcn,
 
 cleanup:
 	if (ret < 0) {
-		memset(&qsTx, 0, sizeof(struct mt7697q_spec));
-		memset(&qsRx, 0, sizeof(struct mt7697q_spec));
+		/* Leave the queue mutexes intact, they outlive the handles */
+		if (qsTx) {
+			memset(&qsTx->data, 0, sizeof(qsTx->data));
+			memset(&qsTx->rsp, 0, sizeof(qsTx->rsp));
+		}
+
+		if (qsRx) {
+			memset(&qsRx->data, 0, sizeof(qsRx->data));
+			memset(&qsRx->rsp, 0, sizeof(qsRx->rsp));
+		}
 	}
 
 	return ret;
@@ -678,7 +761,7 @@ size_t mt7697q_read(void *hndl, u32 *buf, size_t num)
 	u32 buff_words;
 	int ret;
 
-	mutex_lock(&qs->qinfo->mutex);
+	mutex_lock(&qs->mutex);
 
 	buff_words = BF_GET(qs->data.flags,
 	                    MT7697_QUEUE_FLAGS_NUM_WORDS_OFFSET,
@@ -698,7 +781,9 @@ size_t mt7697q_read(void *hndl, u32 *buf, size_t num)
 		dev_dbg(qs->qinfo->dev,
 		        "%s(): rd(%u) queue(%u) rd offset(%u) addr(0x%08x)\n",
 		        __func__, rd_num, qs->ch, read_offset, rd_addr);
+		mutex_lock(&qs->qinfo->mutex);
 		ret = mt7697io_rd(qs->qinfo, rd_addr, &buf[rd_words], rd_num);
+		mutex_unlock(&qs->qinfo->mutex);
 		if (ret < 0) {
 			dev_err(qs->qinfo->dev,
 			        "%s(): mt7697io_rd() failed(%d)\n",
@@ -730,7 +815,9 @@ size_t mt7697q_read(void *hndl, u32 *buf, size_t num)
 		dev_dbg(qs->qinfo->dev,
 		        "%s(): rd(%u) queue(%u) rd offset(%u) addr(0x%08x)\n",
 		        __func__, rd_num, qs->ch, read_offset, rd_addr);
+		mutex_lock(&qs->qinfo->mutex);
 		ret = mt7697io_rd(qs->qinfo, rd_addr, &buf[rd_words], rd_num);
+		mutex_unlock(&qs->qinfo->mutex);
 		if (ret < 0) {
 			dev_err(qs->qinfo->dev,
 			        "%s(): mt7697io_rd() failed(%d)\n",
@@ -753,27 +840,21 @@ size_t mt7697q_read(void *hndl, u32 *buf, size_t num)
 	dev_dbg(qs->qinfo->dev, "%s(): queue(%u) rd offset(%u) read(%u)\n",
 	        __func__, qs->ch, read_offset, rd_words);
 	qs->data.rd_offset = read_offset;
+	qs->rd_pend_words += rd_words;
 
 	ret = rd_words;
 
 cleanup:
-	mutex_unlock(&qs->qinfo->mutex);
+	mutex_unlock(&qs->mutex);
 	return ret;
 }
 
 EXPORT_SYMBOL(mt7697q_read);
 
-size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
+static int mt7697q_wr_reserve(struct mt7697q_spec *qs, size_t num)
 {
-	struct mt7697q_spec *qs = (struct mt7697q_spec*)hndl;
 	size_t avail;
-	size_t words_written = 0;
-	u16 read_offset;
-	u16 write_offset;
-	uint32_t buff_words;
-	int ret;
-
-	mutex_lock(&qs->qinfo->mutex);
+	int ret = 0;
 
 	avail = mt7697q_get_free_words(qs);
 	dev_dbg(qs->qinfo->dev, "%s(): free words(%u)\n", __func__, avail);
@@ -786,6 +867,7 @@ size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
 			goto cleanup;
 		}
 
+		avail = mt7697q_get_free_words(qs);
 		if (avail < num) {
 			dev_dbg(qs->qinfo->dev, "%s(): queue avail(%u < %u)\n",
 			        __func__, avail, num);
@@ -795,6 +877,19 @@ size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
 		}
 	}
 
+cleanup:
+	return ret;
+}
+
+static int mt7697q_wr_data(struct mt7697q_spec *qs, const u32 *buff,
+                           size_t num)
+{
+	size_t words_written = 0;
+	u16 read_offset;
+	u16 write_offset;
+	uint32_t buff_words;
+	int ret;
+
 	buff_words = BF_GET(qs->data.flags, MT7697_QUEUE_FLAGS_NUM_WORDS_OFFSET,
 	                    MT7697_QUEUE_FLAGS_NUM_WORDS_WIDTH);
 
@@ -815,8 +910,10 @@ size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
 		        "%s(): wr(%u) queue(%u) wr offset(%u) addr(0x%08x)\n",
 		        __func__, words_to_write, qs->ch, write_offset,
 		        write_addr);
+		mutex_lock(&qs->qinfo->mutex);
 		ret = mt7697io_wr(qs->qinfo, write_addr, &buff[words_written],
 		                  words_to_write);
+		mutex_unlock(&qs->qinfo->mutex);
 		if (ret < 0) {
 			dev_err(qs->qinfo->dev,
 			        "%s(): mt7697io_wr() failed(%d)\n",
@@ -843,8 +940,10 @@ size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
 		        "%s(): wr(%u) queue(%u) wr offset(%u) addr(0x%08x)\n",
 		        __func__, words_to_write, qs->ch, write_offset,
 		        write_addr);
+		mutex_lock(&qs->qinfo->mutex);
 		ret = mt7697io_wr(qs->qinfo, write_addr, &buff[words_written],
 		                  words_to_write);
+		mutex_unlock(&qs->qinfo->mutex);
 		if (ret < 0) {
 			dev_err(qs->qinfo->dev,
 			        "%s(): mt7697io_wr() failed(%d)\n",
@@ -868,7 +967,33 @@ size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
 	dev_dbg(qs->qinfo->dev, "%s(): queue(%u) wr offset(%u) write(%u)\n",
 	        __func__, qs->ch, write_offset, words_written);
 	qs->data.wr_offset = write_offset;
+	ret = words_written;
 
+cleanup:
+	return ret;
+}
+
+size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
+{
+	struct mt7697q_spec *qs = (struct mt7697q_spec*)hndl;
+	size_t words_written;
+	int ret;
+
+	mutex_lock(&qs->mutex);
+
+	ret = mt7697q_wr_reserve(qs, num);
+	if (ret < 0)
+		goto cleanup;
+
+	ret = mt7697q_wr_data(qs, buff, num);
+	if (ret < 0) {
+		dev_err(qs->qinfo->dev,
+		        "%s(): mt7697q_wr_data() failed(%d)\n",
+		        __func__, ret);
+		goto cleanup;
+	}
+
+	words_written = ret;
 	ret = mt7697q_push_wr_ptr(qs);
 	if (ret < 0) {
 		dev_err(qs->qinfo->dev,
@@ -880,12 +1005,99 @@ size_t mt7697q_write(void *hndl, const u32 *buff, size_t num)
 	ret = words_written;
 
 cleanup:
-	mutex_unlock(&qs->qinfo->mutex);
+	mutex_unlock(&qs->mutex);
 	return ret;
 }
 
 EXPORT_SYMBOL(mt7697q_write);
 
+/*
+ * Write as many whole messages from iov as the queue has room for and publish
+ * them with a single write pointer update.  Returns the number of messages
+ * written.
+ */
+int mt7697q_writev(void *hndl, const struct mt7697_iov *iov, size_t cnt)
+{
+	struct mt7697q_spec *qs = (struct mt7697q_spec*)hndl;
+	size_t written = 0;
+	int ret = 0;
+
+	mutex_lock(&qs->mutex);
+
+	while (written < cnt) {
+		ret = mt7697q_wr_reserve(qs, iov[written].num);
+		if (ret < 0)
+			break;
+
+		ret = mt7697q_wr_data(qs, iov[written].buf, iov[written].num);
+		if (ret < 0) {
+			dev_err(qs->qinfo->dev,
+			        "%s(): mt7697q_wr_data() failed(%d)\n",
+			        __func__, ret);
+			break;
+		}
+
+		written++;
+	}
+
+	if (!written)
+		goto cleanup;
+
+	ret = mt7697q_push_wr_ptr(qs);
+	if (ret < 0) {
+		dev_err(qs->qinfo->dev,
+		        "%s(): mt7697q_push_wr_ptr() failed(%d)\n",
+		        __func__, ret);
+		goto cleanup;
+	}
+
+	ret = written;
+
+cleanup:
+	mutex_unlock(&qs->mutex);
+	return ret;
+}
+
+EXPORT_SYMBOL(mt7697q_writev);
+
+void mt7697q_set_rx_done(void *hndl, rx_done_hndlr rx_done_fcn)
+{
+	struct mt7697q_spec *qs = (struct mt7697q_spec*)hndl;
+
+	mutex_lock(&qs->mutex);
+	qs->rx_done_fcn = rx_done_fcn;
+	mutex_unlock(&qs->mutex);
+}
+
+EXPORT_SYMBOL(mt7697q_set_rx_done);
+
+void mt7697q_debugfs_init(struct mt7697q_info *qinfo)
+{
+	qinfo->debugfs = debugfs_create_dir(DRVNAME, NULL);
+	if (IS_ERR_OR_NULL(qinfo->debugfs)) {
+		dev_warn(qinfo->dev, "%s(): debugfs_create_dir() failed\n",
+		         __func__);
+		qinfo->debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_atomic_t("rd_ptr_push", S_IRUGO, qinfo->debugfs,
+	                        &qinfo->stats.rd_ptr_push);
+	debugfs_create_atomic_t("rd_ptr_defer", S_IRUGO, qinfo->debugfs,
+	                        &qinfo->stats.rd_ptr_defer);
+	debugfs_create_atomic_t("wr_ptr_push", S_IRUGO, qinfo->debugfs,
+	                        &qinfo->stats.wr_ptr_push);
+	debugfs_create_atomic_t("intr", S_IRUGO, qinfo->debugfs,
+	                        &qinfo->stats.intr);
+	mt7697q_irq_debugfs_init(qinfo);
+}
+
+void mt7697q_debugfs_remove(struct mt7697q_info *qinfo)
+{
+	debugfs_remove_recursive(qinfo->debugfs);
+	qinfo->debugfs = NULL;
+}
+
 u32 mt7697q_flags_get_in_use(u32 flags)
 {
 	return BF_GET(flags, MT7697_QUEUE_FLAGS_IN_USE_OFFSET,
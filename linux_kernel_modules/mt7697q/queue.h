@@ -18,6 +18,7 @@
 #define _MT7697_QUEUE_H_
 
 #include <linux/types.h>
+#include <linux/hrtimer.h>
 #include <linux/interrupt.h>
 #include "queue_i.h"
 
@@ -34,6 +35,9 @@
 
 #define MT7697_QUEUE_DEBUG_DUMP_LIMIT 		1024
 
+/* log2 usecs from interrupt/poll timer to worker, last bucket open ended */
+#define MT7697Q_IRQ_LATENCY_BUCKETS		16
+
 struct mt7697q_data {
 	u32 flags;
 	u32 base_addr;
@@ -45,32 +49,50 @@ struct mt7697q_data {
 
 struct mt7697q_spec {
 	struct mt7697q_data             data;
+	struct mt7697_rsp_hdr           rsp;
 	struct mt7697q_info             *qinfo;
 	void                            *priv;
 	notify_tx_hndlr                 notify_tx_fcn;
 	rx_hndlr                        rx_fcn;
+	rx_done_hndlr                   rx_done_fcn;
+	u32                             rd_pend_msgs;
+	u32                             rd_pend_words;
+	struct mutex                    mutex;  /* queue state, taken before qinfo->mutex */
 	u8                              ch;
 };
 
+/* Bumped from the IRQ worker and the writers, not all under one lock */
+struct mt7697q_stats {
+	atomic_t                        rd_ptr_push;
+	atomic_t                        rd_ptr_defer;
+	atomic_t                        wr_ptr_push;
+	atomic_t                        intr;
+	atomic_t                        busy_polls;
+};
+
 struct mt7697q_info {
 	struct mt7697q_spec             queues[MT7697_NUM_QUEUES];
-	struct mt7697_rsp_hdr           rsp;
 
 	struct device                   *dev;
 	void                            *hw_priv;
 	const struct mt7697spi_hw_ops   *hw_ops;
 
-	struct mutex                    mutex;
+	struct mutex                    mutex;  /* SPI slave register access */
 	struct workqueue_struct         *irq_workq;
 
 	struct work_struct              irq_work;
-	struct delayed_work             irq_delayed_work;
+	struct hrtimer                  poll_timer;
+	bool                            polling;  /* worker rearmed by poll_timer */
+	ktime_t                         irq_ts;
+	u32                             irq_latency[MT7697Q_IRQ_LATENCY_BUCKETS];
 	atomic_t                        blocked_writer;
+	atomic_t                        stopping;
+	struct mt7697q_stats            stats;
+	struct dentry                   *debugfs;
 	int                             gpio_pin;
 	int                             irq;
 };
 
-void mt7697q_irq_delayed_work(struct work_struct*);
 void mt7697q_irq_work(struct work_struct*);
 irqreturn_t mt7697q_isr(int, void*);
 
@@ -79,4 +101,7 @@ size_t mt7697q_get_free_words(const struct mt7697q_spec*);
 int mt7697q_proc_data(struct mt7697q_spec*);
 int mt7697q_get_s2m_mbx(struct mt7697q_info*, u8*);
 
+void mt7697q_debugfs_init(struct mt7697q_info*);
+void mt7697q_debugfs_remove(struct mt7697q_info*);
+
 #endif
@@ -61,6 +61,8 @@ int mt7697q_init(u8, u8, void*, notify_tx_hndlr, rx_hndlr, void**, void**);
 int mt7697q_shutdown(void**, void**);
 size_t mt7697q_read(void*, u32*, size_t);
 size_t mt7697q_write(void*, const u32*, size_t);
+int mt7697q_writev(void*, const struct mt7697_iov*, size_t);
+void mt7697q_set_rx_done(void*, rx_done_hndlr);
 
 int mt7697q_wr_reset(void*, void*);
 void mt7697q_unblock_writer(void*);
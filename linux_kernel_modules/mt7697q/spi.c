@@ -80,6 +80,7 @@ static int __init mt7697spi_init(void)
 	struct mt7697q_info *qinfo = NULL;
 	int bus_num = MT7697_SPI_BUS_NUM;
 	int ret = 0;
+	u8 ch;
 
 	pr_info(DRVNAME" %s(): '%s' initialize\n", __func__, DRVNAME);
 
@@ -143,8 +144,11 @@ static int __init mt7697spi_init(void)
 	qinfo->hw_ops = &hw_ops;
 
 	mutex_init(&qinfo->mutex);
-	INIT_DELAYED_WORK(&qinfo->irq_delayed_work, mt7697q_irq_delayed_work);
+	for (ch = 0; ch < MT7697_NUM_QUEUES; ch++)
+		mutex_init(&qinfo->queues[ch].mutex);
 	INIT_WORK(&qinfo->irq_work, mt7697q_irq_work);
+	hrtimer_init(&qinfo->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	qinfo->poll_timer.function = mt7697q_poll_timer;
 
 	qinfo->irq_workq = alloc_workqueue(DRVNAME"wq",
 	                                   WQ_HIGHPRI | WQ_MEM_RECLAIM | WQ_UNBOUND, 1);
@@ -182,6 +186,7 @@ static int __init mt7697spi_init(void)
 	irq_set_irq_type(qinfo->irq, IRQ_TYPE_EDGE_BOTH);
 
 	spi_set_drvdata(spi, qinfo);
+	mt7697q_debugfs_init(qinfo);
 
 	dev_info(qinfo->dev, "%s(): '%s' initialized\n", __func__, DRVNAME);
 	return 0;
@@ -243,12 +248,17 @@ static void __exit mt7697spi_exit(void)
 	}
 
 	dev_info(qinfo->dev, "%s(): remove '%s'\n", __func__, DRVNAME);
-	cancel_delayed_work_sync(&qinfo->irq_delayed_work);
+	/* Stop the ISR, the poll timer and the worker from requeueing */
+	atomic_set(&qinfo->stopping, true);
+	free_irq(qinfo->irq, qinfo);
+
+	hrtimer_cancel(&qinfo->poll_timer);
 	cancel_work_sync(&qinfo->irq_work);
-	flush_workqueue(qinfo->irq_workq);
+	/* A worker already past the stopping check may have rearmed the timer */
+	hrtimer_cancel(&qinfo->poll_timer);
 	destroy_workqueue(qinfo->irq_workq);
 
-	free_irq(qinfo->irq, qinfo);
+	mt7697q_debugfs_remove(qinfo);
 	if (qinfo->gpio_pin > 0) gpio_free(qinfo->gpio_pin);
 	kfree(qinfo);
 
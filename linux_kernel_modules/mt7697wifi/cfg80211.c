@@ -1270,6 +1270,10 @@ struct wireless_dev* mt7697_interface_add(struct mt7697_cfg80211_info *cfg,
 		INIT_LIST_HEAD(&vif->sta_list);
 		vif->sta_max = MT7697_MAX_STA;
 
+		skb_queue_head_init(&vif->rx_skb_queue);
+		netif_napi_add(ndev, &vif->napi, mt7697_rx_poll,
+			       MT7697_NAPI_WEIGHT);
+
 		ndev->addr_assign_type = NET_ADDR_PERM;
 		ndev->addr_len = ETH_ALEN;
 		ndev->dev_addr = cfg->mac_addr.addr;
@@ -1524,8 +1528,6 @@ int mt7697_cfg80211_init(struct mt7697_cfg80211_info *cfg)
 	s32 err = 0;
 
 	dev_dbg(cfg->dev, "%s(): init mt7697 cfg80211\n", __func__);
-	cfg->tx_req.cmd.grp = MT7697_CMD_GRP_80211;
-	cfg->tx_req.cmd.type = MT7697_CMD_TX_RAW;
 
 	cfg->wireless_mode = MT7697_WIFI_PHY_11ABGN_MIXED;
 
@@ -40,7 +40,11 @@
 #define MT7697_MAX_MC_FILTERS_PER_LIST 	7
 #define MT7697_MAX_COOKIE_NUM		180
 #define MT7697_TX_TIMEOUT      		10
-#define MT7697_TX_PKT_POOL_LEN		256
+#define MT7697_TX_QUEUE_LEN		256
+#define MT7697_TX_QUEUE_WAKE		(MT7697_TX_QUEUE_LEN / 2)
+#define MT7697_TX_BATCH			8
+#define MT7697_NAPI_WEIGHT		64
+#define MT7697_RX_QUEUE_LEN		256
 /* TODO update below */
 #define MT7697_DISCON_TIMER_INTVAL_MSEC (300 * 1000)
 
@@ -81,11 +85,6 @@ enum mt7697_vif_state {
 	SCHED_SCANNING,
 };
 
-struct mt7697_tx_pkt {
-	struct list_head next;
-	struct sk_buff *skb;
-};
-
 struct mt7697_cfg80211_info {
 	struct device *dev;
 	struct wiphy *wiphy;
@@ -99,15 +98,11 @@ struct mt7697_cfg80211_info {
 
 	struct work_struct init_work;
 
-	spinlock_t tx_skb_list_lock;
-	atomic_t tx_skb_pool_idx;
-	struct mt7697_tx_pkt tx_skb_pool[MT7697_TX_PKT_POOL_LEN];
 	struct sk_buff_head tx_skb_queue;
-	struct list_head tx_skb_list;
 	struct workqueue_struct *tx_workq;
 	struct work_struct tx_work;
-	struct mt7697_tx_raw_packet tx_req;
 
+	/* Sink for Rx frames with no interface to deliver them to */
 	u8 rx_data[LEN32_ALIGNED(IEEE80211_MAX_FRAME_LEN)];
 	u8 probe_data[LEN32_ALIGNED(IEEE80211_MAX_DATA_LEN)];
 
@@ -188,6 +183,9 @@ struct mt7697_vif {
 	int reconnect_flag;
 	u8 listen_intvl_t;
 
+	struct napi_struct napi;
+	struct sk_buff_head rx_skb_queue;
+
 	struct net_device_stats net_stats;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,18,44)
 	bool locally_generated;
@@ -223,7 +221,10 @@ int mt7697_notify_tx(void*, u32);
 void mt7697_tx_stop(struct mt7697_cfg80211_info*);
 void mt7697_tx_work(struct work_struct*);
 int mt7697_data_tx(struct sk_buff*, struct net_device*);
-int mt7697_rx_data(struct mt7697_cfg80211_info*, u32, u32);
+struct sk_buff *mt7697_rx_alloc_skb(struct mt7697_vif*, u32);
+int mt7697_rx_data(struct mt7697_vif*, struct sk_buff*, u32);
+int mt7697_rx_poll(struct napi_struct*, int);
+void mt7697_rx_done(void*);
 int mt7697_proc_80211cmd(const struct mt7697_rsp_hdr*, void*);
 
 void mt7697_disconnect_timer_hndlr(unsigned long);
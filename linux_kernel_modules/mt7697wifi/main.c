@@ -54,6 +54,7 @@ static int mt7697_open(struct net_device *ndev)
 	int ret = 0;
 
 	dev_dbg(cfg->dev, "%s(): open net device\n", __func__);
+	napi_enable(&vif->napi);
 
 	if (!cfg->rxq_hdl && !cfg->txq_hdl) {
 		dev_dbg(cfg->dev, "%s(): open mt7697 uart\n", __func__);
@@ -66,6 +67,7 @@ static int mt7697_open(struct net_device *ndev)
 		cfg->rxq_hdl = cfg->txq_hdl;
 	}
 
+	netdev_reset_queue(ndev);
 	set_bit(WLAN_ENABLED, &vif->flags);
 
 	if (test_bit(CONNECTED, &vif->flags)) {
@@ -87,6 +89,8 @@ static int mt7697_stop(struct net_device *ndev)
 
 	dev_dbg(cfg->dev, "%s(): stop net device\n", __func__);
 	clear_bit(WLAN_ENABLED, &vif->flags);
+	napi_disable(&vif->napi);
+	skb_queue_purge(&vif->rx_skb_queue);
 
 	ret = mt7697_cfg80211_stop(vif);
 	if (ret < 0) {
@@ -97,6 +101,10 @@ static int mt7697_stop(struct net_device *ndev)
 	}
 
 cleanup:
+	/* Let a batch in flight finish, drop what it put back, reset BQL */
+	flush_work(&cfg->tx_work);
+	mt7697_tx_stop(cfg);
+	netdev_reset_queue(ndev);
 	return ret;
 }
 
@@ -158,6 +166,8 @@ static void mt7697_init_hw_start(struct work_struct *work)
 				__func__, MT7697_MAC80211_QUEUE_TX, err);
 			goto failed;
 		}
+
+		cfg->hif_ops->set_rx_done(cfg->rxq_hdl, mt7697_rx_done);
 	} else {
 		dev_dbg(cfg->dev, "%s(): open mt7697 uart\n", __func__);
 		cfg->txq_hdl = cfg->hif_ops->open(mt7697_proc_80211cmd, cfg);
@@ -195,7 +205,9 @@ void mt7697_init_netdev(struct net_device *ndev)
 	ndev->destructor = free_netdev;
 	ndev->watchdog_timeo = MT7697_TX_TIMEOUT;
 	ndev->needed_headroom = sizeof(struct ieee80211_hdr) +
-	                        sizeof(struct mt7697_llc_snap_hdr);
+	                        sizeof(struct mt7697_llc_snap_hdr) +
+	                        sizeof(struct mt7697_tx_raw_packet);
+	ndev->needed_tailroom = sizeof(u32) - 1;
 	ndev->hw_features |= NETIF_F_IP_CSUM | NETIF_F_RXCSUM;
 }
 
@@ -233,11 +245,6 @@ static int mt7697_probe(struct platform_device *pdev)
 	spin_lock_init(&cfg->vif_list_lock);
 	INIT_LIST_HEAD(&cfg->vif_list);
 
-	spin_lock_init(&cfg->tx_skb_list_lock);
-	INIT_LIST_HEAD(&cfg->tx_skb_list);
-	atomic_set(&cfg->tx_skb_pool_idx, 0);
-	memset(cfg->tx_skb_pool, 0, sizeof(cfg->tx_skb_pool));
-
 	mt7697_to_lower(&hw_itf);
 	dev_dbg(&pdev->dev, "%s(): hw_itf('%s')\n", __func__, hw_itf);
 	if (!strcmp(hw_itf, "spi")) {
@@ -245,6 +252,8 @@ static int mt7697_probe(struct platform_device *pdev)
 		if_ops.shutdown		= mt7697q_shutdown;
 		if_ops.read		= mt7697q_read;
 		if_ops.write		= mt7697q_write;
+		if_ops.writev		= mt7697q_writev;
+		if_ops.set_rx_done	= mt7697q_set_rx_done;
 		if_ops.unblock_writer	= mt7697q_unblock_writer;
 	} else if (!strcmp(hw_itf, "uart")) {
 		if_ops.open		= mt7697_uart_open;
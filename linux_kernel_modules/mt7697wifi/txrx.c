@@ -21,220 +21,281 @@
 int mt7697_notify_tx(void* priv, u32 free)
 {
 	struct mt7697_cfg80211_info *cfg = (struct mt7697_cfg80211_info*)priv;
-	int ret = 0;
-
-	spin_lock_bh(&cfg->tx_skb_list_lock);
-	if (!list_empty(&cfg->tx_skb_list)) {
-		struct mt7697_tx_pkt *tx_pkt = list_entry(&cfg->tx_skb_list,
-			struct mt7697_tx_pkt, next);
-		if (tx_pkt->skb->len >= free) {
-			cfg->hif_ops->unblock_writer(cfg->txq_hdl);
-			ret = queue_work(cfg->tx_workq, &cfg->tx_work);
-			if (ret < 0) {
-				dev_err(cfg->dev,
-					"%s(): queue_work() failed(%d)\n",
-					__func__, ret);
-				goto cleanup;
-			}
-		}
-	}
 
-cleanup:
-	spin_unlock_bh(&cfg->tx_skb_list_lock);
-	return ret;
+	/*
+	 * Kick the worker even when the Tx queue looks empty, frames refused
+	 * with -EAGAIN may not have been put back yet.
+	 */
+	dev_dbg(cfg->dev, "%s(): free words(%u)\n", __func__, free);
+	cfg->hif_ops->unblock_writer(cfg->txq_hdl);
+	queue_work(cfg->tx_workq, &cfg->tx_work);
+
+	return 0;
 }
 
 int mt7697_data_tx(struct sk_buff *skb, struct net_device *ndev)
 {
 	struct mt7697_cfg80211_info *cfg = mt7697_priv(ndev);
 	struct mt7697_vif *vif = netdev_priv(ndev);
-	struct mt7697_tx_pkt *tx_skb;
-	int ret = 0;
+	struct mt7697_tx_raw_packet *hdr;
+	u32 len = skb->len;
 
-	dev_dbg(cfg->dev, "%s(): tx len(%u)\n", __func__, skb->len);
+	dev_dbg(cfg->dev, "%s(): tx len(%u)\n", __func__, len);
 
-	dev_dbg(cfg->dev, "%s(): headroom skb/needed(%u/%u)\n",
-		__func__, skb_headroom(skb), ndev->needed_headroom);
-	if (skb_headroom(skb) < ndev->needed_headroom) {
-		struct sk_buff *tmp_skb = skb;
-
-		skb = skb_realloc_headroom(skb, ndev->needed_headroom);
-		kfree_skb(tmp_skb);
-		if (skb == NULL) {
-			dev_dbg(cfg->dev, "%s(): tx dropped\n", __func__);
-			goto cleanup;
-		}
+	if (len < sizeof(struct ieee80211_hdr)) {
+		dev_err(cfg->dev, "%s(): invalid skb len(%u < %u)\n",
+			__func__, len, sizeof(struct ieee80211_hdr));
+		vif->net_stats.tx_errors++;
+		goto drop;
 	}
 
-	tx_skb = &cfg->tx_skb_pool[atomic_read(&cfg->tx_skb_pool_idx)];
-	if (tx_skb->skb) {
-		dev_warn(cfg->dev, "%s(): tx pool full\n",
-			__func__);
-		ret = NETDEV_TX_BUSY;
-		goto cleanup;
+	/* The TX RAW header goes in the headroom, padding in the tailroom */
+	if (skb_cow_head(skb, sizeof(*hdr))) {
+		dev_dbg(cfg->dev, "%s(): skb_cow_head() failed\n", __func__);
+		goto drop;
 	}
 
-	tx_skb->skb = skb;
-	dev_dbg(cfg->dev, "%s(): tx pkt(%u/%p)\n",
-		__func__, atomic_read(&cfg->tx_skb_pool_idx), tx_skb->skb);
-
-	atomic_inc(&cfg->tx_skb_pool_idx);
-	if (atomic_read(&cfg->tx_skb_pool_idx) >= MT7697_TX_PKT_POOL_LEN)
-		atomic_set(&cfg->tx_skb_pool_idx, 0);
-
-	spin_lock_bh(&cfg->tx_skb_list_lock);
-	list_add_tail(&tx_skb->next, &cfg->tx_skb_list);
-	spin_unlock_bh(&cfg->tx_skb_list_lock);
+	if (skb_padto(skb, LEN32_ALIGNED(len))) {
+		dev_dbg(cfg->dev, "%s(): skb_padto() failed\n", __func__);
+		vif->net_stats.tx_dropped++;
+		return NETDEV_TX_OK;
+	}
 
-	ret = queue_work(cfg->tx_workq, &cfg->tx_work);
-	if (ret < 0) {
-		dev_err(cfg->dev, "%s(): queue_work() failed(%d)\n",
-			__func__, ret);
-		ret = NETDEV_TX_BUSY;
-		goto cleanup;
+	hdr = (struct mt7697_tx_raw_packet*)skb_push(skb, sizeof(*hdr));
+	hdr->cmd.len = sizeof(*hdr) + len;
+	hdr->cmd.grp = MT7697_CMD_GRP_80211;
+	hdr->cmd.type = MT7697_CMD_TX_RAW;
+	hdr->len = len;
+
+	netdev_sent_queue(ndev, skb->len);
+	skb_queue_tail(&cfg->tx_skb_queue, skb);
+	if (skb_queue_len(&cfg->tx_skb_queue) >= MT7697_TX_QUEUE_LEN) {
+		dev_dbg(cfg->dev, "%s(): tx queue full\n", __func__);
+		set_bit(NETQ_STOPPED, &vif->flags);
+		netif_stop_queue(ndev);
 	}
 
+	queue_work(cfg->tx_workq, &cfg->tx_work);
 	return NETDEV_TX_OK;
 
-cleanup:
+drop:
 	vif->net_stats.tx_dropped++;
 	vif->net_stats.tx_aborted_errors++;
 
 	dev_kfree_skb(skb);
-	return ret;
+	return NETDEV_TX_OK;
+}
+
+static void mt7697_tx_complete(struct sk_buff *skb, int err)
+{
+	struct mt7697_vif *vif = netdev_priv(skb->dev);
+	unsigned int len = skb->len;
+
+	if (err < 0) {
+		vif->net_stats.tx_errors++;
+	} else {
+		vif->net_stats.tx_packets++;
+		vif->net_stats.tx_bytes += len - sizeof(struct mt7697_tx_raw_packet);
+	}
+
+	netdev_completed_queue(skb->dev, 1, len);
+	dev_kfree_skb(skb);
+}
+
+static void mt7697_tx_wake(struct mt7697_cfg80211_info *cfg)
+{
+	struct mt7697_vif *vif;
+
+	if (skb_queue_len(&cfg->tx_skb_queue) >= MT7697_TX_QUEUE_WAKE)
+		return;
+
+	spin_lock_bh(&cfg->vif_list_lock);
+	list_for_each_entry(vif, &cfg->vif_list, next) {
+		if (test_and_clear_bit(NETQ_STOPPED, &vif->flags))
+			netif_wake_queue(vif->ndev);
+	}
+
+	spin_unlock_bh(&cfg->vif_list_lock);
 }
 
 void mt7697_tx_work(struct work_struct *work)
 {
 	struct mt7697_cfg80211_info *cfg = container_of(work,
 		struct mt7697_cfg80211_info, tx_work);
-	struct mt7697_tx_pkt *tx_pkt, *tx_pkt_next = NULL;
-	struct ieee80211_hdr *hdr;
+	struct sk_buff *batch[MT7697_TX_BATCH];
+	struct mt7697_iov iov[MT7697_TX_BATCH];
+	size_t cnt;
+	size_t sent;
+	size_t i;
 	int ret;
 
-	list_for_each_entry_safe(tx_pkt, tx_pkt_next, &cfg->tx_skb_list, next) {
-		struct mt7697_vif *vif = netdev_priv(tx_pkt->skb->dev);
-		WARN_ON(!vif);
+	while (1) {
+		for (cnt = 0; cnt < MT7697_TX_BATCH; cnt++) {
+			batch[cnt] = skb_dequeue(&cfg->tx_skb_queue);
+			if (!batch[cnt])
+				break;
 
-		/* validate length for ether packet */
-		if (tx_pkt->skb->len < sizeof(*hdr)) {
-			dev_err(cfg->dev, "%s(): invalid skb len(%u < %u)\n",
-				__func__, tx_pkt->skb->len, sizeof(*hdr));
-			vif->net_stats.tx_errors++;
+			iov[cnt].buf = (const u32*)batch[cnt]->data;
+			iov[cnt].num = LEN_TO_WORD(batch[cnt]->len);
 		}
 
-		ret = mt7697_wr_tx_raw_packet(cfg, tx_pkt->skb->data,
-			tx_pkt->skb->len);
-		if (ret < 0) {
+		if (!cnt)
+			break;
+
+		ret = mt7697_wr_tx_raw_packets(cfg, iov, cnt);
+		if ((ret < 0) && (ret != -EAGAIN)) {
 			dev_dbg(cfg->dev,
-				"%s(): mt7697_wr_tx_raw_packet() failed(%d)\n",
+				"%s(): mt7697_wr_tx_raw_packets() failed(%d)\n",
 				__func__, ret);
-			vif->net_stats.tx_errors++;
+			for (i = 0; i < cnt; i++)
+				mt7697_tx_complete(batch[i], ret);
+			continue;
 		}
 
-		dev_dbg(cfg->dev, "%s(): tx complete pkt(%p)\n", __func__,
-			tx_pkt->skb);
-		vif->net_stats.tx_packets++;
-		vif->net_stats.tx_bytes += tx_pkt->skb->len;
-
-		spin_lock_bh(&cfg->tx_skb_list_lock);
-		list_del(&tx_pkt->next);
-		spin_unlock_bh(&cfg->tx_skb_list_lock);
+		sent = (ret < 0) ? 0 : ret;
+		for (i = 0; i < sent; i++) {
+			dev_dbg(cfg->dev, "%s(): tx complete pkt(%p)\n",
+				__func__, batch[i]);
+			mt7697_tx_complete(batch[i], 0);
+		}
 
-		__skb_queue_tail(&cfg->tx_skb_queue, tx_pkt->skb);
-		tx_pkt->skb = NULL;
+		mt7697_tx_wake(cfg);
+		if (sent < cnt) {
+			/*
+			 * Put the rest back in order. With nothing sent the
+			 * MT7697 queue is full and mt7697_notify_tx() will
+			 * reschedule the work. A partial write hides the
+			 * error that stopped it, so run again to find out.
+			 */
+			while (cnt > sent)
+				skb_queue_head(&cfg->tx_skb_queue,
+					       batch[--cnt]);
+
+			if (sent)
+				queue_work(cfg->tx_workq, &cfg->tx_work);
+			break;
+		}
 	}
-
-	__skb_queue_purge(&cfg->tx_skb_queue);
 }
 
 void mt7697_tx_stop(struct mt7697_cfg80211_info *cfg)
 {
-	struct mt7697_tx_pkt *tx_pkt, *tx_pkt_next = NULL;
+	struct sk_buff *skb;
 
-	list_for_each_entry_safe(tx_pkt, tx_pkt_next, &cfg->tx_skb_list, next) {
-		struct mt7697_vif *vif = netdev_priv(tx_pkt->skb->dev);
-		WARN_ON(!vif);
+	while ((skb = skb_dequeue(&cfg->tx_skb_queue))) {
+		struct mt7697_vif *vif = netdev_priv(skb->dev);
 
-		dev_dbg(cfg->dev, "%s(): tx drop pkt(%p)\n", __func__,
-			tx_pkt->skb);
+		dev_dbg(cfg->dev, "%s(): tx drop pkt(%p)\n", __func__, skb);
 		vif->net_stats.tx_dropped++;
-
-		spin_lock_bh(&cfg->tx_skb_list_lock);
-		list_del(&tx_pkt->next);
-		spin_unlock_bh(&cfg->tx_skb_list_lock);
+		netdev_completed_queue(skb->dev, 1, skb->len);
+		dev_kfree_skb(skb);
 	}
 }
 
-int mt7697_rx_data(struct mt7697_cfg80211_info *cfg, u32 len, u32 if_idx)
+struct sk_buff *mt7697_rx_alloc_skb(struct mt7697_vif *vif, u32 len)
 {
-	struct mt7697_vif *vif;
-	struct sk_buff *skb = NULL;
-	struct ieee80211_hdr *hdr;
-	int ret = 0;
-
-	vif = mt7697_get_vif_by_idx(cfg, if_idx);
-	if (!vif) {
-		dev_err(cfg->dev, "%s(): mt7697_get_vif_by_idx(%u) failed\n",
-			    __func__, if_idx);
-		ret = -EINVAL;
-		goto cleanup;
-	}
+	struct mt7697_cfg80211_info *cfg = vif->cfg;
+	struct sk_buff *skb;
 
 	dev_dbg(cfg->dev, "%s(): vif(%u)\n", __func__, vif->fw_vif_idx);
 	if (!(vif->ndev->flags & IFF_UP)) {
 		dev_warn(cfg->dev, "%s(): net device NOT up\n", __func__);
-		ret = -EINVAL;
-		goto cleanup;
+		return NULL;
 	}
 
-	if ((len < sizeof(*hdr)) || (len > IEEE80211_MAX_FRAME_LEN)) {
+	if ((len < sizeof(struct ieee80211_hdr)) ||
+	    (len > IEEE80211_MAX_FRAME_LEN)) {
 		dev_warn(cfg->dev, "%s(): invalid Rx frame size(%u)\n",
 			__func__, len);
 		vif->net_stats.rx_length_errors++;
-		ret = -EINVAL;
-		goto cleanup;
+		return NULL;
 	}
 
-	skb = dev_alloc_skb(len);
+	/* The queue is read in whole words straight into the skb */
+	skb = netdev_alloc_skb(vif->ndev, LEN32_ALIGNED(len));
 	if (!skb) {
-		dev_err(cfg->dev, "%s(): dev_alloc_skb() failed\n", __func__);
-		ret = -ENOMEM;
-		goto cleanup;
-	}
-
-	skb_put(skb, len);
-	memcpy(skb->data, cfg->rx_data, len);
-	skb->dev = vif->ndev;
-
-	vif->net_stats.rx_packets++;
-	vif->net_stats.rx_bytes += len;
-
-	skb->protocol = eth_type_trans(skb, skb->dev);
-	skb->ip_summed = CHECKSUM_UNNECESSARY;
-	dev_dbg(cfg->dev, "%s(): rx frame protocol(%u) type(%u)\n",
-		__func__, skb->protocol, skb->pkt_type);
-
-	ret = netif_rx_ni(skb);
-	if (ret != NET_RX_SUCCESS) {
-		if (ret == NET_RX_DROP) {
-			dev_warn(cfg->dev, "%s(): rx frame dropped\n", __func__);
-			vif->net_stats.rx_dropped++;
-			ret = 0;
-			goto cleanup;
-		}
-
-		dev_err(cfg->dev, "%s(): netif_rx_ni() failed(%d)\n", __func__,
-			ret);
-		goto cleanup;
+		dev_err(cfg->dev, "%s(): netdev_alloc_skb() failed\n",
+			__func__);
+		vif->net_stats.rx_dropped++;
+		return NULL;
 	}
 
-cleanup:
-	if (ret < 0) {
+	skb_put(skb, LEN32_ALIGNED(len));
+	return skb;
+}
+
+int mt7697_rx_data(struct mt7697_vif *vif, struct sk_buff *skb, u32 len)
+{
+	struct mt7697_cfg80211_info *cfg = vif->cfg;
+
+	skb_trim(skb, len);
+
+	if (skb_queue_len(&vif->rx_skb_queue) >= MT7697_RX_QUEUE_LEN) {
+		dev_warn(cfg->dev, "%s(): rx frame dropped\n", __func__);
 		vif->net_stats.rx_dropped++;
-		vif->net_stats.rx_errors++;
-		if (skb) dev_kfree_skb(skb);
+		dev_kfree_skb(skb);
+		return 0;
+	}
+
+	skb_queue_tail(&vif->rx_skb_queue, skb);
+
+	/* Batched interfaces schedule NAPI from mt7697_rx_done() */
+	if (!cfg->hif_ops->set_rx_done) {
+		local_bh_disable();
+		napi_schedule(&vif->napi);
+		local_bh_enable();
+	}
+
+	return 0;
+}
+
+void mt7697_rx_done(void *priv)
+{
+	struct mt7697_cfg80211_info *cfg = (struct mt7697_cfg80211_info*)priv;
+	struct mt7697_vif *vif;
+
+	/* Called from the queue worker, let the softirq run on bh enable */
+	local_bh_disable();
+	spin_lock(&cfg->vif_list_lock);
+	list_for_each_entry(vif, &cfg->vif_list, next) {
+		if (!skb_queue_empty(&vif->rx_skb_queue))
+			napi_schedule(&vif->napi);
+	}
+
+	spin_unlock(&cfg->vif_list_lock);
+	local_bh_enable();
+}
+
+int mt7697_rx_poll(struct napi_struct *napi, int budget)
+{
+	struct mt7697_vif *vif = container_of(napi, struct mt7697_vif, napi);
+	struct sk_buff *skb;
+	int done = 0;
+
+	while (done < budget) {
+		skb = skb_dequeue(&vif->rx_skb_queue);
+		if (!skb)
+			break;
+
+		vif->net_stats.rx_packets++;
+		vif->net_stats.rx_bytes += skb->len;
+
+		skb->protocol = eth_type_trans(skb, vif->ndev);
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+		dev_dbg(vif->cfg->dev, "%s(): rx frame protocol(%u) type(%u)\n",
+			__func__, skb->protocol, skb->pkt_type);
+
+		napi_gro_receive(napi, skb);
+		done++;
+	}
+
+	if (done < budget) {
+		napi_complete(napi);
+
+		/* A frame queued before completion did not reschedule */
+		if (!skb_queue_empty(&vif->rx_skb_queue))
+			napi_schedule(napi);
 	}
 
-	return ret;
+	return done;
 }
@@ -749,6 +749,9 @@ cleanup:
 static int mt7697_rx_raw(const struct mt7697_rsp_hdr* rsp,
                          struct mt7697_cfg80211_info *cfg)
 {
+	struct mt7697_vif *vif = NULL;
+	struct sk_buff *skb = NULL;
+	u32 *rd_buf = (u32*)cfg->rx_data;
 	int ret;
 
 	dev_dbg(cfg->dev, "%s(): --> RX RAW(%u)\n", __func__, rsp->cmd.len);
@@ -769,7 +772,17 @@ static int mt7697_rx_raw(const struct mt7697_rsp_hdr* rsp,
 		goto cleanup;
 	}
 
-	ret = cfg->hif_ops->read(cfg->rxq_hdl, (u32*)cfg->rx_data,
+	/* TODO: interface index come from MT7697 */
+	if (!list_empty(&cfg->vif_list))
+		vif = mt7697_get_vif_by_idx(cfg, 0);
+
+	/* Frames nobody can receive are still drained into rx_data */
+	if (vif)
+		skb = mt7697_rx_alloc_skb(vif, rsp->result);
+	if (skb)
+		rd_buf = (u32*)skb->data;
+
+	ret = cfg->hif_ops->read(cfg->rxq_hdl, rd_buf,
 		LEN_TO_WORD(LEN32_ALIGNED(rsp->result)));
 	if (ret != LEN_TO_WORD(LEN32_ALIGNED(rsp->result))) {
 		dev_err(cfg->dev, "%s(): read() failed(%d != %d)\n",
@@ -779,16 +792,15 @@ static int mt7697_rx_raw(const struct mt7697_rsp_hdr* rsp,
 		goto cleanup;
 	}
 
-//	print_hex_dump(KERN_DEBUG, DRVNAME" RX ", DUMP_PREFIX_OFFSET,
-//		16, 1, cfg->rx_data, rsp->result, 0);
-
-	if (list_empty(&cfg->vif_list)) {
-		dev_dbg(cfg->dev, "%s(): no interfaces\n", __func__);
+	if (!skb) {
+		dev_dbg(cfg->dev, "%s(): no interface for rx frame\n",
+			__func__);
+		ret = 0;
 		goto cleanup;
 	}
 
-	/* TODO: interface index come from MT7697 */
-	ret = mt7697_rx_data(cfg, rsp->result, 0);
+	ret = mt7697_rx_data(vif, skb, rsp->result);
+	skb = NULL;
 	if (ret) {
 		dev_err(cfg->dev, "%s(): mt7697_rx_data() failed(%d)\n",
 			__func__, ret);
@@ -798,6 +810,11 @@ static int mt7697_rx_raw(const struct mt7697_rsp_hdr* rsp,
 	ret = 0;
 
 cleanup:
+	if (skb) {
+		vif->net_stats.rx_errors++;
+		dev_kfree_skb(skb);
+	}
+
 	return ret;
 }
 
@@ -1475,29 +1492,40 @@ cleanup:
 	return ret;
 }
 
-int mt7697_wr_tx_raw_packet(struct mt7697_cfg80211_info* cfg,
-			    const u8* data, u32 len)
+/*
+ * Each iov entry is a complete TX RAW message built in the skb headroom.
+ * Returns the number of messages handed to the queue.
+ */
+int mt7697_wr_tx_raw_packets(struct mt7697_cfg80211_info* cfg,
+                             const struct mt7697_iov *iov, size_t cnt)
 {
+	size_t i;
 	int ret;
 
-	cfg->tx_req.cmd.len = sizeof(struct mt7697_cmd_hdr) + sizeof(len) + len;
-	cfg->tx_req.len = len;
-	WARN_ON(len > sizeof(cfg->tx_req.data));
-	memcpy(cfg->tx_req.data, data, len);
-
-	dev_dbg(cfg->dev, "%s(): <-- TX RAW PKT len(%u)\n",
-		__func__, cfg->tx_req.len);
-	ret = cfg->hif_ops->write(cfg->txq_hdl, (const u32*)&cfg->tx_req,
-		LEN_TO_WORD(LEN32_ALIGNED(cfg->tx_req.cmd.len)));
-	if (ret != LEN_TO_WORD(LEN32_ALIGNED(cfg->tx_req.cmd.len))) {
-		dev_dbg(cfg->dev, "%s(): write() failed(%d != %d)\n",
-			__func__, ret,
-			LEN_TO_WORD(LEN32_ALIGNED(cfg->tx_req.cmd.len)));
-		ret = (ret < 0) ? ret:-EIO;
+	dev_dbg(cfg->dev, "%s(): <-- TX RAW PKT cnt(%u)\n", __func__, cnt);
+	if (cfg->hif_ops->writev) {
+		ret = cfg->hif_ops->writev(cfg->txq_hdl, iov, cnt);
+		if (ret < 0) {
+			dev_dbg(cfg->dev, "%s(): writev() failed(%d)\n",
+				__func__, ret);
+		}
+
 		goto cleanup;
 	}
 
-	ret = 0;
+	for (i = 0; i < cnt; i++) {
+		ret = cfg->hif_ops->write(cfg->txq_hdl, iov[i].buf,
+			iov[i].num);
+		if (ret != iov[i].num) {
+			dev_dbg(cfg->dev, "%s(): write() failed(%d != %d)\n",
+				__func__, ret, iov[i].num);
+			ret = (ret < 0) ? ret:-EIO;
+			break;
+		}
+	}
+
+	if (i > 0)
+		ret = i;
 
 cleanup:
 	return ret;
@@ -250,7 +250,7 @@ struct mt7697_disconnect_ind {
 struct mt7697_tx_raw_packet {
 	struct mt7697_cmd_hdr cmd;
 	__be32                len;
-	u8                    data[LEN32_ALIGNED(IEEE80211_MAX_FRAME_LEN)];
+	u8                    data[];
 } __attribute__((packed, aligned(4)));
 
 struct mt7697_rx_raw_packet {
@@ -276,7 +276,8 @@ int mt7697_wr_set_security_mode_req(const struct mt7697_cfg80211_info*, u8, u8);
 int mt7697_wr_get_security_mode_req(const struct mt7697_cfg80211_info*, u32);
 int mt7697_wr_scan_stop_req(const struct mt7697_cfg80211_info*);
 int mt7697_wr_disconnect_req(const struct mt7697_cfg80211_info*, const u8*);
-int mt7697_wr_tx_raw_packet(struct mt7697_cfg80211_info*, const u8*, u32);
+int mt7697_wr_tx_raw_packets(struct mt7697_cfg80211_info*,
+                              const struct mt7697_iov*, size_t);
 int mt7697_proc_data(void*);
 
 #endif
@@ -27,10 +27,15 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/version.h>
 
+#include <linux/iio/buffer.h>
 #include <linux/iio/events.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 
 #define OPT300x_RESULT		0x00
 #define OPT300x_CONFIGURATION	0x01
@@ -237,6 +242,18 @@ struct opt300x {
 	u8			low_thresh_exp;
 
 	bool			use_irq;
+
+	/*
+	 * Continuous conversions feeding the buffer. With an IRQ, the
+	 * end-of-conversion interrupt refreshes result and fires trig.
+	 */
+	bool			buffered;
+	struct iio_trigger	*trig;
+	bool			trig_on;
+	s64			timestamp;
+
+	/* Result, padding and timestamp */
+	u32			scan[4] __aligned(8);
 };
 
 static int opt300x_find_scale(const struct opt300x *opt, int val,
@@ -286,6 +303,65 @@ static void opt300x_set_mode(struct opt300x *opt, u16 *reg, u16 mode)
 	opt->mode = mode;
 }
 
+static int opt300x_write_mode(struct opt300x *opt, u16 mode)
+{
+	int ret;
+	u16 reg;
+
+	ret = i2c_smbus_read_word_swapped(opt->client, OPT300x_CONFIGURATION);
+	if (ret < 0) {
+		dev_err(opt->dev, "failed to read register %02x\n",
+				OPT300x_CONFIGURATION);
+		return ret;
+	}
+
+	reg = ret;
+	opt300x_set_mode(opt, &reg, mode);
+
+	ret = i2c_smbus_write_word_swapped(opt->client, OPT300x_CONFIGURATION,
+			reg);
+	if (ret < 0) {
+		dev_err(opt->dev, "failed to write register %02x\n",
+				OPT300x_CONFIGURATION);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Enables the end-of-conversion interrupt mechanism, or disables it by
+ * restoring the low-level limit value. Note that selectively clearing the
+ * OPT300x_LOW_LIMIT_EOC_ENABLE bits would affect the actual limit value
+ * due to bit-overlap and therefore can't be done.
+ */
+static int opt300x_set_eoc(struct opt300x *opt, bool enable)
+{
+	int ret;
+	u16 value;
+
+	if (enable)
+		value = OPT300x_LOW_LIMIT_EOC_ENABLE;
+	else
+		value = (opt->low_thresh_exp << 12) | opt->low_thresh_mantissa;
+
+	ret = i2c_smbus_write_word_swapped(opt->client, OPT300x_LOW_LIMIT,
+					   value);
+	if (ret < 0) {
+		dev_err(opt->dev, "failed to write register %02x\n",
+				OPT300x_LOW_LIMIT);
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Linear value of a result register, in units of the scale attribute */
+static u32 opt300x_result_to_raw(u16 result)
+{
+	return OPT300x_REG_MANTISSA(result) << OPT300x_REG_EXPONENT(result);
+}
+
 static IIO_CONST_ATTR_INT_TIME_AVAIL("0.1 0.8");
 
 static struct attribute *opt300x_attributes[] = {
@@ -316,9 +392,17 @@ static const struct iio_chan_spec opt300x_channels[] = {
 	{
 		.type = IIO_LIGHT,
 		.info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) |
+				BIT(IIO_CHAN_INFO_SCALE) |
 				BIT(IIO_CHAN_INFO_INT_TIME),
 		.event_spec = opt300x_event_spec,
 		.num_event_specs = ARRAY_SIZE(opt300x_event_spec),
+		.scan_index = 0,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 32,
+			.storagebits = 32,
+			.endianness = IIO_CPU,
+		},
 	},
 	IIO_CHAN_SOFT_TIMESTAMP(1),
 };
@@ -329,7 +413,6 @@ static int opt300x_get_lux(struct opt300x *opt, int *val, int *val2)
 	u16 mantissa;
 	u16 reg;
 	u8 exponent;
-	u16 value;
 	long timeout;
 
 	if (opt->use_irq) {
@@ -338,14 +421,9 @@ static int opt300x_get_lux(struct opt300x *opt, int *val, int *val2)
 		 * doing so will overwrite the low-level limit value however we
 		 * will restore this value later on.
 		 */
-		ret = i2c_smbus_write_word_swapped(opt->client,
-					OPT300x_LOW_LIMIT,
-					OPT300x_LOW_LIMIT_EOC_ENABLE);
-		if (ret < 0) {
-			dev_err(opt->dev, "failed to write register %02x\n",
-					OPT300x_LOW_LIMIT);
+		ret = opt300x_set_eoc(opt, true);
+		if (ret < 0)
 			return ret;
-		}
 
 		/* Allow IRQ to access the device despite lock being set */
 		opt->ok_to_ignore_lock = true;
@@ -420,22 +498,10 @@ err:
 		return ret;
 
 	if (opt->use_irq) {
-		/*
-		 * Disable the end-of-conversion interrupt mechanism by
-		 * restoring the low-level limit value (clearing
-		 * OPT300x_LOW_LIMIT_EOC_ENABLE). Note that selectively clearing
-		 * those enable bits would affect the actual limit value due to
-		 * bit-overlap and therefore can't be done.
-		 */
-		value = (opt->low_thresh_exp << 12) | opt->low_thresh_mantissa;
-		ret = i2c_smbus_write_word_swapped(opt->client,
-						   OPT300x_LOW_LIMIT,
-						   value);
-		if (ret < 0) {
-			dev_err(opt->dev, "failed to write register %02x\n",
-					OPT300x_LOW_LIMIT);
+		/* Disable the end-of-conversion interrupt mechanism */
+		ret = opt300x_set_eoc(opt, false);
+		if (ret < 0)
 			return ret;
-		}
 	}
 
 	exponent = OPT300x_REG_EXPONENT(opt->result);
@@ -446,6 +512,46 @@ err:
 	return IIO_VAL_INT_PLUS_MICRO;
 }
 
+/*
+ * Reads the latest result of continuous conversions without waiting for a
+ * new one. With an IRQ the buffer mode keeps a cached copy up to date.
+ */
+static int opt300x_get_latest_result(struct opt300x *opt, u16 *result)
+{
+	int ret;
+
+	if (opt->buffered && opt->result_ready) {
+		*result = opt->result;
+		return 0;
+	}
+
+	ret = i2c_smbus_read_word_swapped(opt->client, OPT300x_RESULT);
+	if (ret < 0) {
+		dev_err(opt->dev, "failed to read register %02x\n",
+				OPT300x_RESULT);
+		return ret;
+	}
+
+	*result = ret;
+
+	return 0;
+}
+
+static int opt300x_get_latest_lux(struct opt300x *opt, int *val, int *val2)
+{
+	int ret;
+	u16 result;
+
+	ret = opt300x_get_latest_result(opt, &result);
+	if (ret < 0)
+		return ret;
+
+	opt300x_to_iio_ret(opt, OPT300x_REG_EXPONENT(result),
+			OPT300x_REG_MANTISSA(result), val, val2);
+
+	return IIO_VAL_INT_PLUS_MICRO;
+}
+
 static int opt300x_get_int_time(struct opt300x *opt, int *val, int *val2)
 {
 	*val = 0;
@@ -492,9 +598,6 @@ static int opt300x_read_raw(struct iio_dev *iio,
 	struct opt300x *opt = iio_priv(iio);
 	int ret;
 
-	if (opt->mode == OPT300x_CONFIGURATION_M_CONTINUOUS)
-		return -EBUSY;
-
 	if (chan->type != IIO_LIGHT)
 		return -EINVAL;
 
@@ -502,7 +605,20 @@ static int opt300x_read_raw(struct iio_dev *iio,
 
 	switch (mask) {
 	case IIO_CHAN_INFO_PROCESSED:
-		ret = opt300x_get_lux(opt, val, val2);
+		/*
+		 * Continuous conversions run for the buffer or the threshold
+		 * events, the latest result is returned straight away.
+		 */
+		if (opt->mode == OPT300x_CONFIGURATION_M_CONTINUOUS)
+			ret = opt300x_get_latest_lux(opt, val, val2);
+		else
+			ret = opt300x_get_lux(opt, val, val2);
+		break;
+	case IIO_CHAN_INFO_SCALE:
+		/* Turns buffered values into the processed ones */
+		*val = opt->chip->multiplier_numerator;
+		*val2 = opt->chip->multiplier_denominator;
+		ret = IIO_VAL_FRACTIONAL;
 		break;
 	case IIO_CHAN_INFO_INT_TIME:
 		ret = opt300x_get_int_time(opt, val, val2);
@@ -622,6 +738,12 @@ static int opt300x_write_event_value(struct iio_dev *iio,
 		goto err;
 	}
 
+	/* Restored when the buffer stops using the end-of-conversion IRQ */
+	if (reg == OPT300x_LOW_LIMIT && opt->buffered && opt->use_irq) {
+		ret = 0;
+		goto err;
+	}
+
 	ret = i2c_smbus_write_word_swapped(opt->client, reg, value);
 	if (ret < 0) {
 		dev_err(opt->dev, "failed to write register %02x\n", reg);
@@ -640,7 +762,8 @@ static int opt300x_read_event_config(struct iio_dev *iio,
 {
 	struct opt300x *opt = iio_priv(iio);
 
-	return opt->mode == OPT300x_CONFIGURATION_M_CONTINUOUS;
+	return opt->mode == OPT300x_CONFIGURATION_M_CONTINUOUS &&
+		!opt->buffered;
 }
 
 static int opt300x_write_event_config(struct iio_dev *iio,
@@ -650,7 +773,10 @@ static int opt300x_write_event_config(struct iio_dev *iio,
 	struct opt300x *opt = iio_priv(iio);
 	int ret;
 	u16 mode;
-	u16 reg;
+
+	/* The buffer owns the conversions and the low-limit register */
+	if (opt->buffered)
+		return -EBUSY;
 
 	if (state && opt->mode == OPT300x_CONFIGURATION_M_CONTINUOUS)
 		return 0;
@@ -663,22 +789,80 @@ static int opt300x_write_event_config(struct iio_dev *iio,
 	mode = state ? OPT300x_CONFIGURATION_M_CONTINUOUS
 		: OPT300x_CONFIGURATION_M_SHUTDOWN;
 
-	ret = i2c_smbus_read_word_swapped(opt->client, OPT300x_CONFIGURATION);
-	if (ret < 0) {
-		dev_err(opt->dev, "failed to read register %02x\n",
-				OPT300x_CONFIGURATION);
+	ret = opt300x_write_mode(opt, mode);
+
+	mutex_unlock(&opt->lock);
+
+	return ret;
+}
+
+static irqreturn_t opt300x_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *iio = pf->indio_dev;
+	struct opt300x *opt = iio_priv(iio);
+	s64 timestamp = pf->timestamp;
+	u16 result;
+	int ret;
+
+	mutex_lock(&opt->lock);
+	ret = opt300x_get_latest_result(opt, &result);
+	/* Chained from the IRQ thread, so the top half did not run */
+	if (iio->trig == opt->trig)
+		timestamp = opt->timestamp;
+	mutex_unlock(&opt->lock);
+	if (ret < 0)
+		goto done;
+
+	opt->scan[0] = opt300x_result_to_raw(result);
+	iio_push_to_buffers_with_timestamp(iio, opt->scan, timestamp);
+done:
+	iio_trigger_notify_done(iio->trig);
+	return IRQ_HANDLED;
+}
+
+static int opt300x_trig_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *iio = iio_trigger_get_drvdata(trig);
+	struct opt300x *opt = iio_priv(iio);
+
+	opt->trig_on = state;
+
+	return 0;
+}
+
+static const struct iio_trigger_ops opt300x_trigger_ops = {
+	.set_trigger_state = opt300x_trig_set_state,
+	.validate_device = iio_trigger_validate_own_device,
+};
+
+static int opt300x_buffer_preenable(struct iio_dev *iio)
+{
+	struct opt300x *opt = iio_priv(iio);
+	int ret;
+
+	mutex_lock(&opt->lock);
+
+	/* Threshold events already run continuous conversions */
+	if (opt->mode == OPT300x_CONFIGURATION_M_CONTINUOUS) {
+		ret = -EBUSY;
 		goto err;
 	}
 
-	reg = ret;
-	opt300x_set_mode(opt, &reg, mode);
+	if (opt->use_irq) {
+		ret = opt300x_set_eoc(opt, true);
+		if (ret < 0)
+			goto err;
+	}
 
-	ret = i2c_smbus_write_word_swapped(opt->client, OPT300x_CONFIGURATION,
-			reg);
+	opt->result_ready = false;
+	opt->buffered = true;
+
+	ret = opt300x_write_mode(opt, OPT300x_CONFIGURATION_M_CONTINUOUS);
 	if (ret < 0) {
-		dev_err(opt->dev, "failed to write register %02x\n",
-				OPT300x_CONFIGURATION);
-		goto err;
+		opt->buffered = false;
+		if (opt->use_irq)
+			opt300x_set_eoc(opt, false);
 	}
 
 err:
@@ -687,6 +871,31 @@ err:
 	return ret;
 }
 
+static int opt300x_buffer_postdisable(struct iio_dev *iio)
+{
+	struct opt300x *opt = iio_priv(iio);
+	int ret;
+
+	mutex_lock(&opt->lock);
+
+	ret = opt300x_write_mode(opt, OPT300x_CONFIGURATION_M_SHUTDOWN);
+	if (!ret && opt->use_irq)
+		ret = opt300x_set_eoc(opt, false);
+	opt->buffered = false;
+	opt->result_ready = false;
+
+	mutex_unlock(&opt->lock);
+
+	return ret;
+}
+
+static const struct iio_buffer_setup_ops opt300x_buffer_setup_ops = {
+	.preenable = opt300x_buffer_preenable,
+	.postenable = iio_triggered_buffer_postenable,
+	.predisable = iio_triggered_buffer_predisable,
+	.postdisable = opt300x_buffer_postdisable,
+};
+
 static const struct iio_info opt300x_info = {
 	.attrs = &opt300x_attribute_group,
 	.read_raw = opt300x_read_raw,
@@ -800,10 +1009,21 @@ static int opt300x_configure(struct opt300x *opt)
 	return 0;
 }
 
+static irqreturn_t opt300x_irq_handler(int irq, void *_iio)
+{
+	struct iio_dev *iio = _iio;
+	struct opt300x *opt = iio_priv(iio);
+
+	opt->timestamp = iio_get_time_ns();
+
+	return IRQ_WAKE_THREAD;
+}
+
 static irqreturn_t opt300x_irq(int irq, void *_iio)
 {
 	struct iio_dev *iio = _iio;
 	struct opt300x *opt = iio_priv(iio);
+	bool poll_trig = false;
 	int ret;
 
 	if (!opt->ok_to_ignore_lock)
@@ -816,7 +1036,20 @@ static irqreturn_t opt300x_irq(int irq, void *_iio)
 		goto out;
 	}
 
-	if ((ret & OPT300x_CONFIGURATION_M_MASK) ==
+	if (opt->buffered) {
+		if (!(ret & OPT300x_CONFIGURATION_CRF))
+			goto out;
+
+		ret = i2c_smbus_read_word_swapped(opt->client, OPT300x_RESULT);
+		if (ret < 0) {
+			dev_err(opt->dev, "failed to read register %02x\n",
+					OPT300x_RESULT);
+			goto out;
+		}
+		opt->result = ret;
+		opt->result_ready = true;
+		poll_trig = opt->trig_on;
+	} else if ((ret & OPT300x_CONFIGURATION_M_MASK) ==
 			OPT300x_CONFIGURATION_M_CONTINUOUS) {
 		if (ret & OPT300x_CONFIGURATION_FH)
 			iio_push_event(iio,
@@ -846,6 +1079,14 @@ out:
 	if (!opt->ok_to_ignore_lock)
 		mutex_unlock(&opt->lock);
 
+	/* The trigger handler takes the lock itself */
+	if (poll_trig)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+		iio_trigger_poll_chained(opt->trig);
+#else
+		iio_trigger_poll_chained(opt->trig, opt->timestamp);
+#endif
+
 	return IRQ_HANDLED;
 }
 
@@ -889,20 +1130,29 @@ static int opt300x_probe(struct i2c_client *client,
 	iio->modes = INDIO_DIRECT_MODE;
 	iio->info = &opt300x_info;
 
-	ret = devm_iio_device_register(dev, iio);
-	if (ret) {
-		dev_err(dev, "failed to register IIO device\n");
-		return ret;
-	}
-
 	/* Make use of INT pin only if valid IRQ no. is given */
 	if (irq > 0) {
-		ret = request_threaded_irq(irq, NULL, opt300x_irq,
+		opt->trig = devm_iio_trigger_alloc(dev, "%s-dev%d", iio->name,
+						   iio->id);
+		if (!opt->trig)
+			return -ENOMEM;
+
+		opt->trig->dev.parent = dev;
+		opt->trig->ops = &opt300x_trigger_ops;
+		iio_trigger_set_drvdata(opt->trig, iio);
+		ret = iio_trigger_register(opt->trig);
+		if (ret) {
+			dev_err(dev, "failed to register trigger\n");
+			return ret;
+		}
+
+		ret = request_threaded_irq(irq, opt300x_irq_handler,
+				opt300x_irq,
 				IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
 				"opt300x", iio);
 		if (ret) {
 			dev_err(dev, "failed to request IRQ #%d\n", irq);
-			return ret;
+			goto err_trigger_unregister;
 		}
 		opt->use_irq = true;
 		dev_info(opt->dev,"enabling interrupt based operation");
@@ -910,38 +1160,48 @@ static int opt300x_probe(struct i2c_client *client,
 		dev_info(opt->dev, "enabling interrupt-less operation\n");
 	}
 
+	ret = iio_triggered_buffer_setup(iio, iio_pollfunc_store_time,
+					 opt300x_trigger_handler,
+					 &opt300x_buffer_setup_ops);
+	if (ret) {
+		dev_err(dev, "iio triggered buffer setup failed\n");
+		goto err_free_irq;
+	}
+
+	ret = iio_device_register(iio);
+	if (ret) {
+		dev_err(dev, "failed to register IIO device\n");
+		goto err_buffer_cleanup;
+	}
+
 	return 0;
+
+err_buffer_cleanup:
+	iio_triggered_buffer_cleanup(iio);
+err_free_irq:
+	if (opt->use_irq)
+		free_irq(irq, iio);
+err_trigger_unregister:
+	if (opt->trig)
+		iio_trigger_unregister(opt->trig);
+	return ret;
 }
 
 static int opt300x_remove(struct i2c_client *client)
 {
 	struct iio_dev *iio = i2c_get_clientdata(client);
 	struct opt300x *opt = iio_priv(iio);
-	int ret;
-	u16 reg;
+
+	iio_device_unregister(iio);
+	iio_triggered_buffer_cleanup(iio);
 
 	if (opt->use_irq)
 		free_irq(client->irq, iio);
 
-	ret = i2c_smbus_read_word_swapped(opt->client, OPT300x_CONFIGURATION);
-	if (ret < 0) {
-		dev_err(opt->dev, "failed to read register %02x\n",
-				OPT300x_CONFIGURATION);
-		return ret;
-	}
-
-	reg = ret;
-	opt300x_set_mode(opt, &reg, OPT300x_CONFIGURATION_M_SHUTDOWN);
+	if (opt->trig)
+		iio_trigger_unregister(opt->trig);
 
-	ret = i2c_smbus_write_word_swapped(opt->client, OPT300x_CONFIGURATION,
-			reg);
-	if (ret < 0) {
-		dev_err(opt->dev, "failed to write register %02x\n",
-				OPT300x_CONFIGURATION);
-		return ret;
-	}
-
-	return 0;
+	return opt300x_write_mode(opt, OPT300x_CONFIGURATION_M_SHUTDOWN);
 }
 
 static const struct i2c_device_id opt300x_id[] = {